@@ -0,0 +1,73 @@
+#ifndef BACKOFF_C
+#define BACKOFF_C
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Randomized exponential backoff for CAS retry loops
+ *
+ * After a failed CAS a thread spins for a random number of pauses below its
+ * current limit, then doubles the limit up to backoff_max. Spreading the
+ * retries out stops every thread from hitting the same line again at once.
+ * Both limits are plain globals so tests and bench can tune them before any
+ * threads start; backoff_max = 0 turns it off.
+ */
+
+unsigned backoff_min = 16;   // Pauses allowed after the first failure
+unsigned backoff_max = 4096; // Cap on the limit
+
+typedef struct Backoff {
+    unsigned limit;
+} Backoff;
+
+_Thread_local uint32_t backoff_seed = 0;
+
+/**
+ * CPU hint for spin loops
+ */
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#else
+    atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+/**
+ * Starts a retry loop at the minimum limit
+ */
+static inline void backoff_init(Backoff* b) {
+    b->limit = backoff_min < backoff_max ? backoff_min : backoff_max;
+}
+
+/**
+ * Pauses to wait this round, and grows the limit for the next one
+ */
+static inline unsigned backoff_next(Backoff* b) {
+    if (b->limit == 0) {
+        return 0;
+    }
+    if (backoff_seed == 0) { // xorshift seed, different per thread
+        backoff_seed = (uint32_t)(uintptr_t)&backoff_seed | 1;
+    }
+    backoff_seed ^= backoff_seed << 13;
+    backoff_seed ^= backoff_seed >> 17;
+    backoff_seed ^= backoff_seed << 5;
+    unsigned spins = backoff_seed % b->limit + 1;
+    b->limit = b->limit * 2 < backoff_max ? b->limit * 2 : backoff_max;
+    return spins;
+}
+
+/**
+ * Spins for the next backoff round
+ */
+static inline void backoff_pause(Backoff* b) {
+    for (unsigned i = backoff_next(b); i > 0; i--) {
+        cpu_relax();
+    }
+}
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef BATCH_C
+#define BATCH_C
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+
+/*
+ * Helpers for the insert_many/delete_many/contains_many batch calls
+ *
+ * A batch is sorted in place once up front. After that a pass over the list
+ * can look up any node's value with a binary search, or a sorted list can be
+ * walked in step with the batch. Results go into a bool array the caller
+ * hands in, indexed like the sorted keys, so a batch never allocates.
+ */
+
+/**
+ * qsort compare for ints
+ */
+int batch_compare(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Sorts a batch in place
+ */
+void batch_sort(int* keys, int n) {
+    qsort(keys, n, sizeof(int), batch_compare);
+}
+
+/**
+ * Index of the first key >= data in a sorted batch
+ */
+static inline int batch_lower_bound(const int* keys, int n, int data) {
+    int lo = 0;
+    int hi = n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (keys[mid] < data) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * First copy of data in the batch that isn't done yet, -1 if there's none
+ * So a batch with k copies of a key gets to claim k nodes
+ */
+static inline int batch_claim(const int* keys, int n, int data, const bool* done) {
+    for (int i = batch_lower_bound(keys, n, data); i < n && keys[i] == data; i++) {
+        if (!done[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Key streams for list_bulk_load()
+ *
+ * A stream hands out n keys one at a time, either straight from an array or
+ * read from a file descriptor STREAM_CHUNK keys at a time, so a load never
+ * needs the whole input in memory. A file holds raw ints in host byte order.
+ */
+
+#define STREAM_CHUNK 4096
+
+typedef struct KeyStream {
+    const int* keys;    // Array source, NULL when reading fd
+    int fd;
+    long left;          // Keys still to hand out
+    int buf[STREAM_CHUNK];
+    int pos;
+    int len;
+    bool failed;        // Read error or the file ran out early
+} KeyStream;
+
+/**
+ * Streams n keys from an array
+ */
+void stream_array(KeyStream* stream, const int* keys, long n) {
+    stream->keys = keys;
+    stream->fd = -1;
+    stream->left = n > 0 ? n : 0;
+    stream->pos = 0;
+    stream->len = 0;
+    stream->failed = false;
+}
+
+/**
+ * Streams n keys read from fd
+ */
+void stream_fd(KeyStream* stream, int fd, long n) {
+    stream_array(stream, NULL, n);
+    stream->fd = fd;
+}
+
+/**
+ * Refills the buffer from fd, false on error or end of file
+ */
+static bool stream_fill(KeyStream* stream) {
+    size_t want = (stream->left < STREAM_CHUNK ? stream->left : STREAM_CHUNK) * sizeof(int);
+    size_t got = 0;
+    while (got < want) {
+        ssize_t r = read(stream->fd, (char*)stream->buf + got, want - got);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            break;
+        }
+        got += r;
+    }
+    stream->pos = 0;
+    stream->len = got / sizeof(int);
+    return stream->len > 0;
+}
+
+/**
+ * Next key, false once n were handed out or the input failed
+ */
+static inline bool stream_next(KeyStream* stream, int* key) {
+    if (stream->left == 0) {
+        return false;
+    }
+    if (stream->keys != NULL) {
+        *key = *stream->keys++;
+    } else {
+        if (stream->pos == stream->len && !stream_fill(stream)) {
+            stream->failed = true;
+            return false;
+        }
+        *key = stream->buf[stream->pos++];
+    }
+    stream->left--;
+    return true;
+}
+
+#endif
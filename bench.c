@@ -0,0 +1,476 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+ * Throughput/latency benchmark
+ *
+ * Built once per implementation (see the bench-* targets in the Makefile).
+ * Each run prefills the list, then lets T threads hammer it with a fixed
+ * insert/delete/search mix for a fixed time, sweeping T = 1, 2, 4 .. N.
+ * Every operation is timed into a per-thread log-linear histogram, and the
+ * report has ops/sec plus p50/p99/p99.9 per operation type, as CSV or JSON.
+ */
+
+bool bench_adaptive = false; // -a, only the lists with list_set_adaptive() look at it
+double bench_filter = 0;     // -f false positive rate, 0 = no filter, same lists plus list_set_filter()
+long bench_filter_keys = 0;  // Filter sized for the key range
+
+#if defined(BENCH_LOCK_FREE)
+#include "lock-free.c"
+#define BENCH_NAME "lock-free"
+List list;
+void bench_init(void) {
+    list_init(&list);
+    list_set_adaptive(&list, bench_adaptive);
+    list_set_filter(&list, bench_filter > 0 ? bench_filter_keys : 0, bench_filter);
+}
+void bench_insert(int v) { insert_begin(&list, v); }
+bool bench_delete(int v) { return try_delete(&list, v); } // delete_node() minus its not-found printf
+bool bench_contains(int v) { return contains(&list, v); }
+void bench_reset(void) { ebr_drain(); free_list(&list); bench_init(); } // free_list() drops the filter
+
+#elif defined(BENCH_HASH_SET)
+#include "hash-set.c"
+#define BENCH_NAME "hash-set"
+List list;
+void bench_init(void) { list_init(&list); }
+void bench_insert(int v) { insert_begin(&list, v); }
+bool bench_delete(int v) { return delete_node(&list, v); }
+bool bench_contains(int v) { return contains(&list, v); }
+void bench_reset(void) { ebr_drain(); free_list(&list); }
+
+#elif defined(BENCH_SHARDED)
+#include "sharded-list.c"
+#define BENCH_NAME "sharded-list"
+ShardedList list;
+void bench_init(void) { sharded_init(&list, SHARD_HASH, 0, 0, 0); } // One shard per core
+void bench_insert(int v) { sharded_insert(&list, v); }
+bool bench_delete(int v) { return sharded_delete(&list, v); }
+bool bench_contains(int v) { return sharded_contains(&list, v); }
+void bench_reset(void) { ebr_drain(); sharded_free(&list); bench_init(); }
+
+#elif defined(BENCH_QUEUE)
+#include "queue.c"
+#define BENCH_NAME "queue"
+Queue queue; // insert enqueues, delete dequeues, search peeks, the key doesn't matter
+void bench_init(void) { queue_init(&queue); }
+void bench_insert(int v) { enqueue(&queue, v); }
+bool bench_delete(int v) { (void)v; return try_dequeue(&queue, &v); }
+bool bench_contains(int v) { return queue_peek(&queue, &v); }
+void bench_reset(void) { ebr_drain(); queue_free(&queue); queue_init(&queue); }
+
+#elif defined(BENCH_SKIP_LIST)
+#include "skip-list.c"
+#define BENCH_NAME "skip-list"
+SkipList list;
+void bench_init(void) { skip_list_init(&list); }
+void bench_insert(int v) { insert(&list, v); }
+bool bench_delete(int v) { return delete_node(&list, v); }
+bool bench_contains(int v) { return contains(&list, v); }
+void bench_reset(void) { ebr_drain(); free_list(&list); skip_list_init(&list); }
+
+#elif defined(BENCH_UNROLLED)
+#include "unrolled-list.c"
+#define BENCH_NAME "unrolled-list"
+List list;
+void bench_init(void) { list_init(&list, LIST_RWLOCK); }
+void bench_insert(int v) { insert_node(&list, v); }
+bool bench_delete(int v) { return delete_node(&list, v); }
+bool bench_contains(int v) { return contains(&list, v); }
+void bench_reset(void) { free_list(&list); }
+
+#else
+#include "linked-list.c"
+#ifndef BENCH_LIST_MODE
+#define BENCH_LIST_MODE LIST_RWLOCK
+#define BENCH_NAME "linked-list"
+#elif !defined(BENCH_NAME)
+#define BENCH_NAME "lazy-list" // Other modes pass their own name
+#endif
+List list;
+void bench_init(void) {
+    list_init(&list, BENCH_LIST_MODE);
+    list_set_adaptive(&list, bench_adaptive);
+    list_set_filter(&list, bench_filter > 0 ? bench_filter_keys : 0, bench_filter);
+}
+void bench_insert(int v) { insert_node(&list, v); }
+bool bench_delete(int v) { return delete_node(&list, v); }
+bool bench_contains(int v) { return contains(&list, v); }
+void bench_reset(void) { ebr_drain(); list_destroy(&list); bench_init(); } // list_destroy() drops the filter
+#endif
+
+#define OP_INSERT 0
+#define OP_DELETE 1
+#define OP_SEARCH 2
+#define OP_TYPES 3
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+const char* op_names[OP_TYPES] = { "insert", "delete", "search" };
+
+/**
+ * Benchmark settings, filled from the command line
+ */
+typedef struct {
+    int max_threads;
+    int mix[OP_TYPES];   // Percent of each op type
+    int key_range;
+    int prefill;
+    double duration;     // Seconds per thread count
+    double zipf_theta;   // 0 = uniform
+    bool json;
+    bool header;
+    unsigned long seed;
+} BenchConfig;
+
+/**
+ * Per-thread results, padded so threads don't share lines
+ */
+typedef struct {
+    _Alignas(64) uint64_t ops[OP_TYPES];
+    uint32_t hist[OP_TYPES][HIST_BUCKETS];
+} ThreadStats;
+
+typedef struct {
+    int thread_id;
+    uint64_t seed;
+    ThreadStats* stats;
+} ThreadArg;
+
+BenchConfig config;
+double* zipf_cdf = NULL; // Cumulative probability of rank i, NULL for uniform
+_Atomic bool start_flag = false;
+_Atomic bool stop_flag = false;
+
+/**
+ * Nanosecond monotonic clock
+ */
+static inline uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * xorshift64*, one per thread
+ */
+static inline uint64_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+/**
+ * Log-linear bucket for a latency, 16 sub-buckets per power of two
+ */
+static inline int hist_bucket(uint64_t ns) {
+    if (ns < HIST_SUB) {
+        return (int)ns;
+    }
+    int exp = 63 - __builtin_clzll(ns);
+    int sub = (int)((ns >> (exp - HIST_SUB_BITS)) & (HIST_SUB - 1));
+    return (exp - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+/**
+ * Smallest latency that lands in a bucket
+ */
+uint64_t hist_value(int bucket) {
+    if (bucket < HIST_SUB) {
+        return (uint64_t)bucket;
+    }
+    int exp = bucket / HIST_SUB + HIST_SUB_BITS - 1;
+    uint64_t sub = (uint64_t)(bucket % HIST_SUB);
+    return (1ull << exp) | (sub << (exp - HIST_SUB_BITS));
+}
+
+/**
+ * Latency at a percentile of a merged histogram
+ */
+uint64_t hist_percentile(const uint64_t* hist, uint64_t total, double pct) {
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)ceil(pct / 100.0 * (double)total);
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen >= rank) {
+            return hist_value(i);
+        }
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+/**
+ * Builds the Zipf CDF over the key range, rank 0 is the hottest key
+ */
+void init_zipf() {
+    zipf_cdf = malloc(sizeof(double) * config.key_range);
+    if (zipf_cdf == NULL) {
+        perror("malloc failed for zipf table");
+        exit(EXIT_FAILURE);
+    }
+    double sum = 0;
+    for (int i = 0; i < config.key_range; i++) {
+        sum += 1.0 / pow(i + 1, config.zipf_theta);
+        zipf_cdf[i] = sum;
+    }
+    for (int i = 0; i < config.key_range; i++) {
+        zipf_cdf[i] /= sum;
+    }
+}
+
+/**
+ * Draws a key, uniform or Zipfian depending on the config
+ */
+static inline int next_key(uint64_t* state) {
+    uint64_t r = next_random(state);
+    if (zipf_cdf == NULL) {
+        return (int)(r % (uint64_t)config.key_range);
+    }
+    double u = (double)(r >> 11) / (double)(1ull << 53);
+    int lo = 0;
+    int hi = config.key_range - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Thread implementation, runs the mix until stop_flag
+ */
+void* thread_function(void* arg) {
+    ThreadArg* thread_arg = (ThreadArg*)arg;
+    ThreadStats* stats = thread_arg->stats;
+    uint64_t state = thread_arg->seed;
+
+    while (!atomic_load_explicit(&start_flag, memory_order_acquire)) {
+        // Spin so every thread starts together
+    }
+
+    while (!atomic_load_explicit(&stop_flag, memory_order_relaxed)) {
+        int pick = (int)(next_random(&state) % 100);
+        int key = next_key(&state);
+        int op = pick < config.mix[OP_INSERT] ? OP_INSERT
+               : pick < config.mix[OP_INSERT] + config.mix[OP_DELETE] ? OP_DELETE
+               : OP_SEARCH;
+
+        uint64_t start = now_ns();
+        switch (op) {
+            case OP_INSERT:
+                bench_insert(key);
+                break;
+            case OP_DELETE:
+                bench_delete(key);
+                break;
+            case OP_SEARCH:
+                bench_contains(key);
+                break;
+        }
+        uint64_t elapsed = now_ns() - start;
+
+        stats->ops[op]++;
+        stats->hist[op][hist_bucket(elapsed)]++;
+    }
+    return NULL;
+}
+
+/**
+ * Prints one result row
+ */
+void report(int threads, const char* op, uint64_t ops, double seconds, const uint64_t* hist, bool* first) {
+    double rate = seconds > 0 ? (double)ops / seconds : 0;
+    uint64_t p50 = hist_percentile(hist, ops, 50.0);
+    uint64_t p99 = hist_percentile(hist, ops, 99.0);
+    uint64_t p999 = hist_percentile(hist, ops, 99.9);
+
+    if (config.json) {
+        printf("%s  {\"impl\": \"%s\", \"threads\": %d, \"op\": \"%s\", \"ops\": %llu, "
+               "\"ops_per_sec\": %.0f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu}",
+               *first ? "" : ",\n", BENCH_NAME, threads, op, (unsigned long long)ops, rate,
+               (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)p999);
+    } else {
+        printf("%s,%d,%s,%llu,%.0f,%llu,%llu,%llu\n", BENCH_NAME, threads, op, (unsigned long long)ops, rate,
+               (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)p999);
+    }
+    *first = false;
+}
+
+/**
+ * Prefills, runs one thread count for the configured duration, reports
+ */
+void run(int num_threads, bool* first) {
+    uint64_t state = config.seed * 0x9E3779B97F4A7C15ull + (uint64_t)num_threads;
+    for (int i = 0; i < config.prefill; i++) {
+        bench_insert(next_key(&state));
+    }
+
+    pthread_t* threads = malloc(sizeof(pthread_t) * num_threads);
+    ThreadArg* args = malloc(sizeof(ThreadArg) * num_threads);
+    ThreadStats* stats = aligned_alloc(64, sizeof(ThreadStats) * num_threads);
+    if (threads == NULL || args == NULL || stats == NULL) {
+        perror("malloc failed for threads");
+        exit(EXIT_FAILURE);
+    }
+    memset(stats, 0, sizeof(ThreadStats) * num_threads);
+
+    atomic_store(&start_flag, false);
+    atomic_store(&stop_flag, false);
+    for (int i = 0; i < num_threads; i++) {
+        args[i].thread_id = i;
+        args[i].seed = next_random(&state) | 1;
+        args[i].stats = &stats[i];
+        if (pthread_create(&threads[i], NULL, thread_function, &args[i]) != 0) {
+            perror("thread creation fail");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint64_t begin = now_ns();
+    atomic_store_explicit(&start_flag, true, memory_order_release);
+    usleep((useconds_t)(config.duration * 1e6));
+    atomic_store(&stop_flag, true);
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_join(threads[i], NULL) != 0) {
+            perror("thread join fail");
+            exit(EXIT_FAILURE);
+        }
+    }
+    double seconds = (double)(now_ns() - begin) / 1e9;
+
+    // Merge per-thread results, one row per op type plus the total
+    static uint64_t merged[OP_TYPES + 1][HIST_BUCKETS];
+    uint64_t totals[OP_TYPES + 1] = {0};
+    memset(merged, 0, sizeof(merged));
+    for (int i = 0; i < num_threads; i++) {
+        for (int op = 0; op < OP_TYPES; op++) {
+            totals[op] += stats[i].ops[op];
+            totals[OP_TYPES] += stats[i].ops[op];
+            for (int b = 0; b < HIST_BUCKETS; b++) {
+                merged[op][b] += stats[i].hist[op][b];
+                merged[OP_TYPES][b] += stats[i].hist[op][b];
+            }
+        }
+    }
+    for (int op = 0; op < OP_TYPES; op++) {
+        if (config.mix[op] > 0) {
+            report(num_threads, op_names[op], totals[op], seconds, merged[op], first);
+        }
+    }
+    report(num_threads, "all", totals[OP_TYPES], seconds, merged[OP_TYPES], first);
+    fflush(stdout);
+
+    free(threads);
+    free(args);
+    free(stats);
+    bench_reset();
+}
+
+void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-t max_threads] [-m insert:delete:search] [-r key_range] [-p prefill]\n"
+            "          [-d seconds] [-z zipf_theta] [-s seed] [-b min:max] [-a] [-f fp_rate] [-j] [-n]\n"
+            "  threads sweep 1, 2, 4 .. max_threads; -z 0 is uniform; -j prints JSON; -n skips the CSV header\n"
+            "  -b sets the CAS backoff limits in pauses (lock-free and hash set only), -b 0:0 turns it off\n"
+            "  -a moves hot keys to the front (lock-free and linked lists only)\n"
+            "  -f puts a Bloom filter with that false positive rate in front of lookups (same lists)\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    config.max_threads = cpus > 0 ? (int)cpus : 1;
+    config.mix[OP_INSERT] = 10;
+    config.mix[OP_DELETE] = 10;
+    config.mix[OP_SEARCH] = 80;
+    config.key_range = 1000;
+    config.prefill = 500;
+    config.duration = 1.0;
+    config.zipf_theta = 0;
+    config.json = false;
+    config.header = true;
+    config.seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:m:r:p:d:z:s:b:af:jn")) != -1) {
+        switch (opt) {
+            case 't': config.max_threads = atoi(optarg); break;
+            case 'm':
+                if (sscanf(optarg, "%d:%d:%d", &config.mix[OP_INSERT], &config.mix[OP_DELETE],
+                           &config.mix[OP_SEARCH]) != 3 ||
+                    config.mix[OP_INSERT] + config.mix[OP_DELETE] + config.mix[OP_SEARCH] != 100) {
+                    fprintf(stderr, "mix must be three percents adding up to 100\n");
+                    usage(argv[0]);
+                }
+                break;
+            case 'r': config.key_range = atoi(optarg); break;
+            case 'p': config.prefill = atoi(optarg); break;
+            case 'd': config.duration = atof(optarg); break;
+            case 'z': config.zipf_theta = atof(optarg); break;
+            case 's': config.seed = strtoul(optarg, NULL, 10); break;
+            case 'b':
+#ifdef BACKOFF_C
+                if (sscanf(optarg, "%u:%u", &backoff_min, &backoff_max) != 2) {
+                    usage(argv[0]);
+                }
+#endif
+                break;
+            case 'a': bench_adaptive = true; break;
+            case 'f': bench_filter = atof(optarg); break;
+            case 'j': config.json = true; break;
+            case 'n': config.header = false; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (config.max_threads < 1 || config.key_range < 1 || config.prefill < 0 || config.duration <= 0) {
+        usage(argv[0]);
+    }
+    if (config.zipf_theta > 0) {
+        init_zipf();
+    }
+    bench_filter_keys = config.key_range;
+    bench_init();
+
+    bool first = true;
+    if (config.json) {
+        printf("[\n");
+    } else if (config.header) {
+        printf("impl,threads,op,ops,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+    }
+
+    for (int t = 1; ; t *= 2) {
+        int threads = t < config.max_threads ? t : config.max_threads;
+        run(threads, &first);
+        if (threads == config.max_threads) {
+            break;
+        }
+    }
+
+    if (config.json) {
+        printf("\n]\n");
+    }
+    free(zipf_cdf);
+    pool_destroy_all(); // Every run reset its list on the way out, nothing is left in the pools
+    return 0;
+}
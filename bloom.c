@@ -0,0 +1,145 @@
+#ifndef BLOOM_C
+#define BLOOM_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <math.h>
+
+/*
+ * Counting Bloom filter for the list_set_filter() front end
+ *
+ * Answers "definitely not in the list" without walking it. Each key hashes
+ * to one 64-byte block and sets hashes counters inside it, so a lookup reads
+ * one cache line whatever the size. Counters instead of bits so deletes can
+ * take a key back out; the list keeps duplicates, so each copy counts once.
+ *
+ * The lists add a key before the node for it can be seen and remove it only
+ * after the node is deleted, so a zero counter always means absent at that
+ * instant and a filter miss is a correct answer on its own. Anything else is
+ * "maybe", and the caller walks as usual.
+ *
+ * Counters are 8 bits and stick once they hit BLOOM_STUCK, a key with that
+ * many copies (or colliding with that many) just stays "maybe" for good.
+ */
+
+#define BLOOM_BLOCK 64       // Counters per block, one cache line of them
+#define BLOOM_MAX_HASHES 10  // Probes per key, 6 bits of hash each
+#define BLOOM_STUCK 255
+
+typedef struct BloomFilter {
+    _Atomic uint8_t* counters;
+    size_t blocks;
+    int hashes;
+} BloomFilter;
+
+/**
+ * Filter sized for expected keys at roughly fp_rate false positives
+ */
+BloomFilter* bloom_create(long expected, double fp_rate) {
+    if (expected < 1) {
+        expected = 1;
+    }
+    if (fp_rate <= 0 || fp_rate >= 1) {
+        fp_rate = 0.01;
+    }
+    double per_key = -log(fp_rate) / (M_LN2 * M_LN2); // Counters per key for a plain Bloom filter
+    int hashes = (int)lround(per_key * M_LN2);
+    if (hashes < 1) {
+        hashes = 1;
+    } else if (hashes > BLOOM_MAX_HASHES) {
+        hashes = BLOOM_MAX_HASHES;
+    }
+
+    BloomFilter* filter = malloc(sizeof(BloomFilter));
+    if (filter == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    filter->blocks = (size_t)ceil(expected * per_key / BLOOM_BLOCK);
+    filter->hashes = hashes;
+    filter->counters = aligned_alloc(64, filter->blocks * BLOOM_BLOCK);
+    if (filter->counters == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    memset((void*)filter->counters, 0, filter->blocks * BLOOM_BLOCK);
+    return filter;
+}
+
+/**
+ * Frees a filter, nobody can be using it anymore
+ */
+void bloom_destroy(BloomFilter* filter) {
+    free((void*)filter->counters);
+    free(filter);
+}
+
+/**
+ * splitmix64 finalizer
+ */
+static inline uint64_t bloom_mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * Block for key, *probes gets the hash that picks the counters in it
+ */
+static inline _Atomic uint8_t* bloom_block(const BloomFilter* filter, int key, uint64_t* probes) {
+    uint64_t h = bloom_mix((uint32_t)key);
+    *probes = bloom_mix(h);
+    size_t block = (size_t)(((h >> 32) * (uint64_t)filter->blocks) >> 32);
+    return filter->counters + block * BLOOM_BLOCK;
+}
+
+/**
+ * Counts one more copy of key, call before the node can be seen
+ */
+void bloom_add(BloomFilter* filter, int key) {
+    uint64_t probes;
+    _Atomic uint8_t* block = bloom_block(filter, key, &probes);
+    for (int i = 0; i < filter->hashes; i++, probes >>= 6) {
+        _Atomic uint8_t* counter = &block[probes & (BLOOM_BLOCK - 1)];
+        uint8_t c = atomic_load(counter);
+        while (c != BLOOM_STUCK && !atomic_compare_exchange_weak(counter, &c, c + 1)) {
+        }
+    }
+}
+
+/**
+ * Counts one copy of key less, call once its node is deleted
+ */
+void bloom_remove(BloomFilter* filter, int key) {
+    uint64_t probes;
+    _Atomic uint8_t* block = bloom_block(filter, key, &probes);
+    for (int i = 0; i < filter->hashes; i++, probes >>= 6) {
+        _Atomic uint8_t* counter = &block[probes & (BLOOM_BLOCK - 1)];
+        uint8_t c = atomic_load(counter);
+        while (c != BLOOM_STUCK && c != 0 && !atomic_compare_exchange_weak(counter, &c, c - 1)) {
+        }
+    }
+}
+
+/**
+ * False if key is definitely not there, true if it might be
+ */
+bool bloom_maybe(const BloomFilter* filter, int key) {
+    uint64_t probes;
+    _Atomic uint8_t* block = bloom_block(filter, key, &probes);
+    for (int i = 0; i < filter->hashes; i++, probes >>= 6) {
+        if (atomic_load(&block[probes & (BLOOM_BLOCK - 1)]) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
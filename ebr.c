@@ -0,0 +1,231 @@
+#ifndef EBR_C
+#define EBR_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+ * Epoch-based memory reclamation
+ *
+ * Readers wrap every traversal in ebr_enter()/ebr_exit(). A node that has been
+ * unlinked is handed to ebr_retire() instead of free(), and it sits in the
+ * retiring thread's limbo list until the global epoch has moved two steps past
+ * the epoch it was retired in. The epoch can only move once every thread inside
+ * a critical section has seen the current one, so by then nobody can still be
+ * holding a pointer to it. Frees happen in batches of EBR_RETIRE_THRESHOLD.
+ *
+ * Threads register themselves the first time they enter, and give their record
+ * back when they exit (pthread key destructor).
+ */
+
+#define EBR_EPOCHS 3
+#define EBR_RETIRE_THRESHOLD 128 // Limbo size that triggers an advance + collect
+#define EBR_ACTIVE 1UL           // Low bit of a record's epoch word, set inside a critical section
+
+typedef struct EbrRetired {
+    void* ptr;
+    void (*reclaim)(void*);
+} EbrRetired;
+
+typedef struct EbrLimbo {
+    EbrRetired* items;
+    size_t count;
+    size_t capacity;
+    unsigned long epoch; // Global epoch the items were retired in
+} EbrLimbo;
+
+typedef struct EbrRecord {
+    _Alignas(64) _Atomic unsigned long epoch; // (local epoch << 1) | EBR_ACTIVE, or 0 when outside
+    _Atomic bool in_use;
+    unsigned nesting;
+    size_t pending;
+    EbrLimbo limbo[EBR_EPOCHS];
+    struct EbrRecord* next; // Registry link, records are never removed
+} EbrRecord;
+
+_Atomic unsigned long ebr_global_epoch = 0;
+_Atomic(EbrRecord*) ebr_records = NULL;
+
+pthread_key_t ebr_key;
+pthread_once_t ebr_key_once = PTHREAD_ONCE_INIT;
+_Thread_local EbrRecord* ebr_self = NULL;
+
+/**
+ * Thread exit hook, gives the record back so a later thread can reuse it
+ * Anything still in limbo goes with the record
+ */
+void ebr_thread_exit(void* arg) {
+    EbrRecord* rec = (EbrRecord*)arg;
+    rec->nesting = 0;
+    atomic_store(&rec->epoch, 0);
+    atomic_store(&rec->in_use, false);
+}
+
+void ebr_make_key(void) {
+    if (pthread_key_create(&ebr_key, ebr_thread_exit) != 0) {
+        printf("ebr key fail\n");
+        exit(1);
+    }
+}
+
+/**
+ * Claims a free record or adds a new one to the registry
+ */
+EbrRecord* ebr_register(void) {
+    pthread_once(&ebr_key_once, ebr_make_key);
+
+    EbrRecord* rec;
+    for (rec = atomic_load(&ebr_records); rec != NULL; rec = rec->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&rec->in_use, &expected, true)) {
+            break;
+        }
+    }
+
+    if (rec == NULL) {
+        rec = aligned_alloc(64, sizeof(EbrRecord));
+        if (rec == NULL) {
+            printf("malloc fail\n");
+            exit(1);
+        }
+        for (int i = 0; i < EBR_EPOCHS; i++) {
+            rec->limbo[i].items = NULL;
+            rec->limbo[i].count = 0;
+            rec->limbo[i].capacity = 0;
+            rec->limbo[i].epoch = 0;
+        }
+        rec->pending = 0;
+        atomic_init(&rec->epoch, 0);
+        atomic_init(&rec->in_use, true);
+
+        EbrRecord* head;
+        do {
+            head = atomic_load(&ebr_records);
+            rec->next = head;
+        } while (!atomic_compare_exchange_weak(&ebr_records, &head, rec));
+    }
+
+    rec->nesting = 0;
+    pthread_setspecific(ebr_key, rec);
+    ebr_self = rec;
+    return rec;
+}
+
+/**
+ * Enter a read-side critical section, nests
+ */
+void ebr_enter(void) {
+    EbrRecord* rec = ebr_self;
+    if (rec == NULL) {
+        rec = ebr_register();
+    }
+    if (rec->nesting++ == 0) {
+        unsigned long e = atomic_load(&ebr_global_epoch);
+        atomic_store(&rec->epoch, (e << 1) | EBR_ACTIVE); // seq_cst so later list loads can't float above it
+    }
+}
+
+/**
+ * Leave a read-side critical section
+ */
+void ebr_exit(void) {
+    EbrRecord* rec = ebr_self;
+    if (--rec->nesting == 0) {
+        atomic_store_explicit(&rec->epoch, 0, memory_order_release);
+    }
+}
+
+/**
+ * Frees everything in one limbo list
+ */
+void ebr_reclaim_limbo(EbrLimbo* limbo) {
+    for (size_t i = 0; i < limbo->count; i++) {
+        limbo->items[i].reclaim(limbo->items[i].ptr);
+    }
+    limbo->count = 0;
+}
+
+/**
+ * Moves the global epoch forward if every active thread has caught up to it
+ */
+bool ebr_try_advance(void) {
+    unsigned long global = atomic_load(&ebr_global_epoch);
+    for (EbrRecord* rec = atomic_load(&ebr_records); rec != NULL; rec = rec->next) {
+        unsigned long e = atomic_load(&rec->epoch);
+        if ((e & EBR_ACTIVE) && (e >> 1) != global) {
+            return false; // Someone is still reading in an older epoch
+        }
+    }
+    return atomic_compare_exchange_strong(&ebr_global_epoch, &global, global + 1);
+}
+
+/**
+ * Frees this thread's limbo lists that are at least two epochs old
+ */
+void ebr_collect(EbrRecord* rec) {
+    unsigned long global = atomic_load(&ebr_global_epoch);
+    for (int i = 0; i < EBR_EPOCHS; i++) {
+        EbrLimbo* limbo = &rec->limbo[i];
+        if (limbo->count > 0 && limbo->epoch + 2 <= global) {
+            rec->pending -= limbo->count;
+            ebr_reclaim_limbo(limbo);
+        }
+    }
+}
+
+/**
+ * Hand over an unlinked object, reclaim(ptr) runs once no reader can see it
+ * Must only be called once per object, by whoever unlinked it
+ */
+void ebr_retire(void* ptr, void (*reclaim)(void*)) {
+    EbrRecord* rec = ebr_self;
+    if (rec == NULL) {
+        rec = ebr_register();
+    }
+
+    unsigned long global = atomic_load(&ebr_global_epoch); // Read after the unlink
+    EbrLimbo* limbo = &rec->limbo[global % EBR_EPOCHS];
+    if (limbo->epoch != global) {
+        // Same slot, three or more epochs back, so it's already safe
+        rec->pending -= limbo->count;
+        ebr_reclaim_limbo(limbo);
+        limbo->epoch = global;
+    }
+
+    if (limbo->count == limbo->capacity) {
+        size_t capacity = limbo->capacity ? limbo->capacity * 2 : EBR_RETIRE_THRESHOLD;
+        EbrRetired* items = realloc(limbo->items, capacity * sizeof(EbrRetired));
+        if (items == NULL) {
+            printf("malloc fail\n");
+            exit(1);
+        }
+        limbo->items = items;
+        limbo->capacity = capacity;
+    }
+    limbo->items[limbo->count].ptr = ptr;
+    limbo->items[limbo->count].reclaim = reclaim;
+    limbo->count++;
+
+    if (++rec->pending >= EBR_RETIRE_THRESHOLD) {
+        ebr_try_advance();
+        ebr_collect(rec);
+    }
+}
+
+/**
+ * Frees every retired object of every thread
+ * Only call this when no thread is inside a critical section (e.g. after join)
+ */
+void ebr_drain(void) {
+    for (EbrRecord* rec = atomic_load(&ebr_records); rec != NULL; rec = rec->next) {
+        for (int i = 0; i < EBR_EPOCHS; i++) {
+            ebr_reclaim_limbo(&rec->limbo[i]);
+        }
+        rec->pending = 0;
+    }
+}
+
+#endif
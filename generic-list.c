@@ -0,0 +1,363 @@
+#ifndef GENERIC_LIST_C
+#define GENERIC_LIST_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "ebr.c"
+#include "node-pool.c"
+#include "size-counter.c"
+
+/*
+ * Type-generic lists, one specialization per macro expansion
+ *
+ *   DEFINE_LOCKFREE_LIST(name, KeyT, ValT, cmp, hash)   lock-free.c style
+ *   DEFINE_LOCKED_LIST(name, KeyT, ValT, cmp, hash)     linked-list.c style
+ *
+ * Both emit a node with the key and value stored inline, so there's no side
+ * table and no extra pointer chase. cmp(const KeyT*, const KeyT*) returns
+ * <0/0/>0 and hash(const KeyT*) returns an unsigned; pass macros or static
+ * inline functions and they get inlined into the walk. Nodes are kept sorted
+ * by (hash, key), so most steps are one integer compare against the cached
+ * hash and cmp only runs on a hash tie. Keys are a map: insert refuses a key
+ * that's already there.
+ *
+ * Each expansion defines the type name plus name_init, name_insert,
+ * name_delete, name_get (copies the value out), name_contains, name_count,
+ * name_for_each and name_free. The lock-free one keeps its delete mark in
+ * the low bit of next like skip-list.c, and frees through EBR.
+ *
+ * Nodes come from pool_shared() (node-pool.c), so every specialization with
+ * the same node stride shares a pool and there's no limit on how many a
+ * program makes. A node has to fit in POOL_SHARED_MAX bytes, bigger ones
+ * fail to compile. name_free only hands the nodes back, the slabs stay until
+ * process teardown.
+ */
+
+// cmp/hash for plain scalar keys
+#define GENERIC_CMP_SCALAR(a, b) ((*(a) > *(b)) - (*(a) < *(b)))
+#define GENERIC_HASH_INT(k) ((unsigned)(((uint64_t)*(k) * 0x9E3779B97F4A7C15ull) >> 32))
+
+/**
+ * FNV-1a over a fixed-size key, for strings and small structs
+ */
+static inline unsigned generic_hash_bytes(const void* key, size_t size) {
+    const unsigned char* p = key;
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+#define DEFINE_LOCKFREE_LIST(name, KeyT, ValT, cmp, hash)                               \
+                                                                                        \
+typedef struct name##_node {                                                            \
+    unsigned hash;                                                                      \
+    KeyT key;                                                                           \
+    ValT val;                                                                           \
+    _Atomic(struct name##_node*) next; /* Low bit set = deleted */                      \
+} name##_node;                                                                          \
+                                                                                        \
+typedef struct name {                                                                   \
+    _Atomic(name##_node*) head;                                                         \
+    SizeCounter size;                                                                   \
+} name;                                                                                 \
+                                                                                        \
+_Static_assert(sizeof(name##_node) <= POOL_SHARED_MAX, "node over POOL_SHARED_MAX");    \
+                                                                                        \
+static inline bool name##_is_marked(name##_node* p) {                                   \
+    return ((uintptr_t)p & 1) != 0;                                                     \
+}                                                                                       \
+                                                                                        \
+static inline name##_node* name##_unmarked(name##_node* p) {                            \
+    return (name##_node*)((uintptr_t)p & ~(uintptr_t)1);                                \
+}                                                                                       \
+                                                                                        \
+/* Where (h, key) sorts against a node, <0 means before it */                          \
+static inline int name##_order(unsigned h, const KeyT* key, name##_node* node) {        \
+    if (h != node->hash) {                                                              \
+        return h < node->hash ? -1 : 1;                                                 \
+    }                                                                                   \
+    return cmp(key, &node->key);                                                        \
+}                                                                                       \
+                                                                                        \
+void name##_reclaim(void* node) {                                                       \
+    pool_free(node);                                                                    \
+}                                                                                       \
+                                                                                        \
+void name##_init(name* list) {                                                          \
+    atomic_init(&list->head, NULL);                                                     \
+    counter_reset(&list->size);                                                         \
+}                                                                                       \
+                                                                                        \
+/* Harris-Michael find, snips marked nodes, call inside ebr_enter()/ebr_exit() */      \
+static bool name##_find(name* list, unsigned h, const KeyT* key,                        \
+                        _Atomic(name##_node*)** prev_ptr, name##_node** cur_ptr) {      \
+retry: {                                                                                \
+    _Atomic(name##_node*)* prev = &list->head;                                          \
+    name##_node* cur = atomic_load(prev);                                               \
+    while (cur != NULL) {                                                               \
+        name##_node* succ = atomic_load(&cur->next);                                    \
+        if (name##_is_marked(succ)) {                                                   \
+            name##_node* expected = cur;                                                \
+            if (!atomic_compare_exchange_strong(prev, &expected, name##_unmarked(succ))) { \
+                goto retry;                                                             \
+            }                                                                           \
+            ebr_retire(cur, name##_reclaim);                                            \
+            cur = name##_unmarked(succ);                                                \
+            continue;                                                                   \
+        }                                                                               \
+        int c = name##_order(h, key, cur);                                              \
+        if (c <= 0) {                                                                   \
+            *prev_ptr = prev;                                                           \
+            *cur_ptr = cur;                                                             \
+            return c == 0;                                                              \
+        }                                                                               \
+        prev = &cur->next;                                                              \
+        cur = succ;                                                                     \
+    }                                                                                   \
+    *prev_ptr = prev;                                                                   \
+    *cur_ptr = NULL;                                                                    \
+    return false;                                                                       \
+    }                                                                                   \
+}                                                                                       \
+                                                                                        \
+/* Lock-free insert, false if the key is already there */                              \
+bool name##_insert(name* list, KeyT key, ValT val) {                                    \
+    NodePool* pool = pool_shared(sizeof(name##_node)); /* Same stride, same pool */     \
+    name##_node* node = (name##_node*)pool_alloc(pool);                                 \
+    node->hash = hash(&key);                                                            \
+    node->key = key;                                                                    \
+    node->val = val;                                                                    \
+    _Atomic(name##_node*)* prev;                                                        \
+    name##_node* cur;                                                                   \
+                                                                                        \
+    ebr_enter();                                                                        \
+    while (true) {                                                                      \
+        if (name##_find(list, node->hash, &node->key, &prev, &cur)) {                   \
+            ebr_exit();                                                                 \
+            pool_free(node); /* Never published */                                      \
+            return false;                                                               \
+        }                                                                               \
+        atomic_store_explicit(&node->next, cur, memory_order_relaxed);                  \
+        if (atomic_compare_exchange_strong(prev, &cur, node)) {                         \
+            break;                                                                      \
+        }                                                                               \
+    }                                                                                   \
+    ebr_exit();                                                                         \
+    counter_add(&list->size, 1);                                                        \
+    return true;                                                                        \
+}                                                                                       \
+                                                                                        \
+/* Lock-free delete, marking next is the linearization point */                        \
+bool name##_delete(name* list, KeyT key) {                                              \
+    unsigned h = hash(&key);                                                            \
+    _Atomic(name##_node*)* prev;                                                        \
+    name##_node* cur;                                                                   \
+                                                                                        \
+    ebr_enter();                                                                        \
+    while (true) {                                                                      \
+        if (!name##_find(list, h, &key, &prev, &cur)) {                                 \
+            ebr_exit();                                                                 \
+            return false;                                                               \
+        }                                                                               \
+        name##_node* succ = atomic_load(&cur->next);                                    \
+        if (name##_is_marked(succ) ||                                                   \
+            !atomic_compare_exchange_strong(&cur->next, &succ,                          \
+                                            (name##_node*)((uintptr_t)succ | 1))) {     \
+            continue; /* Somebody else got it or it moved, look again */                \
+        }                                                                               \
+        name##_node* expected = cur;                                                    \
+        if (atomic_compare_exchange_strong(prev, &expected, succ)) {                    \
+            ebr_retire(cur, name##_reclaim);                                            \
+        } /* Else the next find() over it snips it */                                   \
+        ebr_exit();                                                                     \
+        counter_add(&list->size, -1);                                                   \
+        return true;                                                                    \
+    }                                                                                   \
+}                                                                                       \
+                                                                                        \
+/* Wait-free lookup, copies the value into *out if it's there */                       \
+bool name##_get(name* list, KeyT key, ValT* out) {                                      \
+    unsigned h = hash(&key);                                                            \
+    bool found = false;                                                                 \
+    ebr_enter();                                                                        \
+    name##_node* cur = atomic_load(&list->head);                                        \
+    while (cur != NULL) {                                                               \
+        name##_node* succ = atomic_load(&cur->next);                                    \
+        int c = name##_order(h, &key, cur);                                             \
+        if (c < 0) {                                                                    \
+            break;                                                                      \
+        }                                                                               \
+        if (c == 0 && !name##_is_marked(succ)) {                                        \
+            if (out != NULL) {                                                          \
+                *out = cur->val;                                                        \
+            }                                                                           \
+            found = true;                                                               \
+            break;                                                                      \
+        }                                                                               \
+        cur = name##_unmarked(succ);                                                    \
+    }                                                                                   \
+    ebr_exit();                                                                         \
+    return found;                                                                       \
+}                                                                                       \
+                                                                                        \
+bool name##_contains(name* list, KeyT key) {                                            \
+    return name##_get(list, key, NULL);                                                 \
+}                                                                                       \
+                                                                                        \
+long name##_count(name* list) {                                                         \
+    return counter_exact(&list->size);                                                  \
+}                                                                                       \
+                                                                                        \
+/* Wait-free call cb on every live entry, in (hash, key) order */                      \
+void name##_for_each(name* list, void (*cb)(const KeyT* key, const ValT* val, void* arg), void* arg) { \
+    ebr_enter();                                                                        \
+    name##_node* cur = atomic_load(&list->head);                                        \
+    while (cur != NULL) {                                                               \
+        name##_node* succ = atomic_load(&cur->next);                                    \
+        if (!name##_is_marked(succ)) {                                                  \
+            cb(&cur->key, &cur->val, arg);                                              \
+        }                                                                               \
+        cur = name##_unmarked(succ);                                                    \
+    }                                                                                   \
+    ebr_exit();                                                                         \
+}                                                                                       \
+                                                                                        \
+/* Not safe against concurrent operations, call after ebr_drain() */                   \
+void name##_free(name* list) {                                                          \
+    name##_node* cur = atomic_load(&list->head);                                        \
+    while (cur != NULL) {                                                               \
+        name##_node* next = name##_unmarked(atomic_load(&cur->next));                   \
+        pool_free(cur);                                                                 \
+        cur = next;                                                                     \
+    }                                                                                   \
+    atomic_store(&list->head, NULL);                                                    \
+    counter_reset(&list->size);                                                         \
+}
+
+#define DEFINE_LOCKED_LIST(name, KeyT, ValT, cmp, hash)                                 \
+                                                                                        \
+typedef struct name##_node {                                                            \
+    unsigned hash;                                                                      \
+    KeyT key;                                                                           \
+    ValT val;                                                                           \
+    struct name##_node* next;                                                           \
+} name##_node;                                                                          \
+                                                                                        \
+typedef struct name {                                                                   \
+    name##_node* head;                                                                  \
+    long size;                                                                          \
+    pthread_rwlock_t rwlock;                                                            \
+} name;                                                                                 \
+                                                                                        \
+_Static_assert(sizeof(name##_node) <= POOL_SHARED_MAX, "node over POOL_SHARED_MAX");    \
+                                                                                        \
+static inline int name##_order(unsigned h, const KeyT* key, name##_node* node) {        \
+    if (h != node->hash) {                                                              \
+        return h < node->hash ? -1 : 1;                                                 \
+    }                                                                                   \
+    return cmp(key, &node->key);                                                        \
+}                                                                                       \
+                                                                                        \
+void name##_init(name* list) {                                                          \
+    list->head = NULL;                                                                  \
+    list->size = 0;                                                                     \
+    pthread_rwlock_init(&list->rwlock, NULL);                                           \
+}                                                                                       \
+                                                                                        \
+/* Link that points at the first node >= (h, key), call with the lock held */          \
+static inline name##_node** name##_locate(name* list, unsigned h, const KeyT* key) {    \
+    name##_node** link = &list->head;                                                   \
+    while (*link != NULL && name##_order(h, key, *link) > 0) {                          \
+        link = &(*link)->next;                                                          \
+    }                                                                                   \
+    return link;                                                                        \
+}                                                                                       \
+                                                                                        \
+bool name##_insert(name* list, KeyT key, ValT val) {                                    \
+    unsigned h = hash(&key);                                                            \
+    pthread_rwlock_wrlock(&list->rwlock);                                               \
+    name##_node** link = name##_locate(list, h, &key);                                  \
+    if (*link != NULL && name##_order(h, &key, *link) == 0) {                           \
+        pthread_rwlock_unlock(&list->rwlock);                                           \
+        return false;                                                                   \
+    }                                                                                   \
+    NodePool* pool = pool_shared(sizeof(name##_node)); /* Same stride, same pool */     \
+    name##_node* node = (name##_node*)pool_alloc(pool);                                 \
+    node->hash = h;                                                                     \
+    node->key = key;                                                                    \
+    node->val = val;                                                                    \
+    node->next = *link;                                                                 \
+    *link = node;                                                                       \
+    list->size++;                                                                       \
+    pthread_rwlock_unlock(&list->rwlock);                                               \
+    return true;                                                                        \
+}                                                                                       \
+                                                                                        \
+bool name##_delete(name* list, KeyT key) {                                              \
+    unsigned h = hash(&key);                                                            \
+    pthread_rwlock_wrlock(&list->rwlock);                                               \
+    name##_node** link = name##_locate(list, h, &key);                                  \
+    name##_node* node = *link;                                                          \
+    bool found = node != NULL && name##_order(h, &key, node) == 0;                      \
+    if (found) {                                                                        \
+        *link = node->next;                                                             \
+        pool_free(node);                                                                \
+        list->size--;                                                                   \
+    }                                                                                   \
+    pthread_rwlock_unlock(&list->rwlock);                                               \
+    return found;                                                                       \
+}                                                                                       \
+                                                                                        \
+/* Copies the value into *out if the key is there */                                   \
+bool name##_get(name* list, KeyT key, ValT* out) {                                      \
+    unsigned h = hash(&key);                                                            \
+    pthread_rwlock_rdlock(&list->rwlock);                                               \
+    name##_node* node = *name##_locate(list, h, &key);                                  \
+    bool found = node != NULL && name##_order(h, &key, node) == 0;                      \
+    if (found && out != NULL) {                                                         \
+        *out = node->val;                                                               \
+    }                                                                                   \
+    pthread_rwlock_unlock(&list->rwlock);                                               \
+    return found;                                                                       \
+}                                                                                       \
+                                                                                        \
+bool name##_contains(name* list, KeyT key) {                                            \
+    return name##_get(list, key, NULL);                                                 \
+}                                                                                       \
+                                                                                        \
+long name##_count(name* list) {                                                         \
+    pthread_rwlock_rdlock(&list->rwlock);                                               \
+    long size = list->size;                                                             \
+    pthread_rwlock_unlock(&list->rwlock);                                               \
+    return size;                                                                        \
+}                                                                                       \
+                                                                                        \
+/* Calls cb on every entry in (hash, key) order, holds the read lock */                \
+void name##_for_each(name* list, void (*cb)(const KeyT* key, const ValT* val, void* arg), void* arg) { \
+    pthread_rwlock_rdlock(&list->rwlock);                                               \
+    for (name##_node* cur = list->head; cur != NULL; cur = cur->next) {                 \
+        cb(&cur->key, &cur->val, arg);                                                  \
+    }                                                                                   \
+    pthread_rwlock_unlock(&list->rwlock);                                               \
+}                                                                                       \
+                                                                                        \
+void name##_free(name* list) {                                                          \
+    pthread_rwlock_wrlock(&list->rwlock);                                               \
+    name##_node* cur = list->head;                                                      \
+    while (cur != NULL) {                                                               \
+        name##_node* next = cur->next;                                                  \
+        pool_free(cur);                                                                 \
+        cur = next;                                                                     \
+    }                                                                                   \
+    list->head = NULL;                                                                  \
+    list->size = 0;                                                                     \
+    pthread_rwlock_unlock(&list->rwlock);                                               \
+}
+
+#endif
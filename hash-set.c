@@ -0,0 +1,499 @@
+#define LOCK_FREE_CORE_ONLY
+#include "lock-free.c"
+
+/*
+ * Split-ordered lock-free hash set (Shalev & Shavit)
+ *
+ * Every key lives in one lock-free.c list, sorted by its bit-reversed key.
+ * With that order the keys of bucket b sit in one contiguous run, and when
+ * the table doubles, bucket b splits into b and b + size without moving a
+ * node. The directory just points at sentinel nodes inside that list.
+ * Buckets are created lazily on first touch (after their parent), so a resize
+ * is one CAS on size and the new buckets fill in as they get used.
+ *
+ * Node->data holds the split-order key, not the user key:
+ *   regular key k:  reverse(k) | 1      sentinel of bucket b:  reverse(b)
+ * flipped in the top bit so the signed compares in find() order it unsigned.
+ *
+ * Same entry points as lock-free.c on its own List, so test-lock-free.c runs
+ * against it. Keys must be >= 0 and, like insert_begin(), duplicates are kept.
+ * list_set_versioned() works the same too, only regular nodes get stamps.
+ */
+
+#define HASH_MAX_LOAD 4          // Average keys per bucket before the table doubles
+#define HASH_SEGMENT_SIZE 1024   // Buckets per directory segment
+#define HASH_MAX_SEGMENTS 4096   // So up to 4M buckets
+
+typedef struct List {
+    Node sentinel;                 // Bucket 0, the list starts here
+    _Atomic unsigned size;         // Buckets in use, power of two
+    SizeCounter count;             // Regular keys in the set
+    _Atomic(_Atomic(Node*)*) segments[HASH_MAX_SEGMENTS];
+    SnapClock snap;
+    SnapClock* stamps;             // &snap once versioned, NULL with plain nodes
+} List;
+
+static inline unsigned reverse_bits(unsigned x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    return __builtin_bswap32(x);
+}
+
+static inline int so_regular(int key) {
+    return (int)((reverse_bits((unsigned)key) | 1u) ^ 0x80000000u);
+}
+
+static inline int so_sentinel(unsigned bucket) {
+    return (int)(reverse_bits(bucket) ^ 0x80000000u);
+}
+
+static inline bool so_is_regular(int data) {
+    return (data & 1) != 0;
+}
+
+static inline int so_key(int data) {
+    return (int)reverse_bits(((unsigned)data ^ 0x80000000u) & ~1u);
+}
+
+/**
+ * Sets up an empty set with two buckets
+ */
+void list_init(List* list) {
+    _Atomic(Node*)* first = calloc(HASH_SEGMENT_SIZE, sizeof(_Atomic(Node*)));
+    if (first == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    list->sentinel.data = so_sentinel(0);
+    atomic_init(&list->sentinel.next, NULL);
+    atomic_init(&list->size, 2);
+    counter_reset(&list->count);
+    snap_init(&list->snap);
+    list->stamps = NULL;
+    for (int i = 0; i < HASH_MAX_SEGMENTS; i++) {
+        atomic_init(&list->segments[i], NULL);
+    }
+    atomic_init(&first[0], &list->sentinel);
+    atomic_init(&list->segments[0], first);
+}
+
+/**
+ * Turns snapshot versioning on or off, false if the set already has keys
+ * Set it before other threads use the set
+ */
+bool list_set_versioned(List* list, bool versioned) {
+    if (atomic_load(&list->sentinel.next) != NULL) {
+        printf("list_set_versioned: set isn't empty\n");
+        return false;
+    }
+    list->stamps = versioned ? &list->snap : NULL;
+    return true;
+}
+
+/**
+ * Directory slot of a bucket, allocates its segment on first use
+ */
+_Atomic(Node*)* bucket_slot(List* list, unsigned bucket) {
+    _Atomic(_Atomic(Node*)*)* seg_ptr = &list->segments[bucket / HASH_SEGMENT_SIZE];
+    _Atomic(Node*)* seg = atomic_load(seg_ptr);
+    if (seg == NULL) {
+        _Atomic(Node*)* fresh = calloc(HASH_SEGMENT_SIZE, sizeof(_Atomic(Node*)));
+        if (fresh == NULL) {
+            printf("malloc fail\n");
+            exit(1);
+        }
+        if (atomic_compare_exchange_strong(seg_ptr, &seg, fresh)) {
+            seg = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+    return &seg[bucket % HASH_SEGMENT_SIZE];
+}
+
+Node* get_bucket(List* list, unsigned bucket);
+
+/**
+ * Links the sentinel for a bucket, splitting it off its parent
+ * Caller must be inside ebr_enter()/ebr_exit()
+ */
+Node* initialize_bucket(List* list, unsigned bucket) {
+    unsigned parent = bucket & ~(1u << (31 - __builtin_clz(bucket))); // Drop the top set bit
+    Node* parent_node = get_bucket(list, parent);
+
+    Node* sentinel = create_node(so_sentinel(bucket));
+    _Atomic(Node*) *prev;
+    Node* cur;
+    while (true) {
+        if (find(list->stamps, &parent_node->next, sentinel->data, true, &prev, &cur)) {
+            pool_free(sentinel); // Another thread got it in first
+            sentinel = cur;
+            break;
+        }
+        atomic_store(&sentinel->next, cur);
+        if (stat_cas(STAT_SITE_INSERT_LINK, atomic_compare_exchange_strong(prev, &cur, sentinel))) {
+            break;
+        }
+    }
+
+    Node* expected = NULL;
+    atomic_compare_exchange_strong(bucket_slot(list, bucket), &expected, sentinel); // Same node either way
+    return sentinel;
+}
+
+/**
+ * Sentinel for a bucket, initializing it if this is the first touch
+ * Caller must be inside ebr_enter()/ebr_exit()
+ */
+Node* get_bucket(List* list, unsigned bucket) {
+    Node* sentinel = atomic_load(bucket_slot(list, bucket));
+    if (sentinel == NULL) {
+        sentinel = initialize_bucket(list, bucket);
+    }
+    return sentinel;
+}
+
+/**
+ * Sentinel of the bucket a key hashes to
+ */
+static inline Node* key_bucket(List* list, int data) {
+    return get_bucket(list, (unsigned)data & (atomic_load(&list->size) - 1));
+}
+
+/**
+ * Lock-free insert, keeps duplicates like the plain list
+ */
+Node* insert_begin(List* list, int data) {
+    if (data < 0) {
+        printf("hash set: negative key %d not supported\n", data);
+        return NULL;
+    }
+
+    Node* new_node = create_node_for(list->stamps, so_regular(data));
+    _Atomic(Node*) *prev;
+    Node* cur;
+
+    ebr_enter();
+    Node* bucket = key_bucket(list, data);
+    while (true) {
+        find(list->stamps, &bucket->next, new_node->data, true, &prev, &cur);
+        atomic_store(&new_node->next, cur);
+        if (stat_cas(STAT_SITE_INSERT_LINK, atomic_compare_exchange_strong(prev, &cur, new_node))) {
+            break;
+        }
+    }
+    stamp_insert(list->stamps, new_node);
+    ebr_exit();
+
+    // Grow once buckets get too long, the new ones get filled in lazily
+    // The approximate count is plenty for this and costs one load
+    counter_add(&list->count, 1);
+    long count = counter_approx(&list->count);
+    unsigned size = atomic_load(&list->size);
+    if (count / size > HASH_MAX_LOAD && size < (unsigned)HASH_SEGMENT_SIZE * HASH_MAX_SEGMENTS) {
+        atomic_compare_exchange_strong(&list->size, &size, size * 2);
+    }
+    return new_node;
+}
+
+/**
+ * Lock-free delete one copy of a key
+ */
+bool delete_node(List* list, int data) {
+    if (data < 0) {
+        return false;
+    }
+
+    ebr_enter();
+    bool deleted = delete_epoch(list->stamps, &key_bucket(list, data)->next, so_regular(data), true);
+    ebr_exit();
+
+    if (deleted) {
+        counter_add(&list->count, -1);
+    }
+    return deleted;
+}
+
+/**
+ * Wait-free return the node holding a key
+ * Its data is the split-order key, use contains() unless you need the node
+ */
+Node* search(List* list, int data) {
+    if (data < 0) {
+        return NULL;
+    }
+
+    int so = so_regular(data);
+    stat_add(STAT_OPS, 1);
+    ebr_enter();
+    Node* cur = atomic_load(&key_bucket(list, data)->next);
+    while (cur != NULL && cur->data <= so) {
+        stat_add(STAT_VISITED, 1);
+        Node* succ = atomic_load(&cur->next);
+        if (cur->data == so) {
+            if (!is_marked(succ)) {
+                stamp_insert(list->stamps, cur);
+                break;
+            }
+            stamp_delete(list->stamps, cur);
+        }
+        cur = get_unmarked(succ);
+    }
+    if (cur != NULL && cur->data != so) {
+        cur = NULL;
+    }
+    ebr_exit();
+    return cur;
+}
+
+/**
+ * Wait-free check if a key is in the set
+ */
+bool contains(List* list, int data) {
+    return search(list, data) != NULL;
+}
+
+/*
+ * Batch calls, same contract as lock-free.c. A batch spreads over buckets
+ * anyway, so these just run the single-key versions inside one epoch.
+ */
+
+/**
+ * Insert a batch of keys, sorts keys in place
+ */
+void insert_many(List* list, int* keys, int n) {
+    batch_sort(keys, n);
+    ebr_enter();
+    for (int i = 0; i < n; i++) {
+        insert_begin(list, keys[i]);
+    }
+    ebr_exit();
+}
+
+/**
+ * Delete one copy per key in a batch, sorts keys in place
+ * deleted[i] says whether keys[i] (after sorting) was there, returns how many were
+ */
+int delete_many(List* list, int* keys, int n, bool* deleted) {
+    int count = 0;
+    batch_sort(keys, n);
+    ebr_enter();
+    for (int i = 0; i < n; i++) {
+        deleted[i] = delete_node(list, keys[i]);
+        count += deleted[i];
+    }
+    ebr_exit();
+    return count;
+}
+
+/**
+ * Look up a batch of keys, sorts keys in place
+ * found[i] says whether keys[i] (after sorting) is in the set, returns how many are
+ */
+int contains_many(List* list, int* keys, int n, bool* found) {
+    int count = 0;
+    batch_sort(keys, n);
+    ebr_enter();
+    for (int i = 0; i < n; i++) {
+        found[i] = contains(list, keys[i]);
+        count += found[i];
+    }
+    ebr_exit();
+    return count;
+}
+
+/*
+ * Iterators, same modes as lock-free.c. ITER_WEAK hands keys back in split
+ * order, ITER_SNAPSHOT in ascending order.
+ */
+
+typedef struct ListIter {
+    IterMode mode;
+    Node* cur;     // ITER_WEAK: next node to look at
+    int* values;   // ITER_SNAPSHOT: the copy
+    long count;
+    long pos;
+} ListIter;
+
+/**
+ * Starts an iterator, ITER_WEAK stays in an ebr section until list_iter_end()
+ */
+void list_iter_begin(List* list, ListIter* it, IterMode mode) {
+    it->mode = mode;
+    it->cur = NULL;
+    it->values = NULL;
+    it->count = 0;
+    it->pos = 0;
+    ebr_enter();
+    if (mode == ITER_WEAK) {
+        it->cur = atomic_load(&list->sentinel.next);
+        return;
+    }
+
+    SnapBuffer buf = { NULL, 0, 0 };
+    if (list->stamps == NULL) { // No stamps to go by, copy what the walk sees
+        Node* cur = atomic_load(&list->sentinel.next);
+        while (cur != NULL) {
+            Node* succ = atomic_load(&cur->next);
+            if (so_is_regular(cur->data) && !is_marked(succ)) {
+                snap_add(&buf, cur, cur->data);
+            }
+            cur = get_unmarked(succ);
+        }
+        it->values = snap_values(&buf, &it->count);
+    } else {
+        SnapCollector* col = snap_begin(&list->snap);
+        Node* cur = atomic_load(&list->sentinel.next);
+        while (cur != NULL) {
+            Node* succ = atomic_load(&cur->next);
+            if (so_is_regular(cur->data)) {
+                unsigned ins = snap_stamp(&list->snap, &versioned_node(cur)->ins);
+                unsigned del = is_marked(succ) ? snap_stamp(&list->snap, &versioned_node(cur)->del) : 0;
+                if (snap_visible(ins, del, col->version)) {
+                    snap_add(&buf, cur, cur->data);
+                }
+            }
+            cur = get_unmarked(succ);
+        }
+        it->values = snap_finish(&list->snap, col, &buf, &it->count);
+    }
+    // Unlink reports carry the split-order key too, so decode once everything is in
+    for (long i = 0; i < it->count; i++) {
+        it->values[i] = so_key(it->values[i]);
+    }
+    qsort(it->values, it->count, sizeof(int), snap_value_compare);
+    ebr_exit();
+}
+
+/**
+ * Next key, false once there are no more
+ */
+bool list_iter_next(ListIter* it, int* data) {
+    if (it->mode == ITER_SNAPSHOT) {
+        if (it->pos == it->count) {
+            return false;
+        }
+        *data = it->values[it->pos++];
+        return true;
+    }
+    while (it->cur != NULL) {
+        Node* cur = it->cur;
+        Node* succ = atomic_load(&cur->next);
+        it->cur = get_unmarked(succ);
+        if (so_is_regular(cur->data) && !is_marked(succ)) {
+            *data = so_key(cur->data);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Done with an iterator
+ */
+void list_iter_end(ListIter* it) {
+    if (it->mode == ITER_WEAK) {
+        ebr_exit();
+    } else {
+        free(it->values);
+    }
+}
+
+/**
+ * Wait-free call cb on every key in the set, in split order
+ */
+void list_for_each(List* list, void (*cb)(int data, void* arg), void* arg) {
+    ListIter it;
+    int data;
+    list_iter_begin(list, &it, ITER_WEAK);
+    while (list_iter_next(&it, &data)) {
+        cb(data, arg);
+    }
+    list_iter_end(&it);
+}
+
+/**
+ * Print callback
+ */
+void print_key(int data, void* arg) {
+    (void)arg;
+    printf("%d -> ", data);
+}
+
+/**
+ * Wait-free print set contents
+ */
+void print_list(List* list) {
+    if (counter_exact(&list->count) == 0) {
+        printf("empty list\n");
+        return;
+    }
+    printf("List: ");
+    list_for_each(list, print_key, NULL);
+    printf("END\n");
+}
+
+/**
+ * Size from the folded estimate, one load, may lag by a few thousand
+ */
+long size_approx(List* list) {
+    long size = counter_approx(&list->count);
+    return size < 0 ? 0 : size;
+}
+
+/**
+ * Size summed over every shard
+ */
+long size_exact(List* list) {
+    return counter_exact(&list->count);
+}
+
+/**
+ * Number of keys, sums the size shards
+ */
+int count_nodes(List* list) {
+    return (int)size_exact(list);
+}
+
+/**
+ * Count callback
+ */
+void count_key(int data, void* arg) {
+    (void)data;
+    (*(long*)arg)++;
+}
+
+/**
+ * Debug check: walks the set and compares with the counters
+ * Only meaningful once all threads are done
+ */
+bool validate_size(List* list) {
+    long walked = 0;
+    list_for_each(list, count_key, &walked);
+    if (walked != size_exact(list)) {
+        printf("size mismatch: walked %ld, counter says %ld\n", walked, size_exact(list));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Free memory used by the set, leaves it empty and usable
+ * Not safe against concurrent operations, call once all threads are done
+ */
+void free_list(List* list) {
+    Node* cur = atomic_load(&list->sentinel.next); // Regular nodes and sentinels alike
+    while (cur != NULL) {
+        Node* next = get_unmarked(atomic_load(&cur->next));
+        pool_free(cur);
+        cur = next;
+    }
+    for (int i = 0; i < HASH_MAX_SEGMENTS; i++) {
+        free(atomic_load(&list->segments[i]));
+    }
+    snap_destroy(&list->snap);
+    bool versioned = list->stamps != NULL;
+    list_init(list);
+    list_set_versioned(list, versioned); // Stays how it was set up
+}
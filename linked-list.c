@@ -1,63 +1,757 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include "ebr.c"
+#include "node-pool.c"
+#include "size-counter.c"
+#include "batch.c"
+#include "stats.c"
+#include "backoff.c"
+#include "snapshot.c"
+#include "list-image.c"
+#include "bloom.c"
 
-pthread_rwlock_t list_rwlock = PTHREAD_RWLOCK_INITIALIZER; // Global reader-writer lock for thread synchronization
-// Used rw lock to try to solve sync issues, turns out the real reason was bad pointer control.  Leaving it like this because it still works
+/*
+ * Every List carries its own synchronization, so two lists never contend.
+ *
+ * LIST_RWLOCK: unordered, insert at the head, one reader-writer lock per list.
+ * Used rw lock to try to solve sync issues, turns out the real reason was bad
+ * pointer control.  Leaving it like this because it still works
+ *
+ * LIST_LAZY: lazy list (Heller et al.), kept in ascending order. Traversals
+ * take no locks at all; a writer locks just pred and cur, checks neither is
+ * marked and pred still points at cur, then does its update. Delete marks
+ * first so lock-free readers can tell, and the node is freed through EBR.
+ * Writers at different positions never wait on each other.
+ *
+ * LIST_COMBINE: same list as LIST_RWLOCK, but insert_node()/delete_node()
+ * don't queue on the write lock. A writer posts its request in its slot and
+ * tries the lock once; whoever gets it (the combiner) runs every posted
+ * request in one go: all the inserts spliced in together, all the deletes in
+ * a single walk. Everyone else just waits for their slot to say done, and
+ * takes the lock themselves if the combiner left before getting to them.
+ * Readers and the batch calls use the rwlock exactly like LIST_RWLOCK.
+ *
+ * LIST_RCU: same list as LIST_RWLOCK again, for read-mostly use. Readers
+ * take no lock and write nothing shared, they just walk inside an ebr
+ * section. Writers serialize on one mutex, fill a node in completely before
+ * a release store makes it reachable, and unlink instead of freeing: the
+ * node goes to ebr_retire() and is only freed after a grace period, once
+ * every reader that might still be standing on it has left. A reader that
+ * races a writer sees the list from just before or just after that write.
+ * ITER_SNAPSHOT takes the writer mutex for its copy, readers never wait.
+ *
+ * The unordered modes can also reorder themselves for skewed lookups, see
+ * list_set_adaptive(). Any mode can put a counting Bloom filter (bloom.c) in
+ * front of its lookups with list_set_filter(), so most misses never take the
+ * lock or walk the list.
+ *
+ * Every mode keeps sparse skip anchors, about one node in ANCHOR_GAP, so a
+ * parallel pass (list_parallel_for_each(), list_parallel_reduce(), free_list())
+ * can hand the stretches between them to a pool of workers, see below.
+ *
+ * Any mode can start out backed by a mapped image (list_open_mmap(), see
+ * list-image.c). Reads are answered from the image until the first write, or
+ * search() since it hands out nodes, promotes it: builds the nodes from the
+ * image under the write lock and drops the image through EBR.
+ */
+
+typedef enum {
+    LIST_RWLOCK,
+    LIST_LAZY,
+    LIST_COMBINE,
+    LIST_RCU
+} ListMode;
+
+#define FC_SLOTS 64 // Threads past this share slots and take turns
+
+typedef enum {
+    FC_NONE,    // Free
+    FC_CLAIMED, // Owner is filling it in
+    FC_INSERT,  // Posted, waiting for a combiner
+    FC_DELETE,
+    FC_DONE     // Combiner filled in result, owner hands the slot back
+} FcState;
 
+typedef struct FcSlot {
+    _Alignas(64) _Atomic int state;
+    int data;
+    bool result;
+} FcSlot;
+
+// 16 bytes, the flags sit in the padding after data
 typedef struct Node {
     int data;
-    struct Node* next;
+    _Atomic bool marked;    // LIST_LAZY: logically deleted
+    _Atomic bool anchor;    // In list->anchors, see list_parallel_for_each()
+    _Atomic bool locked;    // LIST_LAZY: per node spinlock, see node_lock()
+    _Atomic(struct Node*) next;
 } Node;
 
+// LIST_LAZY nodes also carry snapshot stamps (see snapshot.c), the other
+// modes snapshot under a lock and never need them
+typedef struct LazyNode {
+    Node node;
+    _Atomic unsigned ins;
+    _Atomic unsigned del;
+} LazyNode;
+
+typedef struct List {
+    _Atomic(Node*) head;    // First node, or the sentinel in LIST_LAZY
+    ListMode mode;
+    pthread_rwlock_t rwlock;
+    pthread_mutex_t writer; // LIST_RCU: writers take this, readers nothing
+    SizeCounter size;       // Live nodes, see count_nodes()
+    FcSlot fc[FC_SLOTS];    // LIST_COMBINE: posted writes
+    SnapClock snap;         // LIST_LAZY
+    _Atomic(ListImage*) image; // Mapped image not promoted yet, NULL normally
+    bool adaptive;          // Hits move to the front, see list_set_adaptive()
+    _Atomic unsigned move_seq; // Odd while a move is under way
+    BloomFilter* filter;    // Keys that might be in the list, NULL when off
+    pthread_mutex_t anchor_lock; // Held by a parallel pass, and LIST_LAZY deletes of an anchor
+    Node** anchors;         // Skip anchors, the one nearest the head last
+    int anchor_count;
+    int anchor_cap;
+    long since_anchor;      // Unordered modes: head inserts since the newest anchor
+} List;
+
+_Atomic unsigned fc_next_slot = 0;
+_Thread_local int fc_slot = -1;
+
+NodePool node_pool = NODE_POOL_INIT(Node);
+NodePool lazy_pool = NODE_POOL_INIT(LazyNode);
+
+#define NODE_LOCK_SPINS 64 // Pauses before a waiting node_lock() yields
+
+/**
+ * Sets up a freshly allocated node
+ */
+static inline Node* init_node(Node* new_node, int data) {
+    new_node->data = data;
+    atomic_store_explicit(&new_node->marked, false, memory_order_relaxed);
+    atomic_store_explicit(&new_node->anchor, false, memory_order_relaxed);
+    atomic_store_explicit(&new_node->locked, false, memory_order_relaxed);
+    atomic_store_explicit(&new_node->next, NULL, memory_order_relaxed);
+    return new_node;
+}
+
+/**
+ * Sets up a freshly allocated LIST_LAZY node, ins is where it counts as inserted
+ */
+static inline Node* init_lazy_node(LazyNode* new_node, int data, unsigned ins) {
+    atomic_store_explicit(&new_node->ins, ins, memory_order_relaxed);
+    atomic_store_explicit(&new_node->del, 0, memory_order_relaxed);
+    return init_node(&new_node->node, data);
+}
+
+/**
+ * Stamps of a LIST_LAZY node
+ */
+static inline LazyNode* lazy_node(Node* node) {
+    return (LazyNode*)node;
+}
+
 /**
  * Allocates and creates a new node object
  */
 Node* create_node(int data) {
-    Node* new_node = (Node*)malloc(sizeof(Node));
-    if (new_node == NULL) {
-        printf("malloc fail\n");
-        exit(1);
+    return init_node((Node*)pool_alloc(&node_pool), data);
+}
+
+/**
+ * Same for a LIST_LAZY list
+ */
+Node* create_lazy_node(int data) {
+    return init_lazy_node((LazyNode*)pool_alloc(&lazy_pool), data, 0);
+}
+
+/**
+ * LIST_LAZY per node lock, held just long enough to check and relink
+ * One byte, so the node stays 16 bytes in every mode
+ */
+static inline void node_lock(Node* node) {
+    int spins = 0;
+    while (atomic_exchange_explicit(&node->locked, true, memory_order_acquire)) {
+        while (atomic_load_explicit(&node->locked, memory_order_relaxed)) {
+            if (++spins % NODE_LOCK_SPINS == 0) {
+                sched_yield(); // Holder may not be running
+            } else {
+                cpu_relax();
+            }
+        }
     }
-    new_node->data = data;
-    new_node->next = NULL;
-    return new_node;
+}
+
+static inline void node_unlock(Node* node) {
+    atomic_store_explicit(&node->locked, false, memory_order_release);
+}
+
+/**
+ * Appends a node for data to a chain nobody can see yet, returns it
+ * The nodes come from pool_alloc_seq(), so the chain is laid out in walk order
+ * and counts as there since before any snapshot
+ */
+static inline Node* chain_append(List* list, Node** first, Node* last, int data) {
+    Node* node = list->mode == LIST_LAZY ? init_lazy_node((LazyNode*)pool_alloc_seq(&lazy_pool), data, 1)
+                                         : init_node((Node*)pool_alloc_seq(&node_pool), data);
+    if (last == NULL) {
+        *first = node;
+    } else {
+        atomic_store_explicit(&last->next, node, memory_order_relaxed);
+    }
+    return node;
+}
+
+/**
+ * Frees a node once ebr says nobody can see it anymore
+ */
+void reclaim_node(void* node) {
+    pool_free(node);
+}
+
+/**
+ * Sets up an empty list
+ */
+void list_init(List* list, ListMode mode) {
+    list->mode = mode;
+    pthread_rwlock_init(&list->rwlock, NULL);
+    pthread_mutex_init(&list->writer, NULL);
+    counter_reset(&list->size);
+    for (int i = 0; i < FC_SLOTS; i++) {
+        atomic_init(&list->fc[i].state, FC_NONE);
+    }
+    snap_init(&list->snap);
+    atomic_init(&list->image, NULL);
+    list->adaptive = false;
+    atomic_init(&list->move_seq, 0);
+    list->filter = NULL;
+    pthread_mutex_init(&list->anchor_lock, NULL);
+    list->anchors = NULL;
+    list->anchor_count = 0;
+    list->anchor_cap = 0;
+    list->since_anchor = 0;
+    atomic_init(&list->head, mode == LIST_LAZY ? create_lazy_node(0) : NULL); // Sentinel's data is never looked at
+}
+
+/**
+ * Write side of the list: the writer mutex in LIST_RCU, the write lock otherwise
+ */
+static inline void write_lock(List* list) {
+    if (list->mode == LIST_RCU) {
+        STAT_LOCK(pthread_mutex_lock(&list->writer));
+    } else {
+        STAT_LOCK(pthread_rwlock_wrlock(&list->rwlock));
+    }
+}
+
+static inline bool write_trylock(List* list) {
+    bool locked = list->mode == LIST_RCU ? pthread_mutex_trylock(&list->writer) == 0
+                                         : pthread_rwlock_trywrlock(&list->rwlock) == 0;
+    if (locked) {
+        stat_add(STAT_LOCK_ACQUIRES, 1);
+    }
+    return locked;
+}
+
+static inline void write_unlock(List* list) {
+    if (list->mode == LIST_RCU) {
+        pthread_mutex_unlock(&list->writer);
+    } else {
+        pthread_rwlock_unlock(&list->rwlock);
+    }
+}
+
+/**
+ * Read side for the locked modes, LIST_RCU only enters an ebr section
+ */
+static inline void read_lock(List* list) {
+    if (list->mode == LIST_RCU) {
+        ebr_enter();
+    } else {
+        STAT_LOCK(pthread_rwlock_rdlock(&list->rwlock));
+    }
+}
+
+static inline void read_unlock(List* list) {
+    if (list->mode == LIST_RCU) {
+        ebr_exit();
+    } else {
+        pthread_rwlock_unlock(&list->rwlock);
+    }
+}
+
+/*
+ * Skip anchors
+ *
+ * list->anchors holds about every ANCHOR_GAP-th node, in walk order from the
+ * end of the array back to the front, so a new anchor at the head is an
+ * append. An anchored node has its anchor flag set. When one is unlinked the
+ * node after it takes over its slot, so the anchors stay live nodes in walk
+ * order. Outside LIST_LAZY they only change under write_lock(); LIST_LAZY
+ * deletes have no list lock and take anchor_lock instead, only when the node
+ * they delete is an anchor.
+ */
+
+#ifndef ANCHOR_GAP
+#define ANCHOR_GAP 4096 // Nodes between anchors, -DANCHOR_GAP=16 makes small lists split too
+#endif
+
+/**
+ * Adds node as the anchor nearest the head
+ */
+static void anchor_push(List* list, Node* node) {
+    if (list->anchor_count == list->anchor_cap) {
+        int cap = list->anchor_cap > 0 ? list->anchor_cap * 2 : 64;
+        Node** anchors = realloc(list->anchors, cap * sizeof(Node*));
+        if (anchors == NULL) {
+            printf("malloc fail\n");
+            exit(1);
+        }
+        list->anchors = anchors;
+        list->anchor_cap = cap;
+    }
+    list->anchors[list->anchor_count++] = node;
+    atomic_store(&node->anchor, true);
+}
+
+/**
+ * Anchors were pushed in walk order, flips them round
+ */
+static void anchor_reverse(List* list) {
+    for (int i = 0, j = list->anchor_count - 1; i < j; i++, j--) {
+        Node* tmp = list->anchors[i];
+        list->anchors[i] = list->anchors[j];
+        list->anchors[j] = tmp;
+    }
+}
+
+/**
+ * Counts n nodes just linked in at the head, anchors the head every ANCHOR_GAP
+ * Unordered modes, call with write_lock() held
+ */
+static inline void anchor_head(List* list, int n) {
+    list->since_anchor += n;
+    if (list->since_anchor >= ANCHOR_GAP) {
+        anchor_push(list, list->head);
+        list->since_anchor = 0;
+    }
+}
+
+/**
+ * node was an anchor and is being unlinked, succ (the node after it) takes
+ * its place, or the anchor goes if succ is the end or an anchor already
+ * Call with write_lock() held, or anchor_lock in LIST_LAZY
+ */
+static void anchor_unlink(List* list, Node* node, Node* succ) {
+    for (int i = 0; i < list->anchor_count; i++) {
+        if (list->anchors[i] == node) {
+            if (succ != NULL && !atomic_load(&succ->anchor)) {
+                list->anchors[i] = succ;
+                atomic_store(&succ->anchor, true);
+            } else {
+                memmove(&list->anchors[i], &list->anchors[i + 1], (list->anchor_count - i - 1) * sizeof(Node*));
+                list->anchor_count--;
+            }
+            break;
+        }
+    }
+    atomic_store(&node->anchor, false);
+}
+
+/**
+ * Frees a node that was just unlinked under write_lock()
+ * LIST_RCU readers may still be on it, so it waits out a grace period
+ */
+static inline void drop_node(List* list, Node* node) {
+    if (atomic_load_explicit(&node->anchor, memory_order_relaxed)) {
+        anchor_unlink(list, node, atomic_load(&node->next));
+    }
+    if (list->mode == LIST_RCU) {
+        ebr_retire(node, reclaim_node);
+    } else {
+        pool_free(node);
+    }
+}
+
+/**
+ * Counts a key that's about to go in, before anyone can see its node
+ */
+static inline void filter_add(List* list, int data) {
+    if (list->filter != NULL) {
+        bloom_add(list->filter, data);
+    }
+}
+
+/**
+ * Takes out a key whose node is deleted
+ */
+static inline void filter_remove(List* list, int data) {
+    if (list->filter != NULL) {
+        bloom_remove(list->filter, data);
+    }
+}
+
+/**
+ * Whether the filter says data is definitely not there
+ */
+static inline bool filter_rules_out(List* list, int data) {
+    if (list->filter == NULL) {
+        return false;
+    }
+    stat_add(STAT_FILTER_CHECKS, 1);
+    if (bloom_maybe(list->filter, data)) {
+        return false;
+    }
+    stat_add(STAT_FILTER_NEGATIVES, 1);
+    return true;
+}
+
+/**
+ * Turns a mapped image into real nodes, whoever gets the write lock first builds them
+ */
+void list_promote(List* list) {
+    write_lock(list);
+    ListImage* image = atomic_load(&list->image);
+    if (image != NULL) {
+        Node* first = NULL;
+        Node* last = NULL;
+        long built = 0;
+        for (const ImageRecord* record = image_first(image); record != NULL; record = image_next(image, record)) {
+            last = chain_append(list, &first, last, record->data);
+            if (++built % ANCHOR_GAP == 0) {
+                anchor_push(list, last);
+            }
+        }
+        anchor_reverse(list);
+        if (list->mode == LIST_LAZY) {
+            atomic_store_explicit(&atomic_load(&list->head)->next, first, memory_order_release);
+        } else {
+            atomic_store_explicit(&list->head, first, memory_order_release);
+        }
+        atomic_store(&list->image, NULL);
+        ebr_retire(image, image_close); // LIST_LAZY/LIST_RCU readers and contains() don't take the lock
+    }
+    write_unlock(list);
+}
+
+/**
+ * Promotes the list if it's still backed by an image, one load otherwise
+ */
+static inline void promote_if_mapped(List* list) {
+    if (atomic_load(&list->image) != NULL) {
+        list_promote(list);
+    }
+}
+
+/**
+ * First real node of the list, skips the lazy sentinel
+ */
+static inline Node* first_node(List* list) {
+    Node* head = atomic_load(&list->head);
+    return list->mode == LIST_LAZY ? atomic_load(&head->next) : head;
+}
+
+/**
+ * Optimistic walk to the first node >= data, LIST_LAZY helper
+ * start is the sentinel or any node known to be < data
+ * Caller must be inside ebr_enter()/ebr_exit()
+ */
+static inline void lazy_locate(Node* start, int data, Node** pred_ptr, Node** cur_ptr) {
+    Node* pred = start;
+    Node* cur = atomic_load_explicit(&pred->next, memory_order_acquire);
+    while (cur != NULL && cur->data < data) {
+        pred = cur;
+        cur = atomic_load_explicit(&cur->next, memory_order_acquire);
+    }
+    *pred_ptr = pred;
+    *cur_ptr = cur;
+}
+
+/**
+ * Both still live and still next to each other, call with both locked
+ */
+static inline bool lazy_validate(Node* pred, Node* cur) {
+    return !atomic_load(&pred->marked) &&
+           (cur == NULL || !atomic_load(&cur->marked)) &&
+           atomic_load(&pred->next) == cur;
+}
+
+/**
+ * Insert in order starting the walk at start, returns the node it went in
+ * after so a batch of ascending keys can carry on from there
+ * Falls back to the sentinel if start got deleted under us
+ * Caller must be inside ebr_enter()/ebr_exit()
+ */
+static Node* lazy_insert_from(List* list, Node* start, int data) {
+    Node* new_node = create_lazy_node(data);
+    Node* pred;
+    Node* cur;
+
+    while (true) {
+        lazy_locate(start, data, &pred, &cur);
+        STAT_LOCK(node_lock(pred));
+        if (lazy_validate(pred, cur)) {
+            atomic_store_explicit(&new_node->next, cur, memory_order_relaxed);
+            atomic_store_explicit(&pred->next, new_node, memory_order_release); // Publish once it's complete
+            snap_stamp(&list->snap, &lazy_node(new_node)->ins); // Takes effect here as far as snapshots go
+            node_unlock(pred);
+            return pred;
+        }
+        node_unlock(pred); // Someone changed it under us, go again
+        start = atomic_load(&list->head);
+    }
+}
+
+/**
+ * Insert in order, LIST_LAZY version of insert_node()
+ */
+void lazy_insert(List* list, int data) {
+    ebr_enter();
+    lazy_insert_from(list, atomic_load(&list->head), data);
+    ebr_exit();
+    counter_add(&list->size, 1);
+}
+
+/**
+ * Delete the first node holding data starting the walk at *start
+ * *start gets the node before it, for the next key of an ascending batch
+ * Caller must be inside ebr_enter()/ebr_exit()
+ */
+static bool lazy_delete_from(List* list, Node** start, int data) {
+    Node* pred;
+    Node* cur;
+    bool deleted = false;
+
+    while (true) {
+        lazy_locate(*start, data, &pred, &cur);
+        STAT_LOCK(node_lock(pred));
+        if (cur != NULL) {
+            STAT_LOCK(node_lock(cur)); // Always pred before cur, so no deadlock
+        }
+        bool valid = lazy_validate(pred, cur);
+        if (valid && cur != NULL && cur->data == data) {
+            snap_stamp(&list->snap, &lazy_node(cur)->ins);
+            atomic_store(&cur->marked, true); // Logical delete first, readers skip it from here
+            if (atomic_load(&cur->anchor)) { // Read after marked, see par_walk()
+                STAT_LOCK(pthread_mutex_lock(&list->anchor_lock)); // Waits out a parallel pass
+                anchor_unlink(list, cur, atomic_load(&cur->next)); // cur is locked, so next stays put
+                pthread_mutex_unlock(&list->anchor_lock);
+            }
+            unsigned del = snap_stamp(&list->snap, &lazy_node(cur)->del);
+            snap_report(&list->snap, cur, cur->data, atomic_load(&lazy_node(cur)->ins), del); // Before a snapshot can miss it
+            atomic_store_explicit(&pred->next, atomic_load(&cur->next), memory_order_release);
+            deleted = true;
+        }
+        if (cur != NULL) {
+            node_unlock(cur);
+        }
+        node_unlock(pred);
+        if (valid) {
+            break;
+        }
+        *start = atomic_load(&list->head);
+    }
+    if (deleted) {
+        ebr_retire(cur, reclaim_node); // Lock-free readers may still be on it
+        counter_add(&list->size, -1);
+    }
+    *start = pred;
+    return deleted;
+}
+
+/**
+ * Delete the first node holding data, LIST_LAZY version of delete_node()
+ */
+bool lazy_delete(List* list, int data) {
+    ebr_enter();
+    Node* start = atomic_load(&list->head);
+    bool deleted = lazy_delete_from(list, &start, data);
+    ebr_exit();
+    return deleted;
+}
+
+/**
+ * Deletes one node per key of a sorted batch in one walk, LIST_RWLOCK/LIST_COMBINE/LIST_RCU
+ * deleted[] starts all false, returns how many got deleted
+ * Call with write_lock() held, the caller fixes the size
+ */
+static int delete_pass(List* list, const int* keys, int n, bool* deleted) {
+    int count = 0;
+    int lo = keys[0];     // Most nodes miss the whole batch, skip the search for them
+    int hi = keys[n - 1];
+    _Atomic(Node*)* link = &list->head;
+    Node* cur = *link;
+    while (cur != NULL && count < n) {
+        int data = cur->data;
+        int i = -1;
+        if (n == 1) { // Lone key, plain compare like delete_node()
+            i = data == lo ? 0 : -1;
+        } else if (data >= lo && data <= hi) {
+            i = batch_claim(keys, n, data, deleted);
+        }
+        if (i >= 0) {
+            deleted[i] = true;
+            count++;
+            atomic_store_explicit(link, atomic_load(&cur->next), memory_order_release);
+            drop_node(list, cur);
+        } else {
+            link = &cur->next;
+        }
+        cur = *link;
+    }
+    return count;
+}
+
+/**
+ * Runs every posted request, LIST_COMBINE
+ * Inserts go in first as one chain, then the deletes take one walk
+ * Call with the write lock held
+ */
+static void fc_combine(List* list) {
+    int keys[FC_SLOTS];
+    bool deleted[FC_SLOTS];
+    bool given[FC_SLOTS];
+    bool collected[FC_SLOTS];
+    int n = 0;
+    long delta = 0;
+    unsigned used = atomic_load(&fc_next_slot); // Slots past this were never handed out
+    int slots = used < FC_SLOTS ? (int)used : FC_SLOTS;
+
+    for (int i = 0; i < slots; i++) {
+        FcSlot* slot = &list->fc[i];
+        int state = atomic_load_explicit(&slot->state, memory_order_acquire);
+        collected[i] = state == FC_DELETE;
+        if (state == FC_INSERT) {
+            Node* node = create_node(slot->data);
+            node->next = list->head;
+            list->head = node;
+            anchor_head(list, 1);
+            delta++;
+            slot->result = true;
+            atomic_store_explicit(&slot->state, FC_DONE, memory_order_release);
+        } else if (state == FC_DELETE) {
+            keys[n] = slot->data;
+            deleted[n] = false;
+            given[n] = false;
+            n++;
+        }
+    }
+    if (n == 0) {
+        counter_add(&list->size, delta);
+        return;
+    }
+
+    batch_sort(keys, n);
+    delta -= delete_pass(list, keys, n, deleted);
+
+    // Copies of a key share its results, slots posted since are the next combiner's
+    for (int i = 0; i < slots; i++) {
+        if (collected[i]) {
+            FcSlot* slot = &list->fc[i];
+            int k = batch_claim(keys, n, slot->data, given);
+            given[k] = true;
+            slot->result = deleted[k];
+            atomic_store_explicit(&slot->state, FC_DONE, memory_order_release);
+        }
+    }
+    counter_add(&list->size, delta);
+}
+
+/**
+ * Posts an insert or delete and waits until some combiner ran it, LIST_COMBINE
+ */
+static bool fc_run(List* list, int op, int data) {
+    if (fc_slot < 0) {
+        fc_slot = (int)(atomic_fetch_add(&fc_next_slot, 1) % FC_SLOTS);
+    }
+    FcSlot* slot = &list->fc[fc_slot];
+    int spins = 0;
+    int expected = FC_NONE;
+    while (!atomic_compare_exchange_weak(&slot->state, &expected, FC_CLAIMED)) { // Only shared past FC_SLOTS threads
+        expected = FC_NONE;
+        sched_yield();
+    }
+    slot->data = data;
+    atomic_store_explicit(&slot->state, op, memory_order_release);
+
+    while (atomic_load_explicit(&slot->state, memory_order_acquire) != FC_DONE) {
+        if (pthread_rwlock_trywrlock(&list->rwlock) == 0) {
+            stat_add(STAT_LOCK_ACQUIRES, 1);
+            fc_combine(list); // Ours is in there too
+            pthread_rwlock_unlock(&list->rwlock);
+        } else if (++spins % 64 == 0) {
+            sched_yield(); // Combiner's busy, let it run
+        } else {
+            cpu_relax();
+        }
+    }
+    bool result = slot->result;
+    atomic_store_explicit(&slot->state, FC_NONE, memory_order_release);
+    return result;
 }
 
 /**
- * Insert a node at the first position
+ * Insert a node, at the first position or in order for LIST_LAZY
  */
-void insert_node(Node** head_ref, int data) {
-    pthread_rwlock_wrlock(&list_rwlock);
-    
+void insert_node(List* list, int data) {
+    promote_if_mapped(list);
+    filter_add(list, data);
+    if (list->mode == LIST_LAZY) {
+        lazy_insert(list, data);
+        return;
+    }
+    if (list->mode == LIST_COMBINE) {
+        fc_run(list, FC_INSERT, data);
+        return;
+    }
+
+    write_lock(list);
+
     Node *new_node = create_node(data);
-    new_node->next = *head_ref;
-    *head_ref      = new_node;   // update head while still locked - important!   
+    new_node->next = list->head;
+    atomic_store_explicit(&list->head, new_node, memory_order_release); // update head while still locked - important!
+    anchor_head(list, 1);
 
-    pthread_rwlock_unlock(&list_rwlock);
+    write_unlock(list);
+    counter_add(&list->size, 1);
 }
 
 /**
- * Deletes a given node
+ * Deletes a given node, returns whether it was there
  */
-void delete_node(Node **head_ref, int data) {
-    pthread_rwlock_wrlock(&list_rwlock); // writers have exclusive access
+bool delete_node(List* list, int data) {
+    promote_if_mapped(list);
+    if (list->mode == LIST_LAZY || list->mode == LIST_COMBINE) {
+        bool deleted = list->mode == LIST_LAZY ? lazy_delete(list, data) : fc_run(list, FC_DELETE, data);
+        if (deleted) {
+            filter_remove(list, data);
+        }
+        return deleted;
+    }
 
+    write_lock(list); // writers have exclusive access
 
-    Node *head = *head_ref;
+
+    Node *head = list->head;
     if (head == NULL) { // empty list
-        pthread_rwlock_unlock(&list_rwlock);
-        return;
+        write_unlock(list);
+        return false;
     }
 
     if (head->data == data) { // delete head
 
         Node *temp = head;
-        *head_ref  = head->next;   // update head while locked
-        free(temp);
-        pthread_rwlock_unlock(&list_rwlock);
-        return;
+        atomic_store_explicit(&list->head, atomic_load(&head->next), memory_order_release); // update head while locked
+        drop_node(list, temp);
+        write_unlock(list);
+        counter_add(&list->size, -1);
+        filter_remove(list, data);
+        return true;
     }
     Node *prev = head;
     Node *cur  = head->next;
@@ -67,93 +761,1076 @@ void delete_node(Node **head_ref, int data) {
         cur  = cur->next;
     }
 
-    if (cur != NULL) {
-        prev->next = cur->next;
-        free(cur);
+    bool deleted = cur != NULL;
+    if (deleted) {
+        atomic_store_explicit(&prev->next, atomic_load(&cur->next), memory_order_release);
+        drop_node(list, cur);
+    }
+    write_unlock(list);
+    if (deleted) {
+        counter_add(&list->size, -1);
+        filter_remove(list, data);
     }
-    pthread_rwlock_unlock(&list_rwlock);
+    return deleted;
 }
 
 /**
- * Returns a given node, uses read lock instead of write lock
- * since it doesn't modify the list
+ * Adds a filter sized for expected keys at about fp_rate false positives,
+ * expected <= 0 takes it off again
+ * Loads whatever is in the list already, set it before other threads use it
  */
-Node* search(Node* head, int data) {
-    pthread_rwlock_rdlock(&list_rwlock);
-    
-    Node* cur = head;
-    while (cur != NULL) {
-        if (cur->data == data) {
-            pthread_rwlock_unlock(&list_rwlock);
-            return cur;
+void list_set_filter(List* list, long expected, double fp_rate) {
+    if (list->filter != NULL) {
+        bloom_destroy(list->filter);
+        list->filter = NULL;
+    }
+    if (expected <= 0) {
+        return;
+    }
+    BloomFilter* filter = bloom_create(expected, fp_rate);
+    ListImage* image = atomic_load(&list->image);
+    if (image != NULL) {
+        for (long i = 0; i < image->count; i++) {
+            bloom_add(filter, image_value(image, i));
+        }
+    }
+    for (Node* cur = first_node(list); cur != NULL; cur = atomic_load(&cur->next)) {
+        if (!atomic_load(&cur->marked)) {
+            bloom_add(filter, cur->data);
         }
-        cur = cur->next;
     }
-    
-    pthread_rwlock_unlock(&list_rwlock);
-    return NULL;    
+    list->filter = filter;
 }
 
+/*
+ * Adaptive ordering
+ *
+ * Unordered lists keep keys wherever insert_node() put them, so a hot key
+ * deep in the list costs a long walk on every lookup. With list_set_adaptive()
+ * a search() that hits a node ADAPT_MIN_DEPTH or more steps in moves it to the
+ * head, on one deep hit in ADAPT_SAMPLE per thread. Hot keys come up often
+ * enough to get sampled and collect near the front, and once they're there
+ * nothing moves anymore.
+ *
+ * The move happens under the write side, and only if it's free right now:
+ * a lookup never waits to reorder. In LIST_RCU readers don't take the lock,
+ * and one that was past the node's old spot would miss it, so a move keeps
+ * move_seq odd while it relinks and a reader that comes up empty looks again
+ * if the sequence moved. The node itself is moved, not copied, so nothing
+ * has to wait for a grace period.
+ *
+ * LIST_LAZY stays sorted and ignores it.
+ */
+
+#define ADAPT_SAMPLE 16    // Move on one deep hit in this many per thread
+#define ADAPT_MIN_DEPTH 8  // Hits closer to the head than this stay put
+
+_Thread_local unsigned adapt_hits = 0;
+
 /**
- * Checks if a value exists in the list
+ * Turns adaptive ordering on or off, set it before other threads use the list
  */
-bool contains(Node* head, int data) {
-    return search(head, data) != NULL;
+void list_set_adaptive(List* list, bool adaptive) {
+    list->adaptive = adaptive && list->mode != LIST_LAZY;
 }
 
 /**
- * Prints list contents
+ * Sequence to check a miss against later, waits out a move under way
  */
-void print_list(Node* head) {
-    pthread_rwlock_rdlock(&list_rwlock);
-    
-    if (head == NULL) {
-        printf("empty list\n");
-        pthread_rwlock_unlock(&list_rwlock);
-        return;
+static inline unsigned move_seq_begin(List* list) {
+    unsigned seq;
+    while ((seq = atomic_load(&list->move_seq)) & 1) {
+        cpu_relax();
     }
+    return seq;
+}
 
-    Node* cur = head;
-    printf("List: ");
-    while (cur != NULL) {
-        printf("%d -> ", cur->data);
-        cur = cur->next;
-    }
-    printf("END\n");
-    
-    pthread_rwlock_unlock(&list_rwlock);
+/**
+ * Whether a move ran since move_seq_begin(), a miss has to look again then
+ */
+static inline bool move_seq_changed(List* list, unsigned seq) {
+    return atomic_load(&list->move_seq) != seq;
 }
 
 /**
- * Count nodes in list
+ * Whether a hit depth steps in should move, counts this thread's deep hits
  */
-int count_nodes(Node* head) {
-    pthread_rwlock_rdlock(&list_rwlock);
-    
-    int count = 0;
+static inline bool adapt_sampled(int depth) {
+    return depth >= ADAPT_MIN_DEPTH && ++adapt_hits % ADAPT_SAMPLE == 0;
+}
+
+/**
+ * Moves the first node holding data to the head, skipped if a writer has the list
+ */
+static void move_to_front(List* list, int data) {
+    if (!write_trylock(list)) {
+        return;
+    }
+    Node* head = list->head;
+    Node* prev = NULL;
     Node* cur = head;
-    while (cur != NULL) {
-        count++;
+    while (cur != NULL && cur->data != data) {
+        prev = cur;
         cur = cur->next;
     }
-    
-    pthread_rwlock_unlock(&list_rwlock);
-    return count;
+    if (cur != NULL && prev != NULL && !atomic_load_explicit(&cur->anchor, memory_order_relaxed)) { // Anchors keep their place
+        atomic_fetch_add(&list->move_seq, 1);
+        atomic_store_explicit(&prev->next, atomic_load(&cur->next), memory_order_release);
+        atomic_store_explicit(&cur->next, head, memory_order_release); // A reader on it just walks the front again
+        atomic_store_explicit(&list->head, cur, memory_order_release);
+        atomic_fetch_add(&list->move_seq, 1);
+        stat_add(STAT_MOVED, 1);
+    }
+    write_unlock(list);
 }
 
 /**
- * Free memory used by the list
+ * search() minus the filter check
  */
-void free_list(Node* head) {
-    pthread_rwlock_wrlock(&list_rwlock);
-    
-    Node* cur = head;
-    Node* next;
-    
-    while (cur != NULL) {
-        next = cur->next;
-        free(cur);
-        cur = next;
+static Node* search_walk(List* list, int data) {
+    promote_if_mapped(list);
+    if (list->mode == LIST_LAZY) {
+        ebr_enter();
+        Node* cur = first_node(list);
+        while (cur != NULL && cur->data <= data) {
+            if (cur->data == data) {
+                if (!atomic_load(&cur->marked)) {
+                    snap_stamp(&list->snap, &lazy_node(cur)->ins);
+                    break;
+                }
+                snap_stamp(&list->snap, &lazy_node(cur)->del); // Skipping it has to agree with snapshots too
+            }
+            cur = atomic_load_explicit(&cur->next, memory_order_acquire);
+        }
+        if (cur != NULL && cur->data != data) {
+            cur = NULL;
+        }
+        ebr_exit();
+        if (cur == NULL && list->filter != NULL) {
+            stat_add(STAT_FILTER_FALSE_POSITIVES, 1);
+        }
+        return cur;
     }
-    pthread_rwlock_unlock(&list_rwlock);
-}
\ No newline at end of file
+
+    Node* cur;
+    int depth;
+    unsigned seq = 0;
+    do {
+        if (list->adaptive) {
+            seq = move_seq_begin(list);
+        }
+        read_lock(list);
+        cur = atomic_load_explicit(&list->head, memory_order_acquire);
+        depth = 0;
+        while (cur != NULL && cur->data != data) {
+            cur = atomic_load_explicit(&cur->next, memory_order_acquire);
+            depth++;
+        }
+        read_unlock(list);
+    } while (cur == NULL && list->adaptive && move_seq_changed(list, seq));
+
+    if (cur != NULL && list->adaptive && adapt_sampled(depth)) {
+        move_to_front(list, data);
+    }
+    if (cur == NULL && list->filter != NULL) {
+        stat_add(STAT_FILTER_FALSE_POSITIVES, 1);
+    }
+    return cur;
+}
+
+/**
+ * Returns a given node, uses read lock instead of write lock
+ * since it doesn't modify the list
+ * LIST_LAZY and LIST_RCU take no lock, so only dereference the node inside
+ * your own ebr_enter()/ebr_exit()
+ * On an adaptive list a deep hit may move the node to the front
+ */
+Node* search(List* list, int data) {
+    return filter_rules_out(list, data) ? NULL : search_walk(list, data);
+}
+
+/**
+ * Checks if a value exists in the list
+ * With a filter most misses come back after one cache line, no lock taken
+ */
+bool contains(List* list, int data) {
+    if (filter_rules_out(list, data)) {
+        return false;
+    }
+    ebr_enter(); // Keeps a mapped image around, see list_promote()
+    ListImage* image = atomic_load(&list->image);
+    bool found = image != NULL ? image_contains(image, data) : search_walk(list, data) != NULL;
+    ebr_exit();
+    return found;
+}
+
+/**
+ * Insert a batch of keys, sorts keys in place
+ * LIST_RWLOCK links the nodes up first and splices them in under one lock,
+ * LIST_LAZY carries on each walk from where the previous key went in
+ */
+void insert_many(List* list, int* keys, int n) {
+    if (n <= 0) {
+        return;
+    }
+    batch_sort(keys, n);
+    promote_if_mapped(list);
+    for (int i = 0; i < n; i++) {
+        filter_add(list, keys[i]);
+    }
+
+    if (list->mode == LIST_LAZY) {
+        ebr_enter();
+        Node* start = atomic_load(&list->head);
+        for (int i = 0; i < n; i++) {
+            start = lazy_insert_from(list, start, keys[i]);
+        }
+        ebr_exit();
+        counter_add(&list->size, n);
+        return;
+    }
+
+    Node* last = create_node(keys[n - 1]);
+    Node* first = last;
+    for (int i = n - 2; i >= 0; i--) {
+        Node* node = create_node(keys[i]);
+        node->next = first;
+        first = node;
+    }
+
+    write_lock(list);
+    last->next = list->head;
+    atomic_store_explicit(&list->head, first, memory_order_release);
+    anchor_head(list, n);
+    write_unlock(list);
+    counter_add(&list->size, n);
+}
+
+/**
+ * Delete one node per key in a batch, sorts keys in place
+ * deleted[i] says whether keys[i] (after sorting) found a node, returns how many did
+ * LIST_RWLOCK does it all in one pass under one lock
+ */
+int delete_many(List* list, int* keys, int n, bool* deleted) {
+    for (int i = 0; i < n; i++) {
+        deleted[i] = false;
+    }
+    if (n <= 0) {
+        return 0;
+    }
+    batch_sort(keys, n);
+    promote_if_mapped(list);
+
+    int count = 0;
+    if (list->mode == LIST_LAZY) {
+        ebr_enter();
+        Node* start = atomic_load(&list->head);
+        for (int i = 0; i < n; i++) {
+            deleted[i] = lazy_delete_from(list, &start, keys[i]);
+            count += deleted[i];
+        }
+        ebr_exit();
+    } else {
+        write_lock(list);
+        count = delete_pass(list, keys, n, deleted);
+        write_unlock(list);
+        counter_add(&list->size, -count);
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (deleted[i]) {
+            filter_remove(list, keys[i]);
+        }
+    }
+    return count;
+}
+
+/**
+ * Look up a batch of keys in one pass, sorts keys in place
+ * found[i] says whether keys[i] (after sorting) is in the list, returns how many are
+ */
+int contains_many(List* list, int* keys, int n, bool* found) {
+    for (int i = 0; i < n; i++) {
+        found[i] = false;
+    }
+    if (n <= 0) {
+        return 0;
+    }
+    batch_sort(keys, n);
+
+    ebr_enter();
+    ListImage* image = atomic_load(&list->image);
+    if (image != NULL) {
+        int count = image_contains_many(image, keys, n, found);
+        ebr_exit();
+        return count;
+    }
+    ebr_exit();
+
+    int count = 0;
+    if (list->mode == LIST_LAZY) { // Both sorted, walk them side by side
+        ebr_enter();
+        Node* cur = first_node(list);
+        for (int i = 0; i < n; i++) {
+            while (cur != NULL && cur->data < keys[i]) {
+                cur = atomic_load_explicit(&cur->next, memory_order_acquire);
+            }
+            Node* copy = cur;
+            while (copy != NULL && copy->data == keys[i] && atomic_load(&copy->marked)) {
+                snap_stamp(&list->snap, &lazy_node(copy)->del);
+                copy = atomic_load_explicit(&copy->next, memory_order_acquire);
+            }
+            found[i] = copy != NULL && copy->data == keys[i];
+            if (found[i]) {
+                snap_stamp(&list->snap, &lazy_node(copy)->ins);
+            }
+            count += found[i];
+        }
+        ebr_exit();
+        return count;
+    }
+
+    unsigned seq = list->adaptive ? move_seq_begin(list) : 0;
+    read_lock(list);
+    Node* cur = atomic_load_explicit(&list->head, memory_order_acquire);
+    for (; cur != NULL && count < n; cur = atomic_load_explicit(&cur->next, memory_order_acquire)) {
+        for (int i = batch_lower_bound(keys, n, cur->data); i < n && keys[i] == cur->data && !found[i]; i++) {
+            found[i] = true;
+            count++;
+        }
+    }
+    read_unlock(list);
+    if (list->adaptive && count < n && move_seq_changed(list, seq)) {
+        for (int i = 0; i < n; i++) { // A move may have hidden some, look for those one by one
+            if (!found[i] && search(list, keys[i]) != NULL) {
+                found[i] = true;
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+/*
+ * Iterators
+ *
+ * ITER_WEAK walks the live list. In LIST_LAZY and LIST_RCU that takes no
+ * lock and sees whatever is there as it goes; the other modes hold the read
+ * lock from list_iter_begin() to list_iter_end(), so writers wait for the
+ * whole scan.
+ *
+ * ITER_SNAPSHOT copies the list as it was at one instant and hands that back
+ * in ascending order. LIST_LAZY takes it with versioned nodes (snapshot.c)
+ * and never blocks anyone; the other modes copy under the read lock (the
+ * writer mutex in LIST_RCU) and let go before the first value comes back. Use an iterator from the thread
+ * that began it.
+ */
+
+typedef struct ListIter {
+    List* list;
+    IterMode mode;
+    Node* cur;     // ITER_WEAK: next node to look at
+    const ListImage* image;       // ITER_WEAK on a mapped list: walks the records instead
+    const ImageRecord* record;
+    int* values;   // ITER_SNAPSHOT: the copy
+    long count;
+    long pos;
+} ListIter;
+
+/**
+ * Snapshot of a lazy list, the stamps decide what's in
+ * Deleted nodes keep their next pointer, so the walk goes through them too
+ */
+static int* lazy_snapshot(List* list, long* count) {
+    SnapBuffer buf = { NULL, 0, 0 };
+    ebr_enter();
+    SnapCollector* col = snap_begin(&list->snap);
+    for (Node* cur = first_node(list); cur != NULL; cur = atomic_load_explicit(&cur->next, memory_order_acquire)) {
+        unsigned ins = snap_stamp(&list->snap, &lazy_node(cur)->ins);
+        unsigned del = atomic_load(&cur->marked) ? snap_stamp(&list->snap, &lazy_node(cur)->del) : 0;
+        if (snap_visible(ins, del, col->version)) {
+            snap_add(&buf, cur, cur->data);
+        }
+    }
+    int* values = snap_finish(&list->snap, col, &buf, count);
+    ebr_exit();
+    return values;
+}
+
+/**
+ * Snapshot of a locked list, copies under the read lock
+ * LIST_RCU reads take no lock, so it holds off the writers instead
+ */
+static int* locked_snapshot(List* list, long* count) {
+    long capacity = 256;
+    long n = 0;
+    int* values = malloc(capacity * sizeof(int));
+    if (values == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    if (list->mode == LIST_RCU) {
+        write_lock(list);
+    } else {
+        STAT_LOCK(pthread_rwlock_rdlock(&list->rwlock));
+    }
+    for (Node* cur = list->head; cur != NULL; cur = cur->next) {
+        if (n == capacity) {
+            capacity *= 2;
+            values = realloc(values, capacity * sizeof(int));
+            if (values == NULL) {
+                printf("malloc fail\n");
+                exit(1);
+            }
+        }
+        values[n++] = cur->data;
+    }
+    if (list->mode == LIST_RCU) {
+        write_unlock(list);
+    } else {
+        pthread_rwlock_unlock(&list->rwlock);
+    }
+    batch_sort(values, n);
+    *count = n;
+    return values;
+}
+
+/**
+ * Starts an iterator
+ */
+void list_iter_begin(List* list, ListIter* it, IterMode mode) {
+    it->list = list;
+    it->mode = mode;
+    it->cur = NULL;
+    it->image = NULL;
+    it->record = NULL;
+    it->values = NULL;
+    it->count = 0;
+    it->pos = 0;
+    if (mode == ITER_SNAPSHOT) {
+        ebr_enter();
+        ListImage* image = atomic_load(&list->image);
+        if (image != NULL) { // Read-only, so already a snapshot
+            it->values = image_copy_values(image, &it->count);
+        } else if (list->mode == LIST_LAZY) {
+            it->values = lazy_snapshot(list, &it->count);
+        } else {
+            it->values = locked_snapshot(list, &it->count);
+        }
+        ebr_exit();
+        return;
+    }
+
+    if (list->mode == LIST_LAZY) {
+        ebr_enter();
+    } else {
+        read_lock(list);
+    }
+    ListImage* image = atomic_load(&list->image); // The lock or ebr section keeps it mapped till list_iter_end()
+    if (image != NULL) {
+        it->image = image;
+        it->record = image_first(image);
+        return;
+    }
+    it->cur = first_node(list);
+}
+
+/**
+ * Next value, false once there are no more
+ */
+bool list_iter_next(ListIter* it, int* data) {
+    if (it->mode == ITER_SNAPSHOT) {
+        if (it->pos == it->count) {
+            return false;
+        }
+        *data = it->values[it->pos++];
+        return true;
+    }
+    if (it->image != NULL) {
+        if (it->record == NULL) {
+            return false;
+        }
+        *data = it->record->data;
+        it->record = image_next(it->image, it->record);
+        return true;
+    }
+    while (it->cur != NULL) {
+        Node* cur = it->cur;
+        it->cur = atomic_load_explicit(&cur->next, memory_order_acquire);
+        if (!atomic_load(&cur->marked)) {
+            *data = cur->data;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Done with an iterator
+ */
+void list_iter_end(ListIter* it) {
+    if (it->mode == ITER_SNAPSHOT) {
+        free(it->values);
+    } else if (it->list->mode == LIST_LAZY) {
+        ebr_exit();
+    } else {
+        read_unlock(it->list);
+    }
+}
+
+/**
+ * Calls cb on every value in the list, holds the read lock unless LIST_LAZY/LIST_RCU
+ */
+void list_for_each(List* list, void (*cb)(int data, void* arg), void* arg) {
+    ListIter it;
+    int data;
+    list_iter_begin(list, &it, ITER_WEAK);
+    while (list_iter_next(&it, &data)) {
+        cb(data, arg);
+    }
+    list_iter_end(&it);
+}
+
+/**
+ * Print callback
+ */
+void print_value(int data, void* arg) {
+    (void)arg;
+    printf("%d -> ", data);
+}
+
+/**
+ * Prints list contents
+ */
+void print_list(List* list) {
+    if (first_node(list) == NULL && atomic_load(&list->image) == NULL) {
+        printf("empty list\n");
+        return;
+    }
+
+    printf("List: ");
+    list_for_each(list, print_value, NULL);
+    printf("END\n");
+}
+
+/**
+ * Count callback
+ */
+void count_value(int data, void* arg) {
+    (void)data;
+    (*(int*)arg)++;
+}
+
+/**
+ * Size from the folded estimate, one load, may lag by a few thousand
+ */
+long size_approx(List* list) {
+    long size = counter_approx(&list->size);
+    return size > 0 ? size : 0;
+}
+
+/**
+ * Size summed over every shard
+ */
+long size_exact(List* list) {
+    return counter_exact(&list->size);
+}
+
+/**
+ * Count nodes in list, sums the size shards instead of walking
+ */
+int count_nodes(List* list) {
+    return (int)size_exact(list);
+}
+
+/*
+ * Parallel passes
+ *
+ * The anchors cut the list into chunks: the nodes before the newest anchor,
+ * then one chunk from each anchor up to the next. A pass runs
+ * list_parallel_threads workers, the caller being one of them, and each
+ * takes the next chunk off a shared counter until there are none left, so
+ * n nodes take about n / workers plus one chunk. Walking a chunk also lays
+ * anchors down again every ANCHOR_GAP nodes and drops ones that ended up too
+ * close together, so a list that grew unevenly (LIST_LAZY inserts land
+ * anywhere) is balanced again for the next pass.
+ *
+ * A pass holds the read lock in LIST_RWLOCK/LIST_COMBINE and the writer
+ * mutex in LIST_RCU (like ITER_SNAPSHOT), so writers wait for it. LIST_LAZY
+ * writers carry on, the pass only enters an ebr section; the one exception
+ * is a delete of an anchor, which waits for the pass so the chunk ends stay
+ * put. Every mode also takes anchor_lock, so two passes don't relay the
+ * anchors at once. LIST_LAZY passes are weak like ITER_WEAK: nodes there
+ * throughout are seen exactly once, ones that come or go during it may or
+ * may not be.
+ *
+ * Callbacks run on the worker threads, several at once, in no particular
+ * order, and must not write to the list. A list with no anchors yet (built
+ * by single LIST_LAZY inserts) is one chunk, its first pass runs on one
+ * worker and leaves it anchored for the next.
+ */
+
+#define PAR_MAX_WORKERS 64
+
+int list_parallel_threads = 0; // Workers per pass, 0 = one per online CPU
+
+typedef enum {
+    PAR_EACH,
+    PAR_REDUCE,
+    PAR_FREE
+} ParOp;
+
+typedef struct ParChunk {
+    Node* start;       // Chunks past the first start on an anchor
+    long acc;          // PAR_REDUCE: the chunk folded
+    long count;        // Live nodes walked
+    long lead;         // Live nodes before its first new anchor
+    long tail;         // Live nodes after its last new anchor
+    Node** anchors;    // New anchors laid down in it, walk order
+    int anchor_count;
+    int anchor_cap;
+} ParChunk;
+
+typedef struct ParPass {
+    List* list;
+    ParOp op;
+    void (*each)(int data, void* arg);
+    long (*map)(int data, void* arg);
+    long (*combine)(long a, long b);
+    long identity;
+    void* arg;
+    long result;       // PAR_REDUCE: every chunk combined, in list order
+    ParChunk* chunks;
+    int chunk_count;
+    _Atomic int next_chunk;
+} ParPass;
+
+/**
+ * Notes node as a new anchor of chunk
+ */
+static void par_anchor(ParChunk* chunk, Node* node) {
+    if (chunk->anchor_count == chunk->anchor_cap) {
+        chunk->anchor_cap = chunk->anchor_cap > 0 ? chunk->anchor_cap * 2 : 8;
+        chunk->anchors = realloc(chunk->anchors, chunk->anchor_cap * sizeof(Node*));
+        if (chunk->anchors == NULL) {
+            printf("malloc fail\n");
+            exit(1);
+        }
+    }
+    chunk->anchors[chunk->anchor_count++] = node;
+}
+
+/**
+ * Frees every node of chunk j, nobody else can be on the list
+ * The nodes mostly came from one thread, so they go back in batches
+ */
+static void par_free(ParPass* pass, int j) {
+    Node* stop = j + 1 < pass->chunk_count ? pass->chunks[j + 1].start : NULL;
+    PoolFreeBatch batch = POOL_FREE_BATCH_INIT;
+    for (Node* cur = pass->chunks[j].start; cur != stop;) {
+        Node* next = atomic_load_explicit(&cur->next, memory_order_relaxed);
+        pool_free_batched(&batch, cur);
+        cur = next;
+    }
+    pool_free_flush(&batch);
+}
+
+/**
+ * Runs the pass over chunk j, up to the next chunk's anchor
+ */
+static void par_walk(ParPass* pass, int j) {
+    ParChunk* chunk = &pass->chunks[j];
+    if (pass->op == PAR_FREE) {
+        par_free(pass, j);
+        return;
+    }
+    Node* stop = j + 1 < pass->chunk_count ? pass->chunks[j + 1].start : NULL;
+    bool lazy = pass->list->mode == LIST_LAZY;
+    long since = 0; // Live nodes since the last anchor
+    chunk->acc = pass->identity;
+    chunk->lead = -1;
+
+    for (Node* cur = chunk->start; cur != stop && cur != NULL;
+         cur = atomic_load_explicit(&cur->next, memory_order_acquire)) {
+        if (lazy && atomic_load(&cur->marked)) {
+            continue;
+        }
+        if (since >= ANCHOR_GAP) {
+            atomic_store(&cur->anchor, true);
+            // A LIST_LAZY delete marks then reads the flag, we set the flag then read marked,
+            // so either it sees the flag and waits for anchor_lock, or we see it's going
+            if (!lazy || !atomic_load(&cur->marked)) {
+                par_anchor(chunk, cur);
+                chunk->lead = chunk->lead < 0 ? chunk->count : chunk->lead;
+                since = 0;
+            } else {
+                atomic_store(&cur->anchor, false);
+                continue;
+            }
+        }
+        since++;
+        chunk->count++;
+        if (pass->op == PAR_EACH) {
+            pass->each(cur->data, pass->arg);
+        } else {
+            chunk->acc = pass->combine(chunk->acc, pass->map(cur->data, pass->arg));
+        }
+    }
+    chunk->lead = chunk->lead < 0 ? chunk->count : chunk->lead;
+    chunk->tail = since;
+}
+
+/**
+ * Worker loop, takes chunks until they run out
+ */
+static void* par_worker(void* arg) {
+    ParPass* pass = (ParPass*)arg;
+    int j;
+    while ((j = atomic_fetch_add(&pass->next_chunk, 1)) < pass->chunk_count) {
+        par_walk(pass, j);
+    }
+    return NULL;
+}
+
+/**
+ * Swaps in the anchors the pass laid down, keeping an old one only if it's
+ * at least half a gap from the anchor before it
+ * Every worker is done, anchor_lock still held
+ */
+static void par_reanchor(List* list, ParPass* pass) {
+    int total = 0;
+    for (int j = 0; j < pass->chunk_count; j++) {
+        total += 1 + pass->chunks[j].anchor_count;
+    }
+    Node** anchors = malloc(total * sizeof(Node*));
+    if (anchors == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    free(list->anchors);
+    list->anchors = anchors;
+    list->anchor_count = 0;
+    list->anchor_cap = total;
+
+    long run = 0; // Live nodes since the last anchor kept
+    long before_first = -1;
+    for (int j = 0; j < pass->chunk_count; j++) {
+        ParChunk* chunk = &pass->chunks[j];
+        if (j > 0) {
+            if (run >= ANCHOR_GAP / 2) {
+                before_first = before_first < 0 ? run : before_first;
+                list->anchors[list->anchor_count++] = chunk->start;
+                run = 0;
+            } else {
+                atomic_store(&chunk->start->anchor, false); // A waiting LIST_LAZY delete won't find it, fine
+            }
+        }
+        if (chunk->anchor_count > 0) {
+            before_first = before_first < 0 ? run + chunk->lead : before_first;
+            memcpy(&list->anchors[list->anchor_count], chunk->anchors, chunk->anchor_count * sizeof(Node*));
+            list->anchor_count += chunk->anchor_count;
+            run = chunk->tail;
+        } else {
+            run += chunk->count;
+        }
+    }
+    anchor_reverse(list);
+    list->since_anchor = before_first < 0 ? run : before_first;
+}
+
+/**
+ * Splits the list at its anchors and runs pass over it
+ * Call with the pass locks held, see par_lock()
+ */
+static void par_pass(List* list, ParPass* pass) {
+    int n = list->anchor_count + 1;
+    pass->list = list;
+    pass->chunks = calloc(n, sizeof(ParChunk));
+    if (pass->chunks == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    pass->chunks[0].start = first_node(list);
+    for (int j = 1; j < n; j++) {
+        pass->chunks[j].start = list->anchors[list->anchor_count - j];
+    }
+    pass->chunk_count = n;
+    atomic_init(&pass->next_chunk, 0);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = list_parallel_threads > 0 ? list_parallel_threads : (cpus > 0 ? (int)cpus : 1);
+    workers = workers < n ? workers : n;
+    workers = workers < PAR_MAX_WORKERS ? workers : PAR_MAX_WORKERS;
+    pthread_t threads[PAR_MAX_WORKERS];
+    int started = 0;
+    for (int i = 1; i < workers; i++) {
+        if (pthread_create(&threads[started], NULL, par_worker, pass) == 0) {
+            started++;
+        } // Short a worker, the others take its chunks
+    }
+    par_worker(pass);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pass->result = pass->identity;
+    for (int j = 0; j < n && pass->op == PAR_REDUCE; j++) {
+        pass->result = pass->combine(pass->result, pass->chunks[j].acc);
+    }
+    if (pass->op != PAR_FREE) {
+        par_reanchor(list, pass);
+    }
+    for (int j = 0; j < n; j++) {
+        free(pass->chunks[j].anchors);
+    }
+    free(pass->chunks);
+}
+
+/**
+ * Holds the list still enough for a pass, see above
+ */
+static void par_lock(List* list) {
+    if (list->mode == LIST_LAZY) {
+        ebr_enter(); // Covers the workers too, nothing retired from here on gets freed
+    } else if (list->mode == LIST_RCU) {
+        STAT_LOCK(pthread_mutex_lock(&list->writer));
+    } else {
+        STAT_LOCK(pthread_rwlock_rdlock(&list->rwlock));
+    }
+    STAT_LOCK(pthread_mutex_lock(&list->anchor_lock));
+}
+
+static void par_unlock(List* list) {
+    pthread_mutex_unlock(&list->anchor_lock);
+    if (list->mode == LIST_LAZY) {
+        ebr_exit();
+    } else if (list->mode == LIST_RCU) {
+        pthread_mutex_unlock(&list->writer);
+    } else {
+        pthread_rwlock_unlock(&list->rwlock);
+    }
+}
+
+/**
+ * Calls cb on every value, split across list_parallel_threads workers
+ * cb runs on several threads at once in no particular order, and must not write to the list
+ */
+void list_parallel_for_each(List* list, void (*cb)(int data, void* arg), void* arg) {
+    if (atomic_load(&list->image) != NULL) { // Still a mapped image, no nodes to split
+        list_for_each(list, cb, arg);
+        return;
+    }
+    ParPass pass = { .op = PAR_EACH, .each = cb, .arg = arg };
+    par_lock(list);
+    par_pass(list, &pass);
+    par_unlock(list);
+}
+
+/**
+ * Folds map(value) over the whole list with combine, split across the workers
+ * Each chunk starts from identity and the chunks are combined in list order,
+ * so combine has to be associative and identity has to be its identity
+ * map runs on several threads at once and must not write to the list
+ */
+long list_parallel_reduce(List* list, long (*map)(int data, void* arg), long (*combine)(long a, long b),
+                          long identity, void* arg) {
+    if (atomic_load(&list->image) != NULL) { // Still a mapped image, no nodes to split
+        ListIter it;
+        int data;
+        long acc = identity;
+        list_iter_begin(list, &it, ITER_WEAK);
+        while (list_iter_next(&it, &data)) {
+            acc = combine(acc, map(data, arg));
+        }
+        list_iter_end(&it);
+        return acc;
+    }
+    ParPass pass = { .op = PAR_REDUCE, .map = map, .combine = combine, .identity = identity, .arg = arg };
+    par_lock(list);
+    par_pass(list, &pass);
+    par_unlock(list);
+    return pass.result;
+}
+
+/**
+ * Count map and sum combine for list_parallel_reduce()
+ */
+long count_one(int data, void* arg) {
+    (void)data;
+    (void)arg;
+    return 1;
+}
+
+long sum_values(long a, long b) {
+    return a + b;
+}
+
+/**
+ * Debug check: walks the list (in parallel) and compares with the counters
+ * Only meaningful once all threads are done
+ */
+bool validate_size(List* list) {
+    long walked = list_parallel_reduce(list, count_one, sum_values, 0, NULL);
+    long counted = size_exact(list);
+    if (walked != counted) {
+        printf("size mismatch: walked %ld nodes, counters say %ld\n", walked, counted);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Bulk load
+ *
+ * Builds a whole list from ascending keys in one pass: the nodes come off
+ * pool_alloc_seq() back to back in the order they're linked, so loading runs
+ * at memory speed and walking the new list afterwards is a straight sweep
+ * through memory. The finished chain goes in with one store on head.
+ */
+
+/**
+ * Builds the list from stream, frees what it built if the keys weren't ascending
+ */
+static bool bulk_load(List* list, ListMode mode, KeyStream* stream) {
+    list_init(list, mode);
+    Node* first = NULL;
+    Node* last = NULL;
+    long count = 0;
+    bool ascending = true;
+    int key;
+    while (stream_next(stream, &key)) {
+        if (last != NULL && key < last->data) {
+            ascending = false;
+            break;
+        }
+        last = chain_append(list, &first, last, key);
+        if (++count % ANCHOR_GAP == 0) {
+            anchor_push(list, last);
+        }
+    }
+    anchor_reverse(list);
+
+    if (!ascending || stream->failed) {
+        printf("bulk load: %s after %ld keys\n", ascending ? "input ran out" : "keys not ascending", count);
+        while (first != NULL) {
+            Node* next = atomic_load_explicit(&first->next, memory_order_relaxed);
+            pool_free(first);
+            first = next;
+        }
+        list->anchor_count = 0;
+        return false;
+    }
+    counter_add(&list->size, count);
+    if (list->mode == LIST_LAZY) {
+        atomic_store_explicit(&atomic_load(&list->head)->next, first, memory_order_release);
+    } else {
+        atomic_store_explicit(&list->head, first, memory_order_release);
+    } // Nobody could see any of it before this
+    return true;
+}
+
+/**
+ * Sets up list in mode holding the n keys of an array, false if they aren't ascending
+ * Keys have to be ascending, duplicates are fine
+ */
+bool list_bulk_load(List* list, ListMode mode, const int* keys, long n) {
+    KeyStream stream;
+    stream_array(&stream, keys, n);
+    return bulk_load(list, mode, &stream);
+}
+
+/**
+ * Sets up list in mode holding n keys read from fd (raw ints, see batch.c)
+ * False if they aren't ascending or the read comes up short
+ */
+bool list_bulk_load_fd(List* list, ListMode mode, int fd, long n) {
+    KeyStream stream;
+    stream_fd(&stream, fd, n);
+    return bulk_load(list, mode, &stream);
+}
+
+/*
+ * Persistence
+ *
+ * list_save() writes a snapshot of the list as an image file, list_open_mmap()
+ * maps one back in without building any nodes, see list-image.c.
+ */
+
+/**
+ * Saves a consistent copy of the list to path, false if it can't be written
+ * Safe to call while other threads are using the list
+ */
+bool list_save(List* list, const char* path) {
+    ListIter it;
+    list_iter_begin(list, &it, ITER_SNAPSHOT);
+    bool ok = image_save(path, it.values, it.count);
+    list_iter_end(&it);
+    return ok;
+}
+
+/**
+ * Sets up list in mode backed by the image at path, false if it can't be opened
+ * O(1): the records are only read as they're used, the nodes only get built
+ * on the first write
+ */
+bool list_open_mmap(List* list, ListMode mode, const char* path) {
+    list_init(list, mode);
+    ListImage* image = image_open(path);
+    if (image == NULL) {
+        return false;
+    }
+    counter_add(&list->size, image->count);
+    atomic_store(&list->image, image);
+    return true;
+}
+
+/**
+ * Free memory used by the list, leaves it empty and usable
+ * The nodes are freed in parallel, one chunk per worker, see par_pass()
+ * The slabs stay with the node pool, pool_destroy_all() gives them back at exit
+ * LIST_LAZY/LIST_RCU: call once all threads are done, after ebr_drain()
+ * Takes the filter off as well
+ */
+void free_list(List* list) {
+    write_lock(list);
+
+    ListImage* image = atomic_load(&list->image);
+    if (image != NULL) { // Never promoted
+        image_close(image);
+        atomic_store(&list->image, NULL);
+    }
+
+    ParPass pass = { .op = PAR_FREE }; // Every chunk freed at once
+    pthread_mutex_lock(&list->anchor_lock);
+    par_pass(list, &pass);
+    list->anchor_count = 0;
+    list->since_anchor = 0;
+    pthread_mutex_unlock(&list->anchor_lock);
+
+    if (list->mode == LIST_LAZY) {
+        atomic_store(&atomic_load(&list->head)->next, NULL);
+    } else {
+        list->head = NULL;
+    }
+    counter_reset(&list->size);
+    snap_destroy(&list->snap);
+    list_set_filter(list, 0, 0);
+    write_unlock(list);
+}
+
+/**
+ * free_list() for a list that's going away, also frees the LIST_LAZY sentinel
+ */
+void list_destroy(List* list) {
+    free_list(list);
+    if (list->mode == LIST_LAZY) {
+        pool_free(atomic_load(&list->head));
+        atomic_store(&list->head, NULL);
+    }
+    free(list->anchors);
+    list->anchors = NULL;
+    list->anchor_cap = 0;
+    pthread_rwlock_destroy(&list->rwlock);
+    pthread_mutex_destroy(&list->writer);
+    pthread_mutex_destroy(&list->anchor_lock);
+}
@@ -0,0 +1,243 @@
+#ifndef LIST_IMAGE_C
+#define LIST_IMAGE_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * On-disk list image for list_save()/list_open_mmap()
+ *
+ * The file is a header followed by one record per value. Records point at
+ * each other with byte offsets from the start of the file instead of
+ * pointers, so the file means the same thing wherever it gets mapped and can
+ * be used straight off the page cache without fixing anything up.
+ *
+ *   ImageHeader | ImageRecord 0 | ImageRecord 1 | ... | ImageRecord count-1
+ *
+ * image_save() writes the values in ascending order, back to back, so on top
+ * of walking the next offsets the lookups can binary search the records by
+ * index. Opening only checks the header and the file length, O(1) however
+ * big the list is. The pages get read in as the image is used.
+ *
+ * Fields are in host byte order, an image is meant to be reopened on the
+ * machine that saved it.
+ */
+
+#define IMAGE_MAGIC "LISTIMG"
+#define IMAGE_VERSION 1
+
+typedef struct ImageHeader {
+    char magic[8];          // IMAGE_MAGIC, NUL padded
+    uint32_t version;
+    uint32_t record_size;   // sizeof(ImageRecord) when it was written
+    uint64_t count;
+    uint64_t first;         // Offset of the first record, 0 if empty
+} ImageHeader;
+
+typedef struct ImageRecord {
+    int32_t data;
+    uint32_t reserved;
+    uint64_t next;          // Offset of the next record, 0 at the end
+} ImageRecord;
+
+typedef struct ListImage {
+    const unsigned char* base;
+    size_t length;
+    long count;
+} ListImage;
+
+/**
+ * Writes values (ascending) as an image at path
+ * Goes through path.tmp and a rename, so a crash never leaves half an image
+ */
+bool image_save(const char* path, const int* values, long count) {
+    size_t tmp_len = strlen(path) + 5;
+    char* tmp = malloc(tmp_len);
+    if (tmp == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+
+    FILE* file = fopen(tmp, "wb");
+    if (file == NULL) {
+        perror("image save");
+        free(tmp);
+        return false;
+    }
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.version = IMAGE_VERSION;
+    header.record_size = sizeof(ImageRecord);
+    header.count = count;
+    header.first = count > 0 ? sizeof(ImageHeader) : 0;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (long i = 0; i < count && ok; i++) {
+        ImageRecord record;
+        record.data = values[i];
+        record.reserved = 0;
+        record.next = i + 1 < count ? sizeof(ImageHeader) + (uint64_t)(i + 1) * sizeof(ImageRecord) : 0;
+        ok = fwrite(&record, sizeof(record), 1, file) == 1;
+    }
+
+    ok = fflush(file) == 0 && ok;
+    ok = fsync(fileno(file)) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+    if (ok && rename(tmp, path) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        perror("image save");
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok;
+}
+
+/**
+ * Maps an image read-only, NULL if it can't be opened or isn't one
+ */
+ListImage* image_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("image open");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ImageHeader)) {
+        printf("image open: %s is too short\n", path);
+        close(fd);
+        return NULL;
+    }
+    size_t length = st.st_size;
+    void* base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file
+    if (base == MAP_FAILED) {
+        perror("image open");
+        return NULL;
+    }
+
+    const ImageHeader* header = base;
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+        header->version != IMAGE_VERSION || header->record_size != sizeof(ImageRecord) ||
+        header->count > (length - sizeof(ImageHeader)) / sizeof(ImageRecord)) {
+        printf("image open: %s is not a list image\n", path);
+        munmap(base, length);
+        return NULL;
+    }
+
+    ListImage* image = malloc(sizeof(ListImage));
+    if (image == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    image->base = base;
+    image->length = length;
+    image->count = header->count;
+    return image;
+}
+
+/**
+ * Unmaps an image, also the ebr reclaim callback once a list is promoted
+ */
+void image_close(void* arg) {
+    ListImage* image = (ListImage*)arg;
+    munmap((void*)image->base, image->length);
+    free(image);
+}
+
+/**
+ * Record at a file offset, NULL for 0 or anything outside the file
+ */
+static inline const ImageRecord* image_at(const ListImage* image, uint64_t offset) {
+    if (offset < sizeof(ImageHeader) || offset > image->length - sizeof(ImageRecord)) {
+        return NULL;
+    }
+    return (const ImageRecord*)(image->base + offset);
+}
+
+/**
+ * First record in list order, NULL if the image is empty
+ */
+static inline const ImageRecord* image_first(const ListImage* image) {
+    return image_at(image, ((const ImageHeader*)image->base)->first);
+}
+
+/**
+ * Follows a record's next offset
+ */
+static inline const ImageRecord* image_next(const ListImage* image, const ImageRecord* record) {
+    return image_at(image, record->next);
+}
+
+/**
+ * Value of the i-th record, records sit back to back after the header
+ */
+static inline int image_value(const ListImage* image, long i) {
+    return ((const ImageRecord*)(image->base + sizeof(ImageHeader)))[i].data;
+}
+
+/**
+ * Index of the first record >= data, count if there's none
+ */
+long image_lower_bound(const ListImage* image, int data) {
+    long lo = 0;
+    long hi = image->count;
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if (image_value(image, mid) < data) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Whether the image holds data
+ */
+bool image_contains(const ListImage* image, int data) {
+    long i = image_lower_bound(image, data);
+    return i < image->count && image_value(image, i) == data;
+}
+
+/**
+ * contains_many() against an image, keys already sorted
+ */
+int image_contains_many(const ListImage* image, const int* keys, int n, bool* found) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        found[i] = image_contains(image, keys[i]);
+        count += found[i];
+    }
+    return count;
+}
+
+/**
+ * Copies every value out in ascending order (malloc'd, *count of them)
+ */
+int* image_copy_values(const ListImage* image, long* count) {
+    int* values = malloc((image->count > 0 ? image->count : 1) * sizeof(int));
+    if (values == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    for (long i = 0; i < image->count; i++) {
+        values[i] = image_value(image, i);
+    }
+    *count = image->count;
+    return values;
+}
+
+#endif
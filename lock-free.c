@@ -4,202 +4,1771 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdatomic.h>
+#include <sched.h>
+#include "ebr.c"
+#include "node-pool.c"
+#include "size-counter.c"
+#include "batch.c"
+#include "stats.c"
+#include "backoff.c"
+#include "snapshot.c"
+#include "list-image.c"
+#include "bloom.c"
+#include "mcas.c"
 
 // Define the Node structure with atomic next pointer
+// The low bit of next is the logical delete mark (Harris), so marking and
+// linking after a node are the same word and can't race each other
+// Bit 1 of next (and head) is an mcas.c descriptor, see link_read()
 typedef struct Node {
     int data;
     _Atomic(struct Node*) next;
-    _Atomic bool marked;  // Flag for logical deletion
 } Node;
 
+// Node of a versioned list, see list_set_versioned()
+// 24 bytes against 16, so plain lists don't carry the stamps
+typedef struct VersionedNode {
+    Node node;
+    _Atomic unsigned ins;  // Snapshot stamps, see snapshot.c
+    _Atomic unsigned del;
+} VersionedNode;
+
+NodePool node_pool = NODE_POOL_INIT(Node);
+NodePool versioned_pool = NODE_POOL_INIT(VersionedNode);
+
+static inline bool is_marked(Node* p) {
+    return ((uintptr_t)p & 1) != 0;
+}
+
+static inline Node* get_unmarked(Node* p) {
+    return (Node*)((uintptr_t)p & ~(uintptr_t)1);
+}
+
+static inline Node* get_marked(Node* p) {
+    return (Node*)((uintptr_t)p | 1);
+}
+
 /**
- * Allocates and creates a new node object
+ * Loads a next pointer or head for a walk, reads through an mcas.c
+ * descriptor if one is in it (list_move(), list_replace() and moves put them there)
  */
-Node* create_node(int data) {
-    Node* new_node = (Node*)malloc(sizeof(Node));
-    if (new_node == NULL) {
-        printf("malloc fail\n");
-        exit(1);
-    }
+static inline Node* link_read(_Atomic(Node*)* link) {
+    return (Node*)mcas_read((_Atomic(void*)*)link);
+}
+
+/**
+ * Same for a link about to be CASed, helps a descriptor out of the way first
+ */
+static inline Node* link_load(_Atomic(Node*)* link) {
+    return (Node*)mcas_load((_Atomic(void*)*)link);
+}
+
+/**
+ * Adds link: old -> new to a multi-word update
+ */
+static inline void mcas_add_link(McasDesc* desc, _Atomic(Node*)* link, Node* old, Node* new) {
+    mcas_add(desc, (_Atomic(void*)*)link, old, new);
+}
+
+/**
+ * Sets up a freshly allocated node
+ */
+static inline Node* init_node(Node* new_node, int data) {
     new_node->data = data;
     atomic_store(&new_node->next, NULL); // Atomicity for protection
-    atomic_store(&new_node->marked, false);
     return new_node;
 }
 
+static inline VersionedNode* versioned_node(Node* node) {
+    return (VersionedNode*)node;
+}
+
 /**
- * Lock-free insert a node at the first position
+ * Sets up a freshly allocated VersionedNode, ins 1 counts as there since
+ * before any snapshot
  */
-Node* insert_begin(_Atomic(Node*) *head_ptr, int data) {
-    Node* new_node = create_node(data);
-    Node* expected;
-    
-    do {
-        expected = atomic_load(head_ptr);
-        atomic_store(&new_node->next, expected);
-    } while (!atomic_compare_exchange_strong(head_ptr, &expected, new_node)); // Compare and swap like slides
-    
-    return new_node;
+static inline Node* init_versioned_node(VersionedNode* new_node, int data, unsigned ins) {
+    atomic_store_explicit(&new_node->ins, ins, memory_order_relaxed);
+    atomic_store_explicit(&new_node->del, 0, memory_order_relaxed);
+    return init_node(&new_node->node, data);
 }
+
 /**
- * Find a node, helper for deletion
+ * Allocates and creates a new node object
  */
-bool find(_Atomic(Node*) *head_ptr, int data, Node** pred_ptr, Node** cur_ptr) {
-retry: { // Block to stop compiler warning (and in case lab machines are running old C)
-    Node* pred = atomic_load(head_ptr);
-    if (pred == NULL) {
-        *pred_ptr = NULL;
-        *cur_ptr = NULL;
-        return false;
+Node* create_node(int data) {
+    return init_node((Node*)pool_alloc(&node_pool), data);
+}
+
+/**
+ * Same for a structure that stamps its nodes, plain if stamps is NULL
+ */
+Node* create_node_for(SnapClock* stamps, int data) {
+    if (stamps != NULL) {
+        return init_versioned_node((VersionedNode*)pool_alloc(&versioned_pool), data, 0);
     }
-    
-    Node* cur = atomic_load(&pred->next);
+    return create_node(data);
+}
+
+/**
+ * Appends a node for data to a chain nobody can see yet, returns it
+ * The nodes come from pool_alloc_seq(), so the chain is laid out in walk order
+ */
+static inline Node* chain_append(SnapClock* stamps, Node** first, Node* last, int data) {
+    Node* node = stamps != NULL
+        ? init_versioned_node((VersionedNode*)pool_alloc_seq(&versioned_pool), data, 1)
+        : init_node((Node*)pool_alloc_seq(&node_pool), data);
+    if (last == NULL) {
+        *first = node;
+    } else {
+        atomic_store_explicit(&last->next, node, memory_order_relaxed);
+    }
+    return node;
+}
+
+/**
+ * Frees a node once ebr says nobody can see it anymore
+ */
+void reclaim_node(void* node) {
+    pool_free(node);
+}
+
+/**
+ * Stamps a linked node's insert, after this every snapshot agrees it's there
+ * snap is NULL for plain nodes, which have nothing to stamp
+ */
+static inline void stamp_insert(SnapClock* snap, Node* node) {
+    if (snap != NULL) {
+        snap_stamp(snap, &versioned_node(node)->ins);
+    }
+}
+
+/**
+ * Stamps a marked node's delete
+ */
+static inline void stamp_delete(SnapClock* snap, Node* node) {
+    if (snap != NULL) {
+        snap_stamp(snap, &versioned_node(node)->del);
+    }
+}
+
+/**
+ * Call right before the CAS that unlinks a marked node
+ */
+static inline void report_unlink(SnapClock* snap, Node* node) {
+    if (snap != NULL) {
+        unsigned del = snap_stamp(snap, &versioned_node(node)->del);
+        snap_report(snap, node, node->data, atomic_load(&versioned_node(node)->ins), del);
+    }
+}
+
+/**
+ * Find a node, helper for the delete and sorted paths
+ * Unlinks any marked nodes it walks over on the way
+ * sorted: stop at the first node >= data, otherwise stop at the first == data
+ * prev_ptr gets the link that points at cur (head_ptr or some node's next)
+ * Caller must be inside ebr_enter()/ebr_exit()
+ */
+bool find(SnapClock* snap, _Atomic(Node*) *head_ptr, int data, bool sorted, _Atomic(Node*) **prev_ptr, Node** cur_ptr) {
+    stat_add(STAT_OPS, 1);
+retry: { // Block to stop compiler warning (and in case lab machines are running old C)
+    _Atomic(Node*) *prev = head_ptr;
+    Node* cur = link_load(prev);
     
     while (cur != NULL) {
-        Node* succ = atomic_load(&cur->next);
+        Node* succ = link_load(&cur->next);
+        stat_add(STAT_VISITED, 1);
         
         // Check if current node is marked
-        if (atomic_load(&cur->marked)) {
+        if (is_marked(succ)) {
             // Try to physically remove the logically deleted node
-            if (!atomic_compare_exchange_strong(&pred->next, &cur, succ)) {
+            // prev must still point at cur unmarked, so this can't drop an insert
+            report_unlink(snap, cur);
+            if (!stat_cas(STAT_SITE_UNLINK, atomic_compare_exchange_strong(prev, &cur, get_unmarked(succ)))) {
                 // CAS failed, retry from the beginning
+                stat_add(STAT_RETRIES, 1);
                 goto retry;
             }
-            cur = succ;
+            stat_add(STAT_HELP_UNLINKS, 1);
+            ebr_retire(cur, reclaim_node); // We unlinked it, so we retire it
+            cur = get_unmarked(succ);
         } else {
-            if (cur->data >= data) {
-                *pred_ptr = pred;
+            if (cur->data == data || (sorted && cur->data > data)) {
+                *prev_ptr = prev;
                 *cur_ptr = cur;
                 return cur->data == data;
             }
-            pred = cur;
+            prev = &cur->next;
             cur = succ;
         }
     }
     
-    *pred_ptr = pred;
+    *prev_ptr = prev;
     *cur_ptr = NULL;
     return false;
     }
 }
 
 /**
- * Deletes a given node
- * Deletes logically first then for real
+ * Deletes the first node holding data, helper for delete_node()/delete_sorted()
+ * Caller must be inside ebr_enter()/ebr_exit()
  */
-bool delete_node(_Atomic(Node*) *head_ptr, int data) {
-    Node* head = atomic_load(head_ptr);
-    if (head == NULL) {
-        printf("empty list\n");
-        return false;
-    }
-    
-    // Special case for head
-    if (head->data == data) {
-        bool expected = false; // Try to mark the head for deletion
-        if (atomic_compare_exchange_strong(&head->marked, &expected, true)) {
-            Node* next = atomic_load(&head->next); // Try to atomically replace the head
-            if (atomic_compare_exchange_strong(head_ptr, &head, next)) {
-                free(head);
-            }
-            return true;
-        }
-        return false;
-    }
-    
-    Node* pred;
+bool delete_epoch(SnapClock* snap, _Atomic(Node*) *head_ptr, int data, bool sorted) {
+    _Atomic(Node*) *prev;
     Node* cur;
-    bool found;
+    Backoff backoff;
+    backoff_init(&backoff);
     
     while (true) {
-        found = find(head_ptr, data, &pred, &cur);
-        if (!found || cur == NULL) {
-            printf("delete: value %d not found\n", data);
+        if (!find(snap, head_ptr, data, sorted, &prev, &cur)) {
             return false;
         }
         
-        bool expected = false; // Try to mark the node for deletion
-        if (!atomic_compare_exchange_strong(&cur->marked, &expected, true)) {
-            continue; // Already marked or cas failed, retry
-        } // Node is now logically deleted
+        stamp_insert(snap, cur); // Can't delete what a snapshot could still call pending
+        Node* succ = link_load(&cur->next); // Try to mark the node for deletion
+        if (is_marked(succ) ||
+            !stat_cas(STAT_SITE_MARK, atomic_compare_exchange_strong(&cur->next, &succ, get_marked(succ)))) {
+            stat_add(STAT_RETRIES, 1);
+            backoff_pause(&backoff);
+            continue; // Already marked or next changed, retry
+        } // Node is now logically deleted, nothing can link after it anymore
 
-        Node* succ = atomic_load(&cur->next); // Update next pointer to physically remove the node
-        if (atomic_compare_exchange_strong(&pred->next, &cur, succ)) {
-            free(cur);
+        report_unlink(snap, cur); // Stamps the delete as well
+        if (stat_cas(STAT_SITE_UNLINK, atomic_compare_exchange_strong(prev, &cur, succ))) {
+            ebr_retire(cur, reclaim_node); // Readers may still be on it, free later
         }
-        // If cas fail, the loop will call find() again to ensure deletion
+        // If cas fail, the next find() over it will unlink it
         return true;
     }
 }
 
+#ifndef LOCK_FREE_CORE_ONLY
+/*
+ * Plain list API
+ *
+ * Structures that reuse the node and find() machinery above under the same
+ * function names (hash-set.c) define LOCK_FREE_CORE_ONLY to leave these out.
+ *
+ * Head contention: an insert_begin() whose CAS on head fails backs off, and
+ * spends the backoff parked in one of the list's elimination slots. A
+ * delete_node() checks the slots before walking, and if one holds its value
+ * it takes the node out of the slot and both calls return without touching
+ * the list (the insert counts as happening right before the delete).
+ *
+ * Mapped images: list_open_mmap() leaves the list empty and answers reads
+ * from the mapped file instead (see list-image.c). The first call that has
+ * to change the list, or hand out a Node*, promotes it: builds the nodes
+ * from the image in one go and swings head to them. Calls that arrive while
+ * that's happening wait for it, readers already in the image finish there.
+ *
+ * Adaptive ordering: list_set_adaptive() makes search()/contains() move
+ * nodes they hit deep in the list up to the head, see move_to_front().
+ *
+ * Filter: list_set_filter() puts a counting Bloom filter (bloom.c) in front
+ * of the lookups, so most misses are answered without walking the list.
+ *
+ * Versioning: list_set_versioned() gives the list VersionedNodes carrying
+ * snapshot stamps (snapshot.c), which ITER_SNAPSHOT needs to be exact while
+ * writers run. Plain lists skip the stamps and their loads and CASes.
+ *
+ * Multi-key: list_move(), list_replace() and insert_if_absent() change more
+ * than one thing at once without a lock, see mcas.c and the section below.
+ */
+
+#define ELIM_SLOTS 8
+
+typedef struct ElimSlot {
+    _Alignas(64) _Atomic(Node*) offer; // Node of a waiting insert_begin(), NULL if free
+} ElimSlot;
+
+typedef struct List {
+    _Atomic(Node*) head;
+    SizeCounter size;  // Live nodes, updated at each insert/logical delete
+    ElimSlot elim[ELIM_SLOTS];
+    SnapClock snap;
+    SnapClock* stamps;         // &snap once versioned, NULL with plain nodes
+    _Atomic(ListImage*) image; // Mapped image not promoted yet, NULL normally
+    _Atomic bool promoting;
+    bool adaptive;             // Hits move to the front, see list_set_adaptive()
+    _Atomic unsigned move_seq; // Odd while a move is under way
+    _Atomic unsigned replace_begun; // list_replace() calls started and finished,
+    _Atomic unsigned replace_done;  // snapshots wait for these to match
+    BloomFilter* filter;       // Keys that might be in the list, NULL when off
+} List;
+
+/**
+ * Sets up an empty list
+ */
+void list_init(List* list) {
+    atomic_init(&list->head, NULL);
+    counter_reset(&list->size);
+    for (int i = 0; i < ELIM_SLOTS; i++) {
+        atomic_init(&list->elim[i].offer, NULL);
+    }
+    snap_init(&list->snap);
+    list->stamps = NULL;
+    atomic_init(&list->image, NULL);
+    atomic_init(&list->promoting, false);
+    list->adaptive = false;
+    atomic_init(&list->move_seq, 0);
+    atomic_init(&list->replace_begun, 0);
+    atomic_init(&list->replace_done, 0);
+    list->filter = NULL;
+}
+
 /**
- * Wait-free return a node with a given value
+ * Turns snapshot versioning on or off, false if the list already has nodes
+ * Set it before other threads use the list. A mapped list that hasn't been
+ * written to yet counts as empty, bulk loads come out plain
  */
-Node* search(_Atomic(Node*) *head_ptr, int data) {
-    Node* cur = atomic_load(head_ptr);
-    while (cur != NULL) {
-        if (!atomic_load(&cur->marked) && cur->data == data) {
-            return cur;
+bool list_set_versioned(List* list, bool versioned) {
+    if (atomic_load(&list->head) != NULL) {
+        printf("list_set_versioned: list isn't empty\n");
+        return false;
+    }
+    list->stamps = versioned ? &list->snap : NULL;
+    return true;
+}
+
+/**
+ * Turns a mapped image into real nodes, only the first caller builds them
+ */
+void list_promote(List* list) {
+    ListImage* image = atomic_load(&list->image);
+    bool expected = false;
+    if (image == NULL || !atomic_compare_exchange_strong(&list->promoting, &expected, true)) {
+        while (atomic_load(&list->image) != NULL) {
+            sched_yield(); // Someone else is building it
         }
-        cur = atomic_load(&cur->next);
+        return;
+    }
+
+    Node* first = NULL;
+    Node* last = NULL;
+    for (const ImageRecord* record = image_first(image); record != NULL; record = image_next(image, record)) {
+        last = chain_append(list->stamps, &first, last, record->data);
     }
-    return NULL;
+    atomic_store(&list->head, first); // Nothing else writes head until image is cleared
+    atomic_store(&list->image, NULL);
+    ebr_retire(image, image_close); // Readers may still be in it
 }
 
 /**
- * Wait-free check if a value exists in the list
+ * Promotes the list if it's still backed by an image, one load otherwise
  */
-bool contains(_Atomic(Node*) *head_ptr, int data) {
-    return search(head_ptr, data) != NULL;
+static inline void promote_if_mapped(List* list) {
+    if (atomic_load(&list->image) != NULL) {
+        list_promote(list);
+    }
 }
 
 /**
- * Wait-free print list contents
+ * Parks an insert's node in a slot for up to spins pauses
+ * Returns true if a delete took it, then the node is retired and the insert is done
+ */
+static bool elim_offer(List* list, Node* node, unsigned spins) {
+    if (spins == 0) {
+        return false;
+    }
+    ElimSlot* slot = &list->elim[spins % ELIM_SLOTS];
+    Node* empty = NULL;
+    if (!atomic_compare_exchange_strong(&slot->offer, &empty, node)) {
+        for (unsigned i = spins; i > 0; i--) { // Slot's busy, just back off
+            cpu_relax();
+        }
+        return false;
+    }
+    for (unsigned i = spins; i > 0 && atomic_load_explicit(&slot->offer, memory_order_relaxed) == node; i--) {
+        cpu_relax();
+    }
+    Node* mine = node;
+    if (atomic_compare_exchange_strong(&slot->offer, &mine, NULL)) {
+        return false; // Nobody came, try head again
+    }
+    stat_add(STAT_ELIMINATED, 1);
+    ebr_retire(node, reclaim_node); // Deletes scanning the slots may still read its data
+    return true;
+}
+
+/**
+ * Takes a waiting insert of data out of the slots, call inside ebr_enter()/ebr_exit()
+ */
+static bool elim_take(List* list, int data) {
+    for (int i = 0; i < ELIM_SLOTS; i++) {
+        Node* offer = atomic_load(&list->elim[i].offer);
+        if (offer != NULL && offer->data == data &&
+            atomic_compare_exchange_strong(&list->elim[i].offer, &offer, NULL)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Adaptive ordering
+ *
+ * insert_begin() puts keys wherever they happen to land, so a hot key can sit
+ * deep in the list and every lookup for it walks all the way there. On an
+ * adaptive list a search() that hits a node ADAPT_MIN_DEPTH or more steps in
+ * moves it to the head, on one hit in ADAPT_SAMPLE per thread so a key that
+ * only comes up now and then doesn't churn the head. Hot keys get sampled
+ * often and end up near the front, and once they're there nothing moves, so
+ * the walk length follows the access pattern instead of the list size.
+ *
+ * A move marks the old node and links a copy at the head in one mcas_run(),
+ * then unlinks the old one. The value is never missing from the list, but a
+ * walk already past the head can step over the marked node and never see the
+ * copy, so the whole move runs inside an odd move_seq: a lookup or delete
+ * that comes up empty while the sequence changed under it looks again, and a
+ * snapshot taken while it's odd is taken again. Moves are an optimization,
+ * so only one runs at a time, anyone who finds one under way just skips
+ * theirs, and one whose mcas_run() fails is dropped.
+ *
+ * Lookups on an adaptive list wait for a move under way and can look again,
+ * so they're lock-free rather than wait-free there.
+ *
+ * Only for lists used with the unordered calls, the sorted mode relies on
+ * the order.
+ */
+
+#define ADAPT_SAMPLE 16    // Move on one deep hit in this many per thread
+#define ADAPT_MIN_DEPTH 8  // Hits closer to the head than this stay put
+
+_Thread_local unsigned adapt_hits = 0;
+
+Node* search(List* list, int data); // Further down, contains_many() falls back on it
+
+/**
+ * Turns adaptive ordering on or off, set it before other threads use the list
+ */
+void list_set_adaptive(List* list, bool adaptive) {
+    list->adaptive = adaptive;
+}
+
+/**
+ * Sequence to check a miss against later, waits out a move under way
+ */
+static inline unsigned move_seq_begin(List* list) {
+    unsigned seq;
+    while ((seq = atomic_load(&list->move_seq)) & 1) {
+        cpu_relax();
+    }
+    return seq;
+}
+
+/**
+ * Whether a move ran since move_seq_begin(), a miss has to look again then
+ */
+static inline bool move_seq_changed(List* list, unsigned seq) {
+    return atomic_load(&list->move_seq) != seq;
+}
+
+/**
+ * Whether a hit depth steps in should move, counts this thread's deep hits
+ */
+static inline bool adapt_sampled(int depth) {
+    return depth >= ADAPT_MIN_DEPTH && ++adapt_hits % ADAPT_SAMPLE == 0;
+}
+
+/**
+ * Marks node, whose next is succ, and swings link from old to new in one step
+ * False if either had changed, then neither is touched
+ */
+static bool mark_and_link(Node* node, Node* succ, _Atomic(Node*)* link, Node* old, Node* new) {
+    McasDesc* desc = mcas_begin();
+    mcas_add_link(desc, &node->next, succ, get_marked(succ));
+    mcas_add_link(desc, link, old, new);
+    return stat_cas(STAT_SITE_MCAS, mcas_run(desc));
+}
+
+/**
+ * Moves a node search() just hit to the head, returns the node holding its value now
+ * prev is the link search() came through, the old node is unlinked from it if
+ * it still points there, otherwise the next find() over it does that
+ * Caller must be inside ebr_enter()/ebr_exit()
+ */
+static Node* move_to_front(List* list, _Atomic(Node*) *prev, Node* node) {
+    unsigned seq = atomic_load(&list->move_seq);
+    if ((seq & 1) || !atomic_compare_exchange_strong(&list->move_seq, &seq, seq + 1)) {
+        return node; // Someone else is moving, skip it
+    }
+    Node* succ = link_load(&node->next);
+    if (is_marked(succ)) {
+        atomic_store(&list->move_seq, seq + 2);
+        return node; // Deleted since, leave it
+    }
+    Node* copy = create_node_for(list->stamps, node->data);
+    Node* first = link_load(&list->head);
+    atomic_store(&copy->next, first);
+    if (!mark_and_link(node, succ, &list->head, first, copy)) {
+        atomic_store(&list->move_seq, seq + 2);
+        pool_free(copy); // Never published
+        return node; // Linked after, deleted or head moved, leave it
+    }
+    stamp_delete(list->stamps, node);
+    stamp_insert(list->stamps, copy);
+
+    report_unlink(list->stamps, node);
+    Node* expected = node;
+    if (stat_cas(STAT_SITE_UNLINK, atomic_compare_exchange_strong(prev, &expected, succ))) {
+        ebr_retire(node, reclaim_node);
+    }
+    atomic_store(&list->move_seq, seq + 2);
+    stat_add(STAT_MOVED, 1);
+    return copy;
+}
+
+/**
+ * Deletes the first node holding data from the unordered list
+ * Looks again if it missed while a move was under way
+ * Caller must be inside ebr_enter()/ebr_exit()
+ */
+static bool delete_unordered(List* list, int data) {
+    bool deleted;
+    unsigned seq = 0;
+    do {
+        if (list->adaptive) {
+            seq = move_seq_begin(list);
+        }
+        deleted = delete_epoch(list->stamps, &list->head, data, false);
+    } while (!deleted && list->adaptive && move_seq_changed(list, seq));
+    return deleted;
+}
+
+/**
+ * Counts a key that's about to go in, before anyone can see its node
+ */
+static inline void filter_add(List* list, int data) {
+    if (list->filter != NULL) {
+        bloom_add(list->filter, data);
+    }
+}
+
+/**
+ * Takes out a key whose node is deleted
+ */
+static inline void filter_remove(List* list, int data) {
+    if (list->filter != NULL) {
+        bloom_remove(list->filter, data);
+    }
+}
+
+/**
+ * Whether the filter says data is definitely not there
+ */
+static inline bool filter_rules_out(List* list, int data) {
+    if (list->filter == NULL) {
+        return false;
+    }
+    stat_add(STAT_FILTER_CHECKS, 1);
+    if (bloom_maybe(list->filter, data)) {
+        return false;
+    }
+    stat_add(STAT_FILTER_NEGATIVES, 1);
+    return true;
+}
+
+/**
+ * Adds a filter sized for expected keys at about fp_rate false positives,
+ * expected <= 0 takes it off again
+ * Loads whatever is in the list already, set it before other threads use it
+ */
+void list_set_filter(List* list, long expected, double fp_rate) {
+    if (list->filter != NULL) {
+        bloom_destroy(list->filter);
+        list->filter = NULL;
+    }
+    if (expected <= 0) {
+        return;
+    }
+    BloomFilter* filter = bloom_create(expected, fp_rate);
+    ListImage* image = atomic_load(&list->image);
+    if (image != NULL) {
+        for (long i = 0; i < image->count; i++) {
+            bloom_add(filter, image_value(image, i));
+        }
+    }
+    for (Node* cur = atomic_load(&list->head); cur != NULL; cur = get_unmarked(atomic_load(&cur->next))) {
+        if (!is_marked(atomic_load(&cur->next))) {
+            bloom_add(filter, cur->data);
+        }
+    }
+    list->filter = filter;
+}
+
+/**
+ * Lock-free insert a node at the first position
+ * Returns NULL if a concurrent delete_node() of the same value cancelled it out
+ */
+Node* insert_begin(List* list, int data) {
+    promote_if_mapped(list);
+    filter_add(list, data); // A delete that eliminates it takes it back out
+    Node* new_node = create_node_for(list->stamps, data);
+    Node* expected;
+    Backoff backoff;
+    backoff_init(&backoff);
+    
+    ebr_enter(); // A delete can retire the node as soon as it's linked
+    while (true) {
+        expected = link_load(&list->head);
+        atomic_store(&new_node->next, expected);
+        if (stat_cas(STAT_SITE_INSERT_HEAD, atomic_compare_exchange_strong(&list->head, &expected, new_node))) { // Compare and swap like slides
+            break;
+        }
+        if (elim_offer(list, new_node, backoff_next(&backoff))) {
+            ebr_exit();
+            return NULL;
+        }
+    }
+    stamp_insert(list->stamps, new_node);
+    ebr_exit();
+    
+    counter_add(&list->size, 1);
+    return new_node;
+}
+
+/**
+ * Deletes a given node without complaining when it's not there
+ * Tries the elimination slots first, then the list
+ */
+bool try_delete(List* list, int data) {
+    promote_if_mapped(list);
+    ebr_enter();
+    if (elim_take(list, data)) {
+        ebr_exit();
+        filter_remove(list, data);
+        return true; // The insert never counted, so neither does this
+    }
+    bool deleted = delete_unordered(list, data);
+    ebr_exit();
+
+    if (deleted) {
+        counter_add(&list->size, -1);
+        filter_remove(list, data);
+    }
+    return deleted;
+}
+
+/**
+ * Deletes a given node
+ * Deletes logically first then for real
+ * Scans the whole list since insert_begin() doesn't keep it ordered
  */
-void print_list(_Atomic(Node*) *head_ptr) {
-    Node* head = atomic_load(head_ptr);
-    if (head == NULL) {
+bool delete_node(List* list, int data) {
+    promote_if_mapped(list);
+    if (atomic_load(&list->head) == NULL) {
         printf("empty list\n");
+        return false;
+    }
+
+    bool deleted = try_delete(list, data);
+    if (!deleted) {
+        printf("delete: value %d not found\n", data);
+    }
+    return deleted;
+}
+
+/**
+ * Lock-free insert a batch at the first position, sorts keys in place
+ * The nodes are linked up first and go in with a single CAS on head
+ */
+void insert_many(List* list, int* keys, int n) {
+    if (n <= 0) {
         return;
     }
+    batch_sort(keys, n);
+    promote_if_mapped(list);
+    for (int i = 0; i < n; i++) {
+        filter_add(list, keys[i]);
+    }
 
-    Node* cur = head;
-    printf("List: ");
-    while (cur != NULL) {
-        if (!atomic_load(&cur->marked)) {
-            printf("%d -> ", cur->data);
+    Node* last = create_node_for(list->stamps, keys[n - 1]);
+    Node* first = last;
+    for (int i = n - 2; i >= 0; i--) {
+        Node* node = create_node_for(list->stamps, keys[i]);
+        atomic_store_explicit(&node->next, first, memory_order_relaxed);
+        first = node;
+    }
+
+    Node* expected;
+    Backoff backoff;
+    backoff_init(&backoff);
+    ebr_enter();
+    while (true) {
+        expected = link_load(&list->head);
+        atomic_store(&last->next, expected);
+        if (stat_cas(STAT_SITE_INSERT_HEAD, atomic_compare_exchange_strong(&list->head, &expected, first))) {
+            break;
         }
-        cur = atomic_load(&cur->next);
+        backoff_pause(&backoff);
     }
-    printf("END\n");
+    Node* cur = first;
+    for (int i = 0; i < n; i++) { // One at a time, each insert takes effect at its stamp
+        stamp_insert(list->stamps, cur);
+        cur = get_unmarked(link_read(&cur->next));
+    }
+    ebr_exit();
+
+    counter_add(&list->size, n);
 }
 
 /**
- * Wait-free count nodes in list
+ * Lock-free delete one node per key in a batch, sorts keys in place
+ * deleted[i] says whether keys[i] (after sorting) found a node, returns how many did
+ * One pass marks whatever the batch asks for and unlinks it on the spot,
+ * works on plain and sorted lists alike
  */
-int count_nodes(_Atomic(Node*) *head_ptr) {
+int delete_many(List* list, int* keys, int n, bool* deleted) {
+    for (int i = 0; i < n; i++) {
+        deleted[i] = false;
+    }
+    if (n <= 0) {
+        return 0;
+    }
+    batch_sort(keys, n);
+    promote_if_mapped(list);
+
     int count = 0;
-    Node* cur = atomic_load(head_ptr);
-    while (cur != NULL) {
-        if (!atomic_load(&cur->marked)) { // Don't count logically deleted nodes
+    ebr_enter();
+    unsigned seq = list->adaptive ? move_seq_begin(list) : 0;
+    _Atomic(Node*) *prev = &list->head;
+    Node* cur = link_load(prev);
+    while (cur != NULL && count < n) {
+        Node* succ = link_load(&cur->next);
+        if (!is_marked(succ)) {
+            int i = batch_claim(keys, n, cur->data, deleted);
+            if (i < 0) {
+                prev = &cur->next;
+                cur = succ;
+                continue;
+            }
+            stamp_insert(list->stamps, cur);
+            if (!stat_cas(STAT_SITE_MARK, atomic_compare_exchange_strong(&cur->next, &succ, get_marked(succ)))) {
+                continue; // Someone linked after it or marked it, look again
+            }
+            deleted[i] = true;
             count++;
         }
-        cur = atomic_load(&cur->next);
+
+        succ = get_unmarked(succ);
+        report_unlink(list->stamps, cur);
+        Node* expected = cur;
+        if (stat_cas(STAT_SITE_UNLINK, atomic_compare_exchange_strong(prev, &expected, succ))) {
+            ebr_retire(cur, reclaim_node); // Same as find(), we unlinked it so we retire it
+            cur = succ;
+        } else { // prev changed under us, start over like find() does, marks we made stay
+            stat_add(STAT_RETRIES, 1);
+            prev = &list->head;
+            cur = link_load(prev);
+        }
+    }
+    if (list->adaptive && count < n && move_seq_changed(list, seq)) {
+        for (int i = 0; i < n; i++) { // A move may have hidden some, look for those one by one
+            if (!deleted[i] && delete_unordered(list, keys[i])) {
+                deleted[i] = true;
+                count++;
+            }
+        }
+    }
+    ebr_exit();
+
+    counter_add(&list->size, -count);
+    for (int i = 0; i < n; i++) {
+        if (deleted[i]) {
+            filter_remove(list, keys[i]);
+        }
     }
     return count;
 }
 
 /**
- * Free memory used by the list
+ * Wait-free look up a batch of keys in one pass, sorts keys in place
+ * found[i] says whether keys[i] (after sorting) is in the list, returns how many are
+ * Only lock-free on an adaptive list, misses look again while moves run
  */
-void free_list(_Atomic(Node*) *head_ptr) {
-    Node* cur = atomic_load(head_ptr);
-    Node* next;
-    
-    while (cur != NULL) {
-        next = atomic_load(&cur->next);
-        free(cur);
+int contains_many(List* list, int* keys, int n, bool* found) {
+    for (int i = 0; i < n; i++) {
+        found[i] = false;
+    }
+    if (n <= 0) {
+        return 0;
+    }
+    batch_sort(keys, n);
+
+    int count = 0;
+    ebr_enter();
+    ListImage* image = atomic_load(&list->image);
+    if (image != NULL) {
+        count = image_contains_many(image, keys, n, found);
+        ebr_exit();
+        return count;
+    }
+    unsigned seq = list->adaptive ? move_seq_begin(list) : 0;
+    for (Node* cur = link_read(&list->head); cur != NULL && count < n; cur = get_unmarked(link_read(&cur->next))) {
+        int i = batch_lower_bound(keys, n, cur->data);
+        if (i == n || keys[i] != cur->data) {
+            continue;
+        }
+        if (is_marked(link_read(&cur->next))) {
+            stamp_delete(list->stamps, cur); // Skipping it has to agree with snapshots too
+            continue;
+        }
+        stamp_insert(list->stamps, cur);
+        for (; i < n && keys[i] == cur->data && !found[i]; i++) {
+            found[i] = true;
+            count++;
+        }
+    }
+    if (list->adaptive && count < n && move_seq_changed(list, seq)) {
+        for (int i = 0; i < n; i++) { // A move may have hidden some, look for those one by one
+            if (!found[i] && search(list, keys[i]) != NULL) {
+                found[i] = true;
+                count++;
+            }
+        }
+    }
+    ebr_exit();
+    return count;
+}
+
+/*
+ * Sorted mode
+ *
+ * A list built only with insert_sorted() is kept in ascending order with no
+ * duplicates (Harris-Michael ordered set). Every operation below relies on
+ * that, so they can stop as soon as they walk past the key. Don't mix these
+ * with insert_begin() on the same list.
+ */
+
+/**
+ * Lock-free insert in order, returns NULL if the value is already there
+ */
+Node* insert_sorted(List* list, int data) {
+    promote_if_mapped(list);
+    filter_add(list, data);
+    Node* new_node = create_node_for(list->stamps, data);
+    _Atomic(Node*) *prev;
+    Node* cur;
+
+    ebr_enter();
+    while (true) {
+        if (find(list->stamps, &list->head, data, true, &prev, &cur)) {
+            stamp_insert(list->stamps, cur);
+            ebr_exit();
+            pool_free(new_node); // Never published, no need to retire
+            filter_remove(list, data);
+            return NULL;
+        }
+        atomic_store(&new_node->next, cur);
+        if (stat_cas(STAT_SITE_INSERT_LINK, atomic_compare_exchange_strong(prev, &cur, new_node))) {
+            break;
+        }
+    }
+    stamp_insert(list->stamps, new_node);
+    ebr_exit();
+    counter_add(&list->size, 1);
+    return new_node;
+}
+
+/**
+ * Lock-free delete from a sorted list
+ */
+bool delete_sorted(List* list, int data) {
+    promote_if_mapped(list);
+    ebr_enter();
+    bool deleted = delete_epoch(list->stamps, &list->head, data, true);
+    ebr_exit();
+    if (deleted) {
+        counter_add(&list->size, -1);
+        filter_remove(list, data);
+    }
+    return deleted;
+}
+
+/**
+ * Wait-free check if a value exists in a sorted list, stops past the key
+ */
+bool contains_sorted(List* list, int data) {
+    bool found = false;
+    if (filter_rules_out(list, data)) {
+        return false;
+    }
+    stat_add(STAT_OPS, 1);
+    ebr_enter();
+    ListImage* image = atomic_load(&list->image);
+    if (image != NULL) {
+        found = image_contains(image, data);
+        ebr_exit();
+        return found;
+    }
+    Node* cur = link_read(&list->head);
+    while (cur != NULL && cur->data <= data) {
+        stat_add(STAT_VISITED, 1);
+        Node* succ = link_read(&cur->next);
+        if (cur->data == data) {
+            if (!is_marked(succ)) {
+                stamp_insert(list->stamps, cur);
+                found = true;
+                break;
+            }
+            stamp_delete(list->stamps, cur);
+        }
+        cur = get_unmarked(succ);
+    }
+    ebr_exit();
+    return found;
+}
+
+/**
+ * Wait-free return the first node >= data in a sorted list, NULL if none
+ * Same rule as search(), only dereference it inside your own ebr section
+ */
+Node* lower_bound(List* list, int data) {
+    promote_if_mapped(list);
+    ebr_enter();
+    Node* cur = link_read(&list->head);
+    while (cur != NULL && (cur->data < data || is_marked(link_read(&cur->next)))) {
+        cur = get_unmarked(link_read(&cur->next));
+    }
+    ebr_exit();
+    return cur;
+}
+
+/**
+ * Wait-free call cb on every value in [lo, hi] of a sorted list, returns how many
+ */
+int range_scan(List* list, int lo, int hi, void (*cb)(int data, void* arg), void* arg) {
+    int count = 0;
+    ebr_enter();
+    ListImage* image = atomic_load(&list->image);
+    if (image != NULL) {
+        for (long i = image_lower_bound(image, lo); i < image->count && image_value(image, i) <= hi; i++) {
+            cb(image_value(image, i), arg);
+            count++;
+        }
+        ebr_exit();
+        return count;
+    }
+    Node* cur = link_read(&list->head);
+    while (cur != NULL && cur->data <= hi) {
+        Node* succ = link_read(&cur->next);
+        if (cur->data >= lo && !is_marked(succ)) {
+            cb(cur->data, arg);
+            count++;
+        }
+        cur = get_unmarked(succ);
+    }
+    ebr_exit();
+    return count;
+}
+
+/**
+ * Lock-free delete every value in [lo, hi] of a sorted list in one pass
+ * Returns how many nodes this call deleted
+ */
+int range_delete(List* list, int lo, int hi) {
+    int deleted = 0;
+    _Atomic(Node*) *prev;
+    Node* cur;
+
+    promote_if_mapped(list);
+    ebr_enter();
+retry:
+    find(list->stamps, &list->head, lo, true, &prev, &cur);
+    while (cur != NULL && cur->data <= hi) {
+        Node* succ = link_load(&cur->next);
+        if (!is_marked(succ)) {
+            stamp_insert(list->stamps, cur);
+            if (!stat_cas(STAT_SITE_MARK, atomic_compare_exchange_strong(&cur->next, &succ, get_marked(succ)))) {
+                continue; // Someone linked after it, mark again
+            }
+            deleted++; // We did the logical delete, so it's ours
+            filter_remove(list, cur->data);
+        }
+        succ = get_unmarked(succ);
+        report_unlink(list->stamps, cur);
+        if (!stat_cas(STAT_SITE_UNLINK, atomic_compare_exchange_strong(prev, &cur, succ))) {
+            stat_add(STAT_RETRIES, 1);
+            goto retry; // Someone changed prev, find() starts over and snips what we marked
+        }
+        ebr_retire(cur, reclaim_node);
+        cur = succ;
+    }
+    ebr_exit();
+    counter_add(&list->size, -deleted);
+    return deleted;
+}
+
+/**
+ * search() minus the filter check
+ */
+static Node* search_walk(List* list, int data) {
+    promote_if_mapped(list);
+    stat_add(STAT_OPS, 1);
+    ebr_enter();
+    _Atomic(Node*) *prev;
+    Node* cur;
+    int depth;
+    unsigned seq = 0;
+    do {
+        if (list->adaptive) {
+            seq = move_seq_begin(list);
+        }
+        prev = &list->head;
+        cur = link_read(prev);
+        depth = 0;
+        while (cur != NULL) {
+            stat_add(STAT_VISITED, 1);
+            Node* succ = link_read(&cur->next);
+            if (cur->data == data) {
+                if (!is_marked(succ)) {
+                    stamp_insert(list->stamps, cur);
+                    break;
+                }
+                stamp_delete(list->stamps, cur);
+            }
+            prev = &cur->next;
+            cur = get_unmarked(succ);
+            depth++;
+        }
+    } while (cur == NULL && list->adaptive && move_seq_changed(list, seq));
+
+    if (cur != NULL && list->adaptive && adapt_sampled(depth)) {
+        cur = move_to_front(list, prev, cur);
+    }
+    ebr_exit();
+    if (cur == NULL && list->filter != NULL) {
+        stat_add(STAT_FILTER_FALSE_POSITIVES, 1);
+    }
+    return cur;
+}
+
+/**
+ * Wait-free return a node with a given value
+ * The node can be retired once this returns, only dereference it
+ * while still inside your own ebr_enter()/ebr_exit()
+ * On an adaptive list a deep hit may move the node to the front first, and
+ * a lookup waits out moves under way and looks again after a miss, so it's
+ * only lock-free there
+ */
+Node* search(List* list, int data) {
+    return filter_rules_out(list, data) ? NULL : search_walk(list, data);
+}
+
+/**
+ * Wait-free check if a value exists in the list, lock-free on an adaptive list (see search())
+ * With a filter most misses come back after one cache line
+ */
+bool contains(List* list, int data) {
+    if (filter_rules_out(list, data)) {
+        return false;
+    }
+    ebr_enter();
+    ListImage* image = atomic_load(&list->image);
+    bool found = image != NULL ? image_contains(image, data) : search_walk(list, data) != NULL;
+    ebr_exit();
+    return found;
+}
+
+/*
+ * Multi-key operations
+ *
+ * list_move() takes a value out of one list and puts it in another, and
+ * list_replace() swaps one value for another in the same list, each in one
+ * atomic step: the mark on the old node and the link to the new one go in
+ * together through mcas_run() (mcas.c), so no reader ever finds the value in
+ * both places or in neither, and nobody takes a lock. If either word changed
+ * first the update leaves both alone and the call looks again. The _sorted
+ * versions are for lists kept by insert_sorted().
+ *
+ * The unordered calls link at the head like every other unordered insert,
+ * which is what makes insert_if_absent() work: if head is still the node a
+ * walk started from, nothing the walk didn't see has gone in since. A walk
+ * that has to start over only looks at the nodes in front of the last one it
+ * started from. (insert_sorted() already does this for sorted lists.)
+ *
+ * On a versioned list a replace stamps the old node's delete and the new node's insert after its
+ * mcas_run(), so a snapshot whose clock bump fell between the two stamps
+ * would see both values or neither. Replaces count themselves in and out
+ * around that stretch, and list_iter_begin() takes its snapshot again if one
+ * straddled the bump, like it does for moves to the front.
+ */
+
+/**
+ * A same-list replace is about to update, snapshots hold off until replace_end()
+ */
+static inline void replace_begin(List* list) {
+    if (list->stamps != NULL) { // Nothing to straddle without stamps
+        atomic_fetch_add(&list->replace_begun, 1);
+    }
+}
+
+static inline void replace_end(List* list) {
+    if (list->stamps != NULL) {
+        atomic_fetch_add(&list->replace_done, 1);
+    }
+}
+
+/**
+ * Count to check a snapshot against later, waits out replaces under way
+ */
+static inline unsigned replace_seq_begin(List* list) {
+    unsigned begun;
+    while ((begun = atomic_load(&list->replace_begun)) != atomic_load(&list->replace_done)) {
+        cpu_relax();
+    }
+    return begun;
+}
+
+/**
+ * Whether a live node holding data is between cur and stop (NULL for the end)
+ * Stamps what it finds like search() does, caller must be inside ebr_enter()/ebr_exit()
+ */
+static bool walk_finds(List* list, Node* cur, Node* stop, int data) {
+    while (cur != NULL && cur != stop) {
+        Node* succ = link_read(&cur->next);
+        if (cur->data == data) {
+            if (!is_marked(succ)) {
+                stamp_insert(list->stamps, cur);
+                return true;
+            }
+            stamp_delete(list->stamps, cur);
+        }
+        cur = get_unmarked(succ);
+    }
+    return false;
+}
+
+/**
+ * Lock-free insert at the first position unless data is there already
+ * Returns NULL if it was, unordered lists only
+ */
+Node* insert_if_absent(List* list, int data) {
+    promote_if_mapped(list);
+    filter_add(list, data);
+    Node* new_node = create_node_for(list->stamps, data);
+    Node* stop = NULL; // Everything from here on was checked already
+    Backoff backoff;
+    backoff_init(&backoff);
+
+    ebr_enter();
+    while (true) {
+        Node* first = link_load(&list->head);
+        if (walk_finds(list, first, stop, data)) {
+            ebr_exit();
+            pool_free(new_node); // Never published
+            filter_remove(list, data);
+            return NULL;
+        }
+        atomic_store(&new_node->next, first);
+        Node* expected = first;
+        if (stat_cas(STAT_SITE_INSERT_HEAD, atomic_compare_exchange_strong(&list->head, &expected, new_node))) {
+            break;
+        }
+        stop = first;
+        backoff_pause(&backoff);
+    }
+    stamp_insert(list->stamps, new_node);
+    ebr_exit();
+
+    counter_add(&list->size, 1);
+    return new_node;
+}
+
+/**
+ * Unlinks a node a multi-key call just marked, from whatever link came before it
+ * If prev moved on, the next find() over the node does it
+ */
+static void unlink_marked(SnapClock* snap, _Atomic(Node*)* prev, Node* node, Node* succ) {
+    report_unlink(snap, node); // Stamps the delete as well
+    if (stat_cas(STAT_SITE_UNLINK, atomic_compare_exchange_strong(prev, &node, succ))) {
+        ebr_retire(node, reclaim_node);
+    }
+}
+
+/**
+ * Lock-free move a node holding data from src to the front of dst in one step
+ * False if src doesn't have it, both lists unordered
+ */
+bool list_move(List* src, List* dst, int data) {
+    if (src == dst) {
+        return contains(src, data); // Already where it's going
+    }
+    promote_if_mapped(src);
+    promote_if_mapped(dst);
+    filter_add(dst, data);
+    Node* new_node = create_node_for(dst->stamps, data);
+    _Atomic(Node*) *prev;
+    Node* cur;
+    Node* succ;
+    bool moved = false;
+    Backoff backoff;
+    backoff_init(&backoff);
+
+    ebr_enter();
+    unsigned seq = src->adaptive ? move_seq_begin(src) : 0;
+    while (true) {
+        if (!find(src->stamps, &src->head, data, false, &prev, &cur)) {
+            if (src->adaptive && move_seq_changed(src, seq)) { // A move to the front may have hidden it
+                seq = move_seq_begin(src);
+                continue;
+            }
+            break;
+        }
+        stamp_insert(src->stamps, cur); // Can't delete what a snapshot could still call pending
+        succ = link_load(&cur->next);
+        Node* first = link_load(&dst->head);
+        atomic_store(&new_node->next, first);
+        if (!is_marked(succ) && mark_and_link(cur, succ, &dst->head, first, new_node)) {
+            moved = true;
+            break;
+        }
+        stat_add(STAT_RETRIES, 1);
+        backoff_pause(&backoff);
+    }
+    if (moved) {
+        stamp_insert(dst->stamps, new_node);
+        unlink_marked(src->stamps, prev, cur, succ);
+    }
+    ebr_exit();
+
+    if (!moved) {
+        pool_free(new_node);
+        filter_remove(dst, data);
+        return false;
+    }
+    counter_add(&src->size, -1);
+    counter_add(&dst->size, 1);
+    filter_remove(src, data);
+    return true;
+}
+
+/**
+ * Lock-free replace old with new in one step, new goes in at the front
+ * False if old isn't there or new is already, unordered lists only
+ */
+bool list_replace(List* list, int old, int new) {
+    if (old == new) {
+        return contains(list, old);
+    }
+    promote_if_mapped(list);
+    filter_add(list, new);
+    Node* new_node = create_node_for(list->stamps, new);
+    _Atomic(Node*) *prev;
+    Node* cur;
+    Node* succ;
+    Node* stop = NULL; // Nothing from here on holds new
+    bool replaced = false;
+    Backoff backoff;
+    backoff_init(&backoff);
+
+    ebr_enter();
+    unsigned seq = list->adaptive ? move_seq_begin(list) : 0;
+    while (true) {
+        Node* first = link_load(&list->head);
+        if (walk_finds(list, first, stop, new)) {
+            break;
+        }
+        if (!find(list->stamps, &list->head, old, false, &prev, &cur)) {
+            if (list->adaptive && move_seq_changed(list, seq)) {
+                seq = move_seq_begin(list);
+                continue;
+            }
+            break;
+        }
+        stamp_insert(list->stamps, cur);
+        succ = link_load(&cur->next);
+        if (!is_marked(succ)) {
+            atomic_store(&new_node->next, first);
+            replace_begin(list);
+            replaced = mark_and_link(cur, succ, &list->head, first, new_node);
+            if (replaced) {
+                stamp_delete(list->stamps, cur);
+                stamp_insert(list->stamps, new_node);
+            }
+            replace_end(list);
+            if (replaced) {
+                break;
+            }
+        }
+        stop = first;
+        stat_add(STAT_RETRIES, 1);
+        backoff_pause(&backoff);
+    }
+    if (replaced) {
+        unlink_marked(list->stamps, prev, cur, succ);
+    }
+    ebr_exit();
+
+    if (!replaced) {
+        pool_free(new_node);
+        filter_remove(list, new);
+        return false;
+    }
+    filter_remove(list, old);
+    return true;
+}
+
+/**
+ * Lock-free move data from sorted src to sorted dst in one step
+ * False if src doesn't have it or dst has it already
+ */
+bool list_move_sorted(List* src, List* dst, int data) {
+    if (src == dst) {
+        return false; // dst has it whenever src does
+    }
+    promote_if_mapped(src);
+    promote_if_mapped(dst);
+    filter_add(dst, data);
+    Node* new_node = create_node_for(dst->stamps, data);
+    _Atomic(Node*) *prev;
+    _Atomic(Node*) *dst_prev;
+    Node* cur;
+    Node* dst_cur;
+    Node* succ;
+    bool moved = false;
+    Backoff backoff;
+    backoff_init(&backoff);
+
+    ebr_enter();
+    while (true) {
+        if (find(dst->stamps, &dst->head, data, true, &dst_prev, &dst_cur)) {
+            stamp_insert(dst->stamps, dst_cur);
+            break;
+        }
+        if (!find(src->stamps, &src->head, data, true, &prev, &cur)) {
+            break;
+        }
+        stamp_insert(src->stamps, cur);
+        succ = link_load(&cur->next);
+        atomic_store(&new_node->next, dst_cur);
+        if (!is_marked(succ) && mark_and_link(cur, succ, dst_prev, dst_cur, new_node)) {
+            moved = true;
+            break;
+        }
+        stat_add(STAT_RETRIES, 1);
+        backoff_pause(&backoff);
+    }
+    if (moved) {
+        stamp_insert(dst->stamps, new_node);
+        unlink_marked(src->stamps, prev, cur, succ);
+    }
+    ebr_exit();
+
+    if (!moved) {
+        pool_free(new_node);
+        filter_remove(dst, data);
+        return false;
+    }
+    counter_add(&src->size, -1);
+    counter_add(&dst->size, 1);
+    filter_remove(src, data);
+    return true;
+}
+
+/**
+ * Lock-free replace old with new in a sorted list in one step
+ * False if old isn't there or new is already
+ */
+bool list_replace_sorted(List* list, int old, int new) {
+    if (old == new) {
+        return contains_sorted(list, old);
+    }
+    promote_if_mapped(list);
+    filter_add(list, new);
+    Node* new_node = create_node_for(list->stamps, new);
+    _Atomic(Node*) *prev;
+    _Atomic(Node*) *new_prev;
+    Node* cur;
+    Node* new_cur;
+    Node* succ;
+    bool replaced = false;
+    Backoff backoff;
+    backoff_init(&backoff);
+
+    ebr_enter();
+    while (true) {
+        if (find(list->stamps, &list->head, new, true, &new_prev, &new_cur)) {
+            stamp_insert(list->stamps, new_cur);
+            break;
+        }
+        if (!find(list->stamps, &list->head, old, true, &prev, &cur)) {
+            break;
+        }
+        stamp_insert(list->stamps, cur);
+        succ = link_load(&cur->next);
+        if (!is_marked(succ) && (new_prev != &cur->next || new_cur == succ)) {
+            atomic_store(&new_node->next, new_cur);
+            replace_begin(list);
+            if (new_prev == &cur->next) { // new goes right after old, the mark and the link are one word
+                Node* expected = succ;
+                replaced = stat_cas(STAT_SITE_MARK, atomic_compare_exchange_strong(&cur->next, &expected, get_marked(new_node)));
+            } else {
+                replaced = mark_and_link(cur, succ, new_prev, new_cur, new_node);
+            }
+            if (replaced) {
+                stamp_delete(list->stamps, cur);
+                stamp_insert(list->stamps, new_node);
+            }
+            replace_end(list);
+            if (replaced) {
+                break;
+            }
+        }
+        stat_add(STAT_RETRIES, 1);
+        backoff_pause(&backoff);
+    }
+    if (replaced) {
+        if (new_prev == &cur->next) {
+            succ = new_node;
+        }
+        if (new_prev == prev) { // new went in right before old
+            prev = &new_node->next;
+        }
+        unlink_marked(list->stamps, prev, cur, succ);
+    }
+    ebr_exit();
+
+    if (!replaced) {
+        pool_free(new_node);
+        filter_remove(list, new);
+        return false;
+    }
+    filter_remove(list, old);
+    return true;
+}
+
+/*
+ * Iterators
+ *
+ * ITER_WEAK walks the live list and hands back whatever it finds as it goes,
+ * like the readers above. ITER_SNAPSHOT copies the list as it was at one
+ * instant during list_iter_begin() (see snapshot.c) and then hands that back
+ * in ascending order, writers never wait on it. That takes a versioned list,
+ * on a plain one it copies what a walk sees, exact only while nobody writes.
+ * Use an iterator from the thread that began it.
+ */
+
+typedef struct ListIter {
+    IterMode mode;
+    Node* cur;     // ITER_WEAK: next node to look at
+    const ListImage* image;       // ITER_WEAK on a mapped list: walks the records instead
+    const ImageRecord* record;
+    int* values;   // ITER_SNAPSHOT: the copy
+    long count;
+    long pos;
+} ListIter;
+
+/**
+ * Starts an iterator, ITER_WEAK stays in an ebr section until list_iter_end()
+ */
+void list_iter_begin(List* list, ListIter* it, IterMode mode) {
+    it->mode = mode;
+    it->cur = NULL;
+    it->image = NULL;
+    it->record = NULL;
+    it->values = NULL;
+    it->count = 0;
+    it->pos = 0;
+    ebr_enter();
+    ListImage* image = atomic_load(&list->image); // The ebr section keeps it mapped
+    if (image != NULL) { // Read-only, so already a snapshot
+        if (mode == ITER_WEAK) {
+            it->image = image;
+            it->record = image_first(image);
+        } else {
+            it->values = image_copy_values(image, &it->count);
+            ebr_exit();
+        }
+        return;
+    }
+    if (mode == ITER_WEAK) {
+        it->cur = link_read(&list->head);
+        return;
+    }
+
+    SnapBuffer buf = { NULL, 0, 0 };
+    if (list->stamps == NULL) { // No stamps to go by
+        Node* cur = link_read(&list->head);
+        while (cur != NULL) {
+            Node* succ = link_read(&cur->next);
+            if (!is_marked(succ)) {
+                snap_add(&buf, cur, cur->data);
+            }
+            cur = get_unmarked(succ);
+        }
+        it->values = snap_values(&buf, &it->count);
+        ebr_exit();
+        return;
+    }
+
+    // Marked nodes are walked through too, the stamps decide what's in
+    unsigned seq = list->adaptive ? move_seq_begin(list) : 0;
+    unsigned replaces = replace_seq_begin(list);
+    SnapCollector* col = snap_begin(&list->snap);
+    while ((list->adaptive && move_seq_changed(list, seq)) || atomic_load(&list->replace_begun) != replaces) {
+        free(snap_finish(&list->snap, col, &buf, &it->count)); // A move or replace straddled the clock bump, take it again
+        seq = list->adaptive ? move_seq_begin(list) : 0;
+        replaces = replace_seq_begin(list);
+        col = snap_begin(&list->snap);
+    }
+    Node* cur = link_read(&list->head);
+    while (cur != NULL) {
+        unsigned ins = snap_stamp(&list->snap, &versioned_node(cur)->ins);
+        Node* succ = link_read(&cur->next);
+        unsigned del = is_marked(succ) ? snap_stamp(&list->snap, &versioned_node(cur)->del) : 0;
+        if (snap_visible(ins, del, col->version)) {
+            snap_add(&buf, cur, cur->data);
+        }
+        cur = get_unmarked(succ);
+    }
+    it->values = snap_finish(&list->snap, col, &buf, &it->count);
+    ebr_exit();
+}
+
+/**
+ * Next value, false once there are no more
+ */
+bool list_iter_next(ListIter* it, int* data) {
+    if (it->mode == ITER_SNAPSHOT) {
+        if (it->pos == it->count) {
+            return false;
+        }
+        *data = it->values[it->pos++];
+        return true;
+    }
+    if (it->image != NULL) {
+        if (it->record == NULL) {
+            return false;
+        }
+        *data = it->record->data;
+        it->record = image_next(it->image, it->record);
+        return true;
+    }
+    while (it->cur != NULL) {
+        Node* cur = it->cur;
+        Node* succ = link_read(&cur->next);
+        it->cur = get_unmarked(succ);
+        if (!is_marked(succ)) {
+            *data = cur->data;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Done with an iterator
+ */
+void list_iter_end(ListIter* it) {
+    if (it->mode == ITER_WEAK) {
+        ebr_exit();
+    } else {
+        free(it->values);
+    }
+}
+
+/**
+ * Wait-free print list contents
+ */
+void print_list(List* list) {
+    if (atomic_load(&list->head) == NULL && atomic_load(&list->image) == NULL) {
+        printf("empty list\n");
+        return;
+    }
+
+    ListIter it;
+    int data;
+    printf("List: ");
+    list_iter_begin(list, &it, ITER_WEAK);
+    while (list_iter_next(&it, &data)) {
+        printf("%d -> ", data);
+    }
+    list_iter_end(&it);
+    printf("END\n");
+}
+
+/**
+ * Size from the folded estimate, one load, may lag by a few thousand
+ */
+long size_approx(List* list) {
+    long size = counter_approx(&list->size);
+    return size > 0 ? size : 0;
+}
+
+/**
+ * Size summed over every shard
+ */
+long size_exact(List* list) {
+    return counter_exact(&list->size);
+}
+
+/**
+ * Count nodes in list, sums the size shards
+ * Exact once writers are quiet, close while they're running
+ */
+int count_nodes(List* list) {
+    return (int)size_exact(list);
+}
+
+/**
+ * Debug check: walks the list and compares with the counters
+ * Only meaningful once all threads are done
+ */
+bool validate_size(List* list) {
+    long walked = 0;
+    ListIter it;
+    int data;
+    list_iter_begin(list, &it, ITER_WEAK); // Skips logically deleted nodes
+    while (list_iter_next(&it, &data)) {
+        walked++;
+    }
+    list_iter_end(&it);
+
+    long counted = size_exact(list);
+    if (walked != counted) {
+        printf("size mismatch: walked %ld nodes, counters say %ld\n", walked, counted);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Wait-free call cb on every value in the list
+ */
+void list_for_each(List* list, void (*cb)(int data, void* arg), void* arg) {
+    ListIter it;
+    int data;
+    list_iter_begin(list, &it, ITER_WEAK);
+    while (list_iter_next(&it, &data)) {
+        cb(data, arg);
+    }
+    list_iter_end(&it);
+}
+
+/*
+ * Bulk load
+ *
+ * Builds a whole list from ascending keys in one pass: the nodes come off
+ * pool_alloc_seq() back to back in the order they're linked, so loading runs
+ * at memory speed and walking the new list afterwards is a straight sweep
+ * through memory. The finished chain goes in with one store on head.
+ */
+
+/**
+ * Builds the list from stream, frees what it built if the keys weren't ascending
+ */
+static bool bulk_load(List* list, KeyStream* stream) {
+    list_init(list);
+    Node* first = NULL;
+    Node* last = NULL;
+    long count = 0;
+    bool ascending = true;
+    int key;
+    while (stream_next(stream, &key)) {
+        if (last != NULL && key < last->data) {
+            ascending = false;
+            break;
+        }
+        last = chain_append(list->stamps, &first, last, key);
+        count++;
+    }
+
+    if (!ascending || stream->failed) {
+        printf("bulk load: %s after %ld keys\n", ascending ? "input ran out" : "keys not ascending", count);
+        while (first != NULL) {
+            Node* next = atomic_load_explicit(&first->next, memory_order_relaxed);
+            pool_free(first);
+            first = next;
+        }
+        return false;
+    }
+    counter_add(&list->size, count);
+    atomic_store_explicit(&list->head, first, memory_order_release); // Nobody could see any of it before this
+    return true;
+}
+
+/**
+ * Sets up list holding the n keys of an array, false if they aren't ascending
+ * Keys have to be ascending; sorted mode also wants them distinct
+ */
+bool list_bulk_load(List* list, const int* keys, long n) {
+    KeyStream stream;
+    stream_array(&stream, keys, n);
+    return bulk_load(list, &stream);
+}
+
+/**
+ * Sets up list holding n keys read from fd (raw ints, see batch.c)
+ * False if they aren't ascending or the read comes up short
+ */
+bool list_bulk_load_fd(List* list, int fd, long n) {
+    KeyStream stream;
+    stream_fd(&stream, fd, n);
+    return bulk_load(list, &stream);
+}
+
+/*
+ * Persistence
+ *
+ * list_save() writes a snapshot of the list as an image file, list_open_mmap()
+ * maps one back in without building any nodes, see list-image.c.
+ */
+
+/**
+ * Saves a copy of the list to path, false if it can't be written
+ * Consistent while other threads are using the list if it's versioned
+ */
+bool list_save(List* list, const char* path) {
+    ListIter it;
+    list_iter_begin(list, &it, ITER_SNAPSHOT);
+    bool ok = image_save(path, it.values, it.count);
+    list_iter_end(&it);
+    return ok;
+}
+
+/**
+ * Sets up list backed by the image at path, false if it can't be opened
+ * O(1): the records are only read as they're used, the nodes only get built
+ * on the first write
+ */
+bool list_open_mmap(List* list, const char* path) {
+    list_init(list);
+    ListImage* image = image_open(path);
+    if (image == NULL) {
+        return false;
+    }
+    counter_add(&list->size, image->count);
+    atomic_store(&list->image, image);
+    return true;
+}
+
+/**
+ * Free memory used by the list
+ * Not safe against concurrent operations, call once all threads are done
+ * Nodes that were already retired are freed by ebr_drain(), the slabs stay
+ * with the node pool (other lists share it) until pool_destroy_all()
+ * Takes the filter off as well
+ */
+void free_list(List* list) {
+    Node* cur = atomic_load(&list->head);
+    Node* next;
+
+    ListImage* image = atomic_load(&list->image);
+    if (image != NULL) { // Never promoted
+        image_close(image);
+        atomic_store(&list->image, NULL);
+    }
+    
+    while (cur != NULL) {
+        next = get_unmarked(atomic_load(&cur->next));
+        pool_free(cur);
         cur = next;
     }
-    atomic_store(head_ptr, NULL);
-}
\ No newline at end of file
+    atomic_store(&list->head, NULL);
+    counter_reset(&list->size);
+    snap_destroy(&list->snap);
+    list_set_filter(list, 0, 0);
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef MCAS_C
+#define MCAS_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "ebr.c"
+#include "node-pool.c"
+#include "backoff.c"
+
+/*
+ * Multi-word compare-and-swap over pointer words
+ *
+ * mcas_run() changes up to MCAS_MAX words from their old values to their new
+ * ones all at one instant, or leaves every one alone if any of them didn't
+ * hold its old value. The operation is written down in a descriptor, and
+ * the owner puts the descriptor in each word in address order, then one CAS
+ * on its status decides the lot; after that every word is swung to its new
+ * value (or back to its old one).
+ *
+ * Nobody waits on a descriptor they run into. A word holding one is read
+ * through it: the new value if it succeeded, the old one otherwise. A writer
+ * that needs the word helps: if the descriptor is in all of its words it
+ * decides it as succeeded and swings them, if the owner is still putting it
+ * in it gets a few pauses to finish, then it's failed and its words go back.
+ * Address order means two operations after the same words meet at the first
+ * one they share, so they can't each hold a word the other needs.
+ *
+ * Only the owner ever puts its descriptor in a word, and it does its last
+ * swing before retiring it through ebr, so a descriptor can't turn up in a
+ * word after it's been retired. (Textbook MCAS lets helpers put it in too,
+ * with RDCSS, but then a helper that stalls can put it back into a word that
+ * has come round to the old value after the owner retired it.)
+ *
+ * Words are pointers with the low two bits free: bit 0 is the caller's (the
+ * lock-free.c delete mark), a word with bit 1 set holds a descriptor. Old
+ * and new values must have bit 1 clear. Every load of a word that
+ * mcas_run() may touch has to go through mcas_read() (readers) or
+ * mcas_load() (writers about to CAS it). Call everything inside
+ * ebr_enter()/ebr_exit().
+ */
+
+#define MCAS_MAX 4
+#define MCAS_PATIENCE 256 // Pauses a helper gives an owner that's still putting its descriptor in
+
+typedef enum {
+    MCAS_UNDECIDED,
+    MCAS_SUCCEEDED,
+    MCAS_FAILED
+} McasStatus;
+
+typedef struct McasEntry {
+    _Atomic(void*)* word;
+    void* old;
+    void* new;
+} McasEntry;
+
+typedef struct McasDesc {
+    _Atomic int status;
+    int count;
+    McasEntry entries[MCAS_MAX];
+} McasDesc;
+
+NodePool mcas_pool = NODE_POOL_INIT(McasDesc);
+
+static inline bool mcas_is_desc(void* v) {
+    return ((uintptr_t)v & 2) != 0;
+}
+
+static inline void* mcas_tag(McasDesc* desc) {
+    return (void*)((uintptr_t)desc | 2);
+}
+
+static inline McasDesc* mcas_untag(void* v) {
+    return (McasDesc*)((uintptr_t)v & ~(uintptr_t)2);
+}
+
+/**
+ * Starts an empty operation, add words with mcas_add() and run it with mcas_run()
+ */
+McasDesc* mcas_begin(void) {
+    McasDesc* desc = (McasDesc*)pool_alloc(&mcas_pool);
+    atomic_store_explicit(&desc->status, MCAS_UNDECIDED, memory_order_relaxed);
+    desc->count = 0;
+    return desc;
+}
+
+/**
+ * Adds word: old -> new to the operation, every word only once
+ */
+void mcas_add(McasDesc* desc, _Atomic(void*)* word, void* old, void* new) {
+    if (desc->count == MCAS_MAX) {
+        printf("mcas: more than %d words\n", MCAS_MAX);
+        exit(1);
+    }
+    desc->entries[desc->count].word = word;
+    desc->entries[desc->count].old = old;
+    desc->entries[desc->count].new = new;
+    desc->count++;
+}
+
+/**
+ * Swings every word still holding desc to its outcome
+ */
+static void mcas_release(McasDesc* desc) {
+    bool ok = atomic_load(&desc->status) == MCAS_SUCCEEDED;
+    for (int i = 0; i < desc->count; i++) {
+        McasEntry* e = &desc->entries[i];
+        void* tagged = mcas_tag(desc);
+        atomic_compare_exchange_strong(e->word, &tagged, ok ? e->new : e->old);
+    }
+}
+
+/**
+ * Whether desc is in every one of its words
+ */
+static bool mcas_installed(McasDesc* desc) {
+    for (int i = 0; i < desc->count; i++) {
+        if (atomic_load(desc->entries[i].word) != mcas_tag(desc)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Gets someone else's operation out of the way: finishes it if it's in all
+ * its words, fails it if the owner doesn't get there in time
+ */
+void mcas_help(McasDesc* desc) {
+    for (int i = 0; i < MCAS_PATIENCE && atomic_load(&desc->status) == MCAS_UNDECIDED; i++) {
+        if (mcas_installed(desc)) {
+            int expected = MCAS_UNDECIDED;
+            atomic_compare_exchange_strong(&desc->status, &expected, MCAS_SUCCEEDED);
+            break;
+        }
+        cpu_relax();
+    }
+    int expected = MCAS_UNDECIDED;
+    atomic_compare_exchange_strong(&desc->status, &expected, MCAS_FAILED);
+    mcas_release(desc);
+}
+
+/**
+ * Runs the operation, true if every word changed, false if none did
+ * desc is gone afterwards
+ */
+bool mcas_run(McasDesc* desc) {
+    for (int i = 1; i < desc->count; i++) { // Address order, the few entries there are
+        McasEntry e = desc->entries[i];
+        int j = i;
+        for (; j > 0 && (uintptr_t)desc->entries[j - 1].word > (uintptr_t)e.word; j--) {
+            desc->entries[j] = desc->entries[j - 1];
+        }
+        desc->entries[j] = e;
+    }
+
+    for (int i = 0; i < desc->count && atomic_load(&desc->status) == MCAS_UNDECIDED; i++) {
+        McasEntry* e = &desc->entries[i];
+        while (true) {
+            void* seen = e->old;
+            if (atomic_compare_exchange_strong(e->word, &seen, mcas_tag(desc))) {
+                break; // Ours, if a helper failed us meanwhile the release puts it back
+            }
+            if (!mcas_is_desc(seen)) {
+                int expected = MCAS_UNDECIDED;
+                atomic_compare_exchange_strong(&desc->status, &expected, MCAS_FAILED);
+                break;
+            }
+            mcas_help(mcas_untag(seen)); // Someone else's, out of the way and look again
+        }
+    }
+    int expected = MCAS_UNDECIDED;
+    atomic_compare_exchange_strong(&desc->status, &expected, MCAS_SUCCEEDED);
+    bool ok = atomic_load(&desc->status) == MCAS_SUCCEEDED;
+    mcas_release(desc);
+    ebr_retire(desc, pool_free); // Helpers that read it from a word may still be looking
+    return ok;
+}
+
+/**
+ * Value of word right now, read through a descriptor if there is one, never waits
+ */
+void* mcas_read(_Atomic(void*)* word) {
+    void* v = atomic_load(word);
+    if (!mcas_is_desc(v)) {
+        return v;
+    }
+    McasDesc* desc = mcas_untag(v);
+    bool ok = atomic_load(&desc->status) == MCAS_SUCCEEDED;
+    for (int i = 0; i < desc->count; i++) {
+        if (desc->entries[i].word == word) {
+            return ok ? desc->entries[i].new : desc->entries[i].old;
+        }
+    }
+    return NULL; // Not reached, a descriptor only goes in its own words
+}
+
+/**
+ * Value of word with any descriptor in it helped out first,
+ * so a plain CAS expecting the result can succeed
+ */
+void* mcas_load(_Atomic(void*)* word) {
+    void* v = atomic_load(word);
+    while (mcas_is_desc(v)) {
+        mcas_help(mcas_untag(v));
+        v = atomic_load(word);
+    }
+    return v;
+}
+
+#endif
@@ -0,0 +1,397 @@
+#ifndef NODE_POOL_C
+#define NODE_POOL_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+ * Slab allocator for list nodes
+ *
+ * A NodePool hands out objects of exactly one size. Each thread gets its own
+ * cache per pool with a private free list, so alloc and free on the owning
+ * thread are a couple of pointer moves and never touch malloc. Slabs are
+ * POOL_SLAB_BYTES long and aligned to that size, so the slab header (and the
+ * owning cache) can be found from any object address. A free from another
+ * thread is pushed onto the owner's remote stack with a CAS, and the owner
+ * takes the whole stack back in one exchange when its local list runs dry.
+ * pool_free_batched() strings a run of frees for the same owner together and
+ * pushes them with one CAS, for threads tearing down nodes somebody else made.
+ *
+ * pool_alloc_seq() skips the free list and carves objects straight off a
+ * slab kept for it, so consecutive calls come back at consecutive addresses.
+ * Bulk loads use it to lay a new list out in the order it gets walked.
+ * Those objects are freed like any other.
+ *
+ * A pool is shared by every structure with that object type, so freeing a
+ * structure only hands its objects back. Slabs go back to the system with
+ * pool_destroy()/pool_destroy_all() at process teardown.
+ *
+ * Each pool in use takes one of POOL_MAX_POOLS ids. Code that makes node
+ * types on the fly (generic-list.c) takes pool_shared() instead, one pool per
+ * 16-byte stride, so any number of types fit in POOL_SHARED_MAX / 16 ids.
+ *
+ * Build with -DUSE_MALLOC to go back to plain malloc/free for comparison.
+ */
+
+#define POOL_SLAB_BYTES (64 * 1024)
+#define POOL_MAX_POOLS 32
+#define POOL_SHARED_MAX 256  // Largest object pool_shared() takes
+
+typedef struct PoolFree {
+    struct PoolFree* next;
+} PoolFree;
+
+typedef struct PoolCache {
+    _Alignas(64) PoolFree* local;  // Owner only
+    char* run;                     // Owner only, pool_alloc_seq() carves from here up to run_end
+    char* run_end;
+    _Alignas(64) _Atomic(PoolFree*) remote; // Pushed by other threads
+    _Atomic bool in_use;
+    struct NodePool* pool;
+    struct PoolCache* next;        // Pool registry link, caches are never removed
+} PoolCache;
+
+typedef struct PoolSlab {
+    PoolCache* owner;
+    struct PoolSlab* next;
+} PoolSlab;
+
+typedef struct NodePool {
+    size_t obj_size;
+    _Atomic int id;               // Index into the thread cache table, -1 until first use
+    _Atomic(PoolSlab*) slabs;
+    _Atomic(PoolCache*) caches;
+} NodePool;
+
+// Frees collected by one thread, pushed to each owner in one go, see pool_free_batched()
+typedef struct PoolFreeBatch {
+    struct PoolCache* owner;
+    PoolFree* first;
+    PoolFree* last;
+    long count;
+} PoolFreeBatch;
+
+#define POOL_FREE_BATCH_INIT { NULL, NULL, NULL, 0 }
+
+#define NODE_POOL_INIT_SIZE(size) { (size), -1, NULL, NULL }
+#define NODE_POOL_INIT(type) NODE_POOL_INIT_SIZE(sizeof(type))
+
+NodePool pool_shared_pools[POOL_SHARED_MAX / 16] = {
+    NODE_POOL_INIT_SIZE(16),  NODE_POOL_INIT_SIZE(32),  NODE_POOL_INIT_SIZE(48),  NODE_POOL_INIT_SIZE(64),
+    NODE_POOL_INIT_SIZE(80),  NODE_POOL_INIT_SIZE(96),  NODE_POOL_INIT_SIZE(112), NODE_POOL_INIT_SIZE(128),
+    NODE_POOL_INIT_SIZE(144), NODE_POOL_INIT_SIZE(160), NODE_POOL_INIT_SIZE(176), NODE_POOL_INIT_SIZE(192),
+    NODE_POOL_INIT_SIZE(208), NODE_POOL_INIT_SIZE(224), NODE_POOL_INIT_SIZE(240), NODE_POOL_INIT_SIZE(256),
+};
+
+/**
+ * The pool for objects of size bytes shared by every type with the same
+ * stride, size has to be 1..POOL_SHARED_MAX
+ */
+static inline NodePool* pool_shared(size_t size) {
+    return &pool_shared_pools[(size + 15) / 16 - 1];
+}
+
+#ifdef USE_MALLOC
+
+void* pool_alloc(NodePool* pool) {
+    void* obj = malloc(pool->obj_size);
+    if (obj == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    return obj;
+}
+
+void* pool_alloc_seq(NodePool* pool) {
+    return pool_alloc(pool); // No slabs, so no say in the layout
+}
+
+void pool_free(void* obj) {
+    free(obj);
+}
+
+void pool_free_batched(PoolFreeBatch* batch, void* obj) {
+    (void)batch;
+    free(obj);
+}
+
+void pool_free_flush(PoolFreeBatch* batch) {
+    (void)batch;
+}
+
+void pool_destroy(NodePool* pool) {
+    (void)pool;
+}
+
+void pool_destroy_all(void) {
+}
+
+#else
+
+_Atomic int pool_next_id = 0;
+_Atomic(NodePool*) pool_registry[POOL_MAX_POOLS]; // By id, for pool_destroy_all()
+_Thread_local PoolCache* pool_caches[POOL_MAX_POOLS];
+
+pthread_key_t pool_key;
+pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Thread exit hook, gives this thread's caches back for reuse
+ * Their free lists go with them so nothing is lost
+ */
+void pool_thread_exit(void* arg) {
+    PoolCache** caches = (PoolCache**)arg;
+    for (int i = 0; i < POOL_MAX_POOLS; i++) {
+        if (caches[i] != NULL) {
+            atomic_store(&caches[i]->in_use, false);
+            caches[i] = NULL;
+        }
+    }
+}
+
+void pool_make_key(void) {
+    if (pthread_key_create(&pool_key, pool_thread_exit) != 0) {
+        printf("pool key fail\n");
+        exit(1);
+    }
+}
+
+/**
+ * Returns this thread's cache for a pool, claiming or creating one on first use
+ */
+PoolCache* pool_cache(NodePool* pool) {
+    int id = atomic_load_explicit(&pool->id, memory_order_acquire);
+    if (id >= 0 && pool_caches[id] != NULL) {
+        return pool_caches[id];
+    }
+
+    if (id < 0) {
+        int fresh = atomic_fetch_add(&pool_next_id, 1);
+        if (fresh >= POOL_MAX_POOLS) {
+            printf("too many node pools, POOL_MAX_POOLS is %d\n", POOL_MAX_POOLS);
+            exit(1);
+        }
+        int expected = -1;
+        if (atomic_compare_exchange_strong(&pool->id, &expected, fresh)) { // Loser just wastes an id
+            atomic_store(&pool_registry[fresh], pool);
+        }
+        id = atomic_load(&pool->id);
+    }
+
+    pthread_once(&pool_key_once, pool_make_key);
+    pthread_setspecific(pool_key, pool_caches);
+
+    PoolCache* cache;
+    for (cache = atomic_load(&pool->caches); cache != NULL; cache = cache->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&cache->in_use, &expected, true)) {
+            break;
+        }
+    }
+
+    if (cache == NULL) {
+        cache = aligned_alloc(64, sizeof(PoolCache));
+        if (cache == NULL) {
+            printf("malloc fail\n");
+            exit(1);
+        }
+        cache->local = NULL;
+        cache->run = NULL;
+        cache->run_end = NULL;
+        cache->pool = pool;
+        atomic_init(&cache->remote, NULL);
+        atomic_init(&cache->in_use, true);
+
+        PoolCache* head;
+        do {
+            head = atomic_load(&pool->caches);
+            cache->next = head;
+        } while (!atomic_compare_exchange_weak(&pool->caches, &head, cache));
+    }
+
+    pool_caches[id] = cache;
+    return cache;
+}
+
+/**
+ * Object size rounded up the way slabs get carved
+ */
+static inline size_t pool_obj_stride(NodePool* pool) {
+    return (pool->obj_size + 15) & ~(size_t)15;
+}
+
+/**
+ * Allocates a slab owned by cache and adds it to the pool, returns its first object
+ */
+char* pool_new_slab(NodePool* pool, PoolCache* cache) {
+    PoolSlab* slab = aligned_alloc(POOL_SLAB_BYTES, POOL_SLAB_BYTES);
+    if (slab == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    slab->owner = cache;
+
+    PoolSlab* head;
+    do {
+        head = atomic_load(&pool->slabs);
+        slab->next = head;
+    } while (!atomic_compare_exchange_weak(&pool->slabs, &head, slab));
+
+    return (char*)slab + ((sizeof(PoolSlab) + 63) & ~(size_t)63);
+}
+
+/**
+ * Carves a new slab into objects, returns them as a free list
+ */
+PoolFree* pool_grow(NodePool* pool, PoolCache* cache) {
+    size_t size = pool_obj_stride(pool);
+    char* first = pool_new_slab(pool, cache);
+    char* end = (char*)((uintptr_t)first & ~(uintptr_t)(POOL_SLAB_BYTES - 1)) + POOL_SLAB_BYTES;
+
+    PoolFree* list = NULL;
+    for (char* obj = end - size; obj >= first; obj -= size) { // Backwards so the list comes out in address order
+        PoolFree* f = (PoolFree*)obj;
+        f->next = list;
+        list = f;
+    }
+    return list;
+}
+
+/**
+ * Allocates one object from the calling thread's cache
+ */
+void* pool_alloc(NodePool* pool) {
+    PoolCache* cache = pool_cache(pool);
+    PoolFree* obj = cache->local;
+    if (obj == NULL) {
+        obj = atomic_exchange(&cache->remote, NULL); // Take back everything other threads freed
+        if (obj == NULL) {
+            obj = pool_grow(pool, cache);
+        }
+    }
+    cache->local = obj->next;
+    return obj;
+}
+
+/**
+ * Allocates the object right after the previous pool_alloc_seq() one,
+ * starting a fresh slab when the current one is used up
+ */
+void* pool_alloc_seq(NodePool* pool) {
+    PoolCache* cache = pool_cache(pool);
+    size_t size = pool_obj_stride(pool);
+    if (cache->run == NULL || (size_t)(cache->run_end - cache->run) < size) {
+        cache->run = pool_new_slab(pool, cache);
+        cache->run_end = (char*)((uintptr_t)cache->run & ~(uintptr_t)(POOL_SLAB_BYTES - 1)) + POOL_SLAB_BYTES;
+    }
+    void* obj = cache->run;
+    cache->run += size;
+    return obj;
+}
+
+/**
+ * Returns an object to the cache that owns its slab
+ */
+void pool_free(void* ptr) {
+    PoolSlab* slab = (PoolSlab*)((uintptr_t)ptr & ~(uintptr_t)(POOL_SLAB_BYTES - 1));
+    PoolCache* owner = slab->owner;
+    PoolCache* mine = pool_cache(owner->pool);
+    PoolFree* obj = (PoolFree*)ptr;
+
+    if (mine == owner) {
+        obj->next = mine->local;
+        mine->local = obj;
+    } else {
+        PoolFree* head = atomic_load_explicit(&owner->remote, memory_order_relaxed);
+        do {
+            obj->next = head;
+        } while (!atomic_compare_exchange_weak_explicit(&owner->remote, &head, obj,
+                                                        memory_order_release, memory_order_relaxed));
+    }
+}
+
+/**
+ * Hands the objects collected in batch back to their owner, one CAS for all of them
+ */
+void pool_free_flush(PoolFreeBatch* batch) {
+    if (batch->first == NULL) {
+        return;
+    }
+    PoolCache* owner = batch->owner;
+    PoolCache* mine = pool_cache(owner->pool);
+    if (mine == owner) {
+        batch->last->next = mine->local;
+        mine->local = batch->first;
+    } else {
+        PoolFree* head = atomic_load_explicit(&owner->remote, memory_order_relaxed);
+        do {
+            batch->last->next = head;
+        } while (!atomic_compare_exchange_weak_explicit(&owner->remote, &head, batch->first,
+                                                        memory_order_release, memory_order_relaxed));
+    }
+    batch->first = NULL;
+    batch->last = NULL;
+    batch->count = 0;
+}
+
+/**
+ * pool_free() for a thread freeing lots of objects it didn't allocate
+ * Runs of objects with the same owner go back with one CAS instead of one each,
+ * call pool_free_flush() when done
+ */
+void pool_free_batched(PoolFreeBatch* batch, void* ptr) {
+    PoolSlab* slab = (PoolSlab*)((uintptr_t)ptr & ~(uintptr_t)(POOL_SLAB_BYTES - 1));
+    if (slab->owner != batch->owner) {
+        pool_free_flush(batch);
+        batch->owner = slab->owner;
+    }
+    PoolFree* obj = (PoolFree*)ptr;
+    obj->next = batch->first;
+    batch->first = obj;
+    if (batch->last == NULL) {
+        batch->last = obj;
+    }
+    batch->count++;
+}
+
+/**
+ * Gives every slab back to the system, process teardown only
+ * The pool is shared by every structure using that node type, so call this
+ * once no thread will touch it again and ebr_drain() has run; anything still
+ * allocated from it goes too. The pool can be used again afterwards.
+ */
+void pool_destroy(NodePool* pool) {
+    PoolSlab* slab = atomic_exchange(&pool->slabs, NULL);
+    while (slab != NULL) {
+        PoolSlab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    for (PoolCache* cache = atomic_load(&pool->caches); cache != NULL; cache = cache->next) {
+        cache->local = NULL;
+        cache->run = NULL;
+        cache->run_end = NULL;
+        atomic_store(&cache->remote, NULL);
+    }
+}
+
+/**
+ * pool_destroy() on every pool that was ever used, for the end of main()
+ */
+void pool_destroy_all(void) {
+    int count = atomic_load(&pool_next_id);
+    for (int i = 0; i < count && i < POOL_MAX_POOLS; i++) {
+        NodePool* pool = atomic_load(&pool_registry[i]);
+        if (pool != NULL) {
+            pool_destroy(pool);
+        }
+    }
+}
+
+#endif
+
+#endif
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include "lock-free.c"
+
+/*
+ * Lock-free FIFO queue (Michael & Scott) on the lock-free.c Node
+ *
+ * The queue is a singly linked list with a dummy node at the front: head
+ * points at the dummy, the first value lives in the node after it. Enqueue
+ * links the new node after the last one with a CAS on its next pointer,
+ * then swings tail to it; dequeue reads the value after the dummy and swings
+ * head one step, so the node it read becomes the new dummy. tail is allowed
+ * to lag one node behind, and whoever notices swings it forward before doing
+ * their own CAS, so no thread ever waits on another.
+ *
+ * Producers only touch tail and consumers only touch head, and the two sit
+ * on separate cache lines. Old dummies go through ebr, which also keeps a
+ * node from being reused while a slow thread still holds it (no ABA). Nodes
+ * come from the same pool as the lists, failed CASes back off (backoff.c).
+ */
+
+typedef struct Queue {
+    _Alignas(64) _Atomic(Node*) head; // Dummy, consumers only
+    _Alignas(64) _Atomic(Node*) tail; // Last node or the one before it, producers only
+} Queue;
+
+/**
+ * Sets up an empty queue, just the dummy
+ */
+void queue_init(Queue* queue) {
+    Node* dummy = create_node(0); // Dummy's data is never looked at
+    atomic_init(&queue->head, dummy);
+    atomic_init(&queue->tail, dummy);
+}
+
+/**
+ * Lock-free add data at the back
+ */
+void enqueue(Queue* queue, int data) {
+    Node* node = create_node(data);
+    Backoff backoff;
+    backoff_init(&backoff);
+
+    ebr_enter(); // tail can be dequeued and retired under us
+    while (true) {
+        Node* tail = atomic_load(&queue->tail);
+        Node* next = atomic_load(&tail->next);
+        if (tail != atomic_load(&queue->tail)) {
+            continue; // Moved on while we read next
+        }
+        if (next != NULL) { // tail is lagging, help it along and look again
+            atomic_compare_exchange_strong(&queue->tail, &tail, next);
+            continue;
+        }
+        Node* expected = NULL;
+        if (stat_cas(STAT_SITE_INSERT_LINK, atomic_compare_exchange_strong(&tail->next, &expected, node))) {
+            atomic_compare_exchange_strong(&queue->tail, &tail, node); // Fine if someone beat us to it
+            break;
+        }
+        stat_add(STAT_RETRIES, 1);
+        backoff_pause(&backoff);
+    }
+    ebr_exit();
+}
+
+/**
+ * Lock-free take up to max values off the front into out, returns how many
+ * The values come off with one CAS on head, so they're consecutive in the queue
+ * max 1 is try_dequeue()
+ */
+int dequeue_batch(Queue* queue, int* out, int max) {
+    if (max <= 0) {
+        return 0;
+    }
+    Backoff backoff;
+    backoff_init(&backoff);
+
+    ebr_enter();
+    while (true) {
+        Node* head = atomic_load(&queue->head);
+        Node* tail = atomic_load(&queue->tail);
+        Node* last = head;
+        bool behind = false; // tail still points at a node we'd take
+        int n = 0;
+        while (n < max) {
+            Node* next = atomic_load(&last->next);
+            if (next == NULL) {
+                break;
+            }
+            behind = behind || last == tail;
+            out[n++] = next->data; // Set before the node was linked and never changed
+            last = next;
+        }
+        if (head != atomic_load(&queue->head)) {
+            continue; // Someone dequeued while we walked
+        }
+        if (n == 0) {
+            ebr_exit();
+            return 0;
+        }
+        if (behind) { // Swing tail past what we're taking first, or it'd point at a retired node
+            Node* next = atomic_load(&tail->next);
+            if (next != NULL) {
+                atomic_compare_exchange_strong(&queue->tail, &tail, next);
+            }
+            continue;
+        }
+        Node* expected = head;
+        if (stat_cas(STAT_SITE_UNLINK, atomic_compare_exchange_strong(&queue->head, &expected, last))) {
+            for (Node* cur = head; cur != last;) { // last is the new dummy
+                Node* next = atomic_load(&cur->next);
+                ebr_retire(cur, reclaim_node);
+                cur = next;
+            }
+            ebr_exit();
+            return n;
+        }
+        stat_add(STAT_RETRIES, 1);
+        backoff_pause(&backoff);
+    }
+}
+
+/**
+ * Lock-free take the front value, false if the queue is empty
+ */
+bool try_dequeue(Queue* queue, int* data) {
+    return dequeue_batch(queue, data, 1) == 1;
+}
+
+/**
+ * Takes the front value, waits for one if the queue is empty
+ * Only blocks for as long as nothing is enqueued
+ */
+int dequeue(Queue* queue) {
+    int data;
+    Backoff backoff;
+    backoff_init(&backoff);
+    while (!try_dequeue(queue, &data)) {
+        ebr_enter(); // head can be retired as soon as we load it
+        bool empty = atomic_load(&atomic_load(&queue->head)->next) == NULL;
+        ebr_exit();
+        if (empty) {
+            sched_yield(); // Empty, let a producer run
+        } else {
+            backoff_pause(&backoff); // Lost a race, there's more
+        }
+    }
+    return data;
+}
+
+/**
+ * Wait-free look at the front value without taking it, false if empty
+ */
+bool queue_peek(Queue* queue, int* data) {
+    ebr_enter();
+    Node* next = atomic_load(&atomic_load(&queue->head)->next);
+    if (next != NULL) {
+        *data = next->data;
+    }
+    ebr_exit();
+    return next != NULL;
+}
+
+/**
+ * Free every node, the queue can't be used again until queue_init()
+ * Not safe against concurrent operations, call once all threads are done
+ */
+void queue_free(Queue* queue) {
+    Node* cur = atomic_load(&queue->head);
+    while (cur != NULL) {
+        Node* next = atomic_load(&cur->next);
+        pool_free(cur);
+        cur = next;
+    }
+    atomic_store(&queue->head, NULL);
+    atomic_store(&queue->tail, NULL);
+}
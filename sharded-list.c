@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include "lock-free.c"
+
+/*
+ * Sharded front end over lock-free.c
+ *
+ * Even a lock-free list has one head and one hot region that every thread
+ * hits. This splits the key space across N independent lock-free lists, so
+ * threads working on different keys land on different heads, size shards
+ * and elimination slots. Each shard starts on its own cache line and is a
+ * whole number of lines long, so two shards never share one.
+ *
+ * SHARD_HASH: a key goes to the shard its multiplicative hash picks, which
+ *   spreads any key pattern evenly.
+ * SHARD_RANGE: [lo, hi] is cut into N equal slices, keys outside it go to
+ *   the first or last shard. Neighbouring keys share a shard, and walking
+ *   the shards in order walks the key ranges in order, so with the sorted
+ *   calls the whole thing stays a sorted set.
+ *
+ * The shard count defaults to the number of online CPUs. Single-key calls
+ * touch exactly one shard. The aggregate calls (count, print, for_each)
+ * visit the shards one after another, so they're only exact once writers
+ * are quiet, same as the per-list versions.
+ */
+
+typedef enum {
+    SHARD_HASH,
+    SHARD_RANGE
+} ShardMode;
+
+typedef struct Shard {
+    _Alignas(64) List list;
+} Shard;
+
+typedef struct ShardedList {
+    ShardMode mode;
+    int count;
+    int lo;           // SHARD_RANGE: first key of shard 0
+    long long span;   // SHARD_RANGE: keys covered, hi - lo + 1
+    Shard* shards;
+} ShardedList;
+
+/**
+ * Sets up count shards, 0 picks one per online CPU
+ * lo and hi only matter for SHARD_RANGE
+ */
+void sharded_init(ShardedList* sl, ShardMode mode, int count, int lo, int hi) {
+    if (count <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        count = cpus > 0 ? (int)cpus : 1;
+    }
+    sl->mode = mode;
+    sl->count = count;
+    sl->lo = lo;
+    sl->span = hi >= lo ? (long long)hi - lo + 1 : 1;
+    sl->shards = aligned_alloc(64, count * sizeof(Shard));
+    if (sl->shards == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        list_init(&sl->shards[i].list);
+    }
+}
+
+/**
+ * Index of the shard that owns data
+ */
+static inline int shard_index(ShardedList* sl, int data) {
+    if (sl->mode == SHARD_HASH) {
+        uint32_t h = (uint32_t)data * 2654435761u; // Knuth's multiplicative hash
+        return (int)(((uint64_t)h * (uint32_t)sl->count) >> 32);
+    }
+    long long offset = (long long)data - sl->lo;
+    if (offset <= 0) {
+        return 0;
+    }
+    long long i = offset * sl->count / sl->span;
+    return i < sl->count ? (int)i : sl->count - 1;
+}
+
+/**
+ * The list that owns data
+ */
+static inline List* shard_of(ShardedList* sl, int data) {
+    return &sl->shards[shard_index(sl, data)].list;
+}
+
+/**
+ * Lock-free insert, keeps duplicates like insert_begin()
+ */
+Node* sharded_insert(ShardedList* sl, int data) {
+    return insert_begin(shard_of(sl, data), data);
+}
+
+/**
+ * Lock-free delete one copy of data, quiet when it's not there
+ */
+bool sharded_delete(ShardedList* sl, int data) {
+    return try_delete(shard_of(sl, data), data);
+}
+
+/**
+ * Wait-free check if data is there
+ */
+bool sharded_contains(ShardedList* sl, int data) {
+    return contains(shard_of(sl, data), data);
+}
+
+/**
+ * Sorted mode insert, NULL if data is already there, don't mix with sharded_insert()
+ */
+Node* sharded_insert_sorted(ShardedList* sl, int data) {
+    return insert_sorted(shard_of(sl, data), data);
+}
+
+/**
+ * Sorted mode delete
+ */
+bool sharded_delete_sorted(ShardedList* sl, int data) {
+    return delete_sorted(shard_of(sl, data), data);
+}
+
+/**
+ * Sorted mode lookup, stops past the key
+ */
+bool sharded_contains_sorted(ShardedList* sl, int data) {
+    return contains_sorted(shard_of(sl, data), data);
+}
+
+/**
+ * Size summed over every shard's estimate
+ */
+long sharded_size_approx(ShardedList* sl) {
+    long size = 0;
+    for (int i = 0; i < sl->count; i++) {
+        size += size_approx(&sl->shards[i].list);
+    }
+    return size;
+}
+
+/**
+ * Count nodes over every shard
+ */
+int sharded_count_nodes(ShardedList* sl) {
+    int count = 0;
+    for (int i = 0; i < sl->count; i++) {
+        count += count_nodes(&sl->shards[i].list);
+    }
+    return count;
+}
+
+/**
+ * Debug check: every shard's counters agree with a walk
+ */
+bool sharded_validate_size(ShardedList* sl) {
+    for (int i = 0; i < sl->count; i++) {
+        if (!validate_size(&sl->shards[i].list)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Wait-free call cb on every value, one shard after another
+ */
+void sharded_for_each(ShardedList* sl, void (*cb)(int data, void* arg), void* arg) {
+    for (int i = 0; i < sl->count; i++) {
+        list_for_each(&sl->shards[i].list, cb, arg);
+    }
+}
+
+/**
+ * Print callback
+ */
+void sharded_print_value(int data, void* arg) {
+    (void)arg;
+    printf("%d -> ", data);
+}
+
+/**
+ * Wait-free print every shard's contents as one list
+ */
+void sharded_print_list(ShardedList* sl) {
+    if (sharded_count_nodes(sl) == 0) {
+        printf("empty list\n");
+        return;
+    }
+    printf("List: ");
+    sharded_for_each(sl, sharded_print_value, NULL);
+    printf("END\n");
+}
+
+/**
+ * Free every shard
+ * Not safe against concurrent operations, call once all threads are done
+ */
+void sharded_free(ShardedList* sl) {
+    for (int i = 0; i < sl->count; i++) {
+        free_list(&sl->shards[i].list);
+    }
+    free(sl->shards);
+    sl->shards = NULL;
+    sl->count = 0;
+}
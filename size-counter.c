@@ -0,0 +1,81 @@
+#ifndef SIZE_COUNTER_C
+#define SIZE_COUNTER_C
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/*
+ * Sharded size counter
+ *
+ * Each thread adds into its own cache-line shard, so inserts and deletes on
+ * different threads never fight over one counter line. counter_exact() sums
+ * the shards (exact once writers are quiet). counter_approx() is a single
+ * load: shards fold their change into a shared estimate every COUNTER_FOLD
+ * updates, so it's off by at most COUNTER_SHARDS * COUNTER_FOLD.
+ */
+
+#define COUNTER_SHARDS 64
+#define COUNTER_FOLD 64
+
+typedef struct CounterShard {
+    _Alignas(64) _Atomic long value;  // Everything this shard has counted
+    _Atomic long folded;              // How much of value is already in estimate
+} CounterShard;
+
+typedef struct SizeCounter {
+    _Alignas(64) _Atomic long estimate;
+    CounterShard shards[COUNTER_SHARDS];
+} SizeCounter;
+
+_Atomic unsigned counter_next_shard = 0;
+_Thread_local int counter_shard = -1;
+
+/**
+ * Zeroes every shard
+ */
+void counter_reset(SizeCounter* counter) {
+    atomic_store(&counter->estimate, 0);
+    for (int i = 0; i < COUNTER_SHARDS; i++) {
+        atomic_store(&counter->shards[i].value, 0);
+        atomic_store(&counter->shards[i].folded, 0);
+    }
+}
+
+/**
+ * Adds delta to the calling thread's shard
+ */
+static inline void counter_add(SizeCounter* counter, long delta) {
+    if (counter_shard < 0) {
+        counter_shard = (int)(atomic_fetch_add(&counter_next_shard, 1) % COUNTER_SHARDS);
+    }
+    CounterShard* shard = &counter->shards[counter_shard];
+    long value = atomic_fetch_add_explicit(&shard->value, delta, memory_order_relaxed) + delta;
+
+    long folded = atomic_load_explicit(&shard->folded, memory_order_relaxed);
+    long pending = value - folded;
+    if ((pending >= COUNTER_FOLD || pending <= -COUNTER_FOLD) &&
+        atomic_compare_exchange_strong_explicit(&shard->folded, &folded, value,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&counter->estimate, pending, memory_order_relaxed);
+    }
+}
+
+/**
+ * Size without any synchronization, may lag by a few thousand
+ */
+static inline long counter_approx(SizeCounter* counter) {
+    return atomic_load_explicit(&counter->estimate, memory_order_relaxed);
+}
+
+/**
+ * Sum of every shard
+ */
+long counter_exact(SizeCounter* counter) {
+    long total = 0;
+    for (int i = 0; i < COUNTER_SHARDS; i++) {
+        total += atomic_load(&counter->shards[i].value);
+    }
+    return total;
+}
+
+#endif
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "ebr.c"
+#include "node-pool.c"
+
+/*
+ * Lock-free skip list
+ *
+ * Same idea as lock-free.c, stretched over a tower of levels: every level has
+ * its own _Atomic next and a node is deleted by marking. The mark lives in the
+ * low bit of each next pointer, so a marked node's links can't be CASed any
+ * more and nothing gets linked behind a node on its way out. Marking next[0]
+ * is the real delete, the upper levels are marked first just so searches stop
+ * using them. find() snips marked nodes as it goes, like lock-free.c.
+ *
+ * Keys are a set, insert() refuses duplicates. O(log n) expected per op.
+ */
+
+#define SKIP_MAX_LEVEL 32
+#define SKIP_CLASSES 6 // Tower sizes 1, 2, 4, 8, 16, 32
+
+typedef struct SkipNode {
+    int data;
+    int level;         // Tower height, 1..SKIP_MAX_LEVEL
+    _Atomic int refs;  // Inserter + deleter, whoever drops the last one retires it
+    _Atomic(struct SkipNode*) next[]; // Low bit set = deleted at this level
+} SkipNode;
+
+typedef struct SkipList {
+    _Atomic(SkipNode*) head[SKIP_MAX_LEVEL];
+} SkipList;
+
+#define SKIP_POOL(levels) NODE_POOL_INIT_SIZE(sizeof(SkipNode) + (levels) * sizeof(_Atomic(SkipNode*)))
+NodePool skip_pools[SKIP_CLASSES] = {
+    SKIP_POOL(1), SKIP_POOL(2), SKIP_POOL(4), SKIP_POOL(8), SKIP_POOL(16), SKIP_POOL(32)
+};
+
+_Thread_local uint32_t skip_seed = 0;
+
+static inline bool is_marked(SkipNode* p) {
+    return ((uintptr_t)p & 1) != 0;
+}
+
+static inline SkipNode* get_unmarked(SkipNode* p) {
+    return (SkipNode*)((uintptr_t)p & ~(uintptr_t)1);
+}
+
+static inline SkipNode* get_marked(SkipNode* p) {
+    return (SkipNode*)((uintptr_t)p | 1);
+}
+
+/**
+ * The link to CAS at a level, pred NULL means the head
+ */
+static inline _Atomic(SkipNode*)* skip_link(SkipList* list, SkipNode* pred, int level) {
+    return pred == NULL ? &list->head[level] : &pred->next[level];
+}
+
+/**
+ * Pool for a tower of this height
+ */
+static inline int skip_class(int level) {
+    int c = 0;
+    while ((1 << c) < level) {
+        c++;
+    }
+    return c;
+}
+
+/**
+ * Random tower height, each level up is half as likely
+ */
+int random_level() {
+    if (skip_seed == 0) {
+        skip_seed = (uint32_t)(uintptr_t)&skip_seed | 1; // Different per thread
+    }
+    skip_seed ^= skip_seed << 13; // xorshift32
+    skip_seed ^= skip_seed >> 17;
+    skip_seed ^= skip_seed << 5;
+
+    int level = 1 + __builtin_ctz(skip_seed | (1u << (SKIP_MAX_LEVEL - 1)));
+    return level;
+}
+
+/**
+ * Allocates and creates a new node with a tower of the given height
+ */
+SkipNode* create_skip_node(int data, int level) {
+    SkipNode* new_node = (SkipNode*)pool_alloc(&skip_pools[skip_class(level)]);
+    new_node->data = data;
+    new_node->level = level;
+    atomic_store(&new_node->refs, 2);
+    for (int i = 0; i < level; i++) {
+        atomic_store(&new_node->next[i], NULL);
+    }
+    return new_node;
+}
+
+/**
+ * Frees a node once ebr says nobody can see it anymore
+ */
+void reclaim_skip_node(void* node) {
+    pool_free(node);
+}
+
+/**
+ * Drops one reference, the last one retires the node
+ */
+void release_skip_node(SkipNode* node) {
+    if (atomic_fetch_sub(&node->refs, 1) == 1) {
+        ebr_retire(node, reclaim_skip_node);
+    }
+}
+
+/**
+ * Sets up an empty skip list
+ */
+void skip_list_init(SkipList* list) {
+    for (int i = 0; i < SKIP_MAX_LEVEL; i++) {
+        atomic_init(&list->head[i], NULL);
+    }
+}
+
+/**
+ * Find preds/succs of data on every level, helper for insert/delete
+ * Snips marked nodes on the way, restarts if a snip CAS fails
+ * Caller must be inside ebr_enter()/ebr_exit()
+ */
+bool skip_find(SkipList* list, int data, SkipNode** preds, SkipNode** succs) {
+retry: {
+    SkipNode* pred = NULL;
+    for (int level = SKIP_MAX_LEVEL - 1; level >= 0; level--) {
+        SkipNode* cur = get_unmarked(atomic_load(skip_link(list, pred, level)));
+        while (cur != NULL) {
+            SkipNode* succ = atomic_load(&cur->next[level]);
+            if (is_marked(succ)) {
+                // Deleted on this level, snip it out
+                SkipNode* expected = cur;
+                if (!atomic_compare_exchange_strong(skip_link(list, pred, level), &expected, get_unmarked(succ))) {
+                    goto retry; // pred changed or is being deleted itself
+                }
+                cur = get_unmarked(succ);
+            } else if (cur->data < data) {
+                pred = cur;
+                cur = succ;
+            } else {
+                break;
+            }
+        }
+        preds[level] = pred;
+        succs[level] = cur;
+    }
+    return succs[0] != NULL && succs[0]->data == data;
+    }
+}
+
+/**
+ * Lock-free insert, returns false if the value is already there
+ */
+bool insert(SkipList* list, int data) {
+    SkipNode* preds[SKIP_MAX_LEVEL];
+    SkipNode* succs[SKIP_MAX_LEVEL];
+    int level = random_level();
+    SkipNode* new_node = create_skip_node(data, level);
+
+    ebr_enter();
+    while (true) {
+        if (skip_find(list, data, preds, succs)) {
+            ebr_exit();
+            pool_free(new_node); // Never published
+            return false;
+        }
+        for (int i = 0; i < level; i++) {
+            atomic_store(&new_node->next[i], succs[i]);
+        }
+        SkipNode* expected = succs[0];
+        if (atomic_compare_exchange_strong(skip_link(list, preds[0], 0), &expected, new_node)) {
+            break; // In the list now, the rest is just shortcuts
+        }
+    }
+
+    for (int i = 1; i < level; i++) {
+        while (true) {
+            SkipNode* mine = atomic_load(&new_node->next[i]);
+            if (is_marked(mine)) {
+                goto linked; // Being deleted already, stop building
+            }
+            if (mine != succs[i] && !atomic_compare_exchange_strong(&new_node->next[i], &mine, succs[i])) {
+                goto linked; // Only a delete changes it now
+            }
+            SkipNode* expected = succs[i];
+            if (atomic_compare_exchange_strong(skip_link(list, preds[i], i), &expected, new_node)) {
+                break;
+            }
+            skip_find(list, data, preds, succs);
+            if (succs[0] != new_node) {
+                goto linked; // Gone from level 0, don't link it higher
+            }
+        }
+    }
+
+linked:
+    if (is_marked(atomic_load(&new_node->next[0]))) {
+        skip_find(list, data, preds, succs); // A delete may have missed a level we just linked
+    }
+    release_skip_node(new_node);
+    ebr_exit();
+    return true;
+}
+
+/**
+ * Lock-free delete, marks every level top down then lets find() unlink it
+ */
+bool delete_node(SkipList* list, int data) {
+    SkipNode* preds[SKIP_MAX_LEVEL];
+    SkipNode* succs[SKIP_MAX_LEVEL];
+
+    ebr_enter();
+    if (!skip_find(list, data, preds, succs)) {
+        ebr_exit();
+        return false;
+    }
+
+    SkipNode* victim = succs[0];
+    for (int i = victim->level - 1; i >= 1; i--) {
+        SkipNode* succ = atomic_load(&victim->next[i]);
+        while (!is_marked(succ)) {
+            atomic_compare_exchange_strong(&victim->next[i], &succ, get_marked(succ));
+        }
+    }
+
+    SkipNode* succ = atomic_load(&victim->next[0]);
+    while (true) {
+        if (is_marked(succ)) {
+            ebr_exit();
+            return false; // Someone else deleted it first
+        }
+        if (atomic_compare_exchange_strong(&victim->next[0], &succ, get_marked(succ))) {
+            break; // Logically deleted
+        }
+    }
+
+    skip_find(list, data, preds, succs); // Physically unlink it on every level
+    release_skip_node(victim);
+    ebr_exit();
+    return true;
+}
+
+/**
+ * Wait-free return a node with a given value, doesn't help unlink
+ * The node can be retired once this returns, only dereference it
+ * while still inside your own ebr_enter()/ebr_exit()
+ */
+SkipNode* search(SkipList* list, int data) {
+    ebr_enter();
+    SkipNode* pred = NULL;
+    SkipNode* cur = NULL;
+    for (int level = SKIP_MAX_LEVEL - 1; level >= 0; level--) {
+        cur = get_unmarked(atomic_load(skip_link(list, pred, level)));
+        while (cur != NULL) {
+            SkipNode* succ = atomic_load(&cur->next[level]);
+            if (is_marked(succ)) {
+                cur = get_unmarked(succ); // Skip over deleted nodes
+            } else if (cur->data < data) {
+                pred = cur;
+                cur = succ;
+            } else {
+                break;
+            }
+        }
+    }
+    if (cur != NULL && (cur->data != data || is_marked(atomic_load(&cur->next[0])))) {
+        cur = NULL;
+    }
+    ebr_exit();
+    return cur;
+}
+
+/**
+ * Wait-free check if a value exists in the list
+ */
+bool contains(SkipList* list, int data) {
+    return search(list, data) != NULL;
+}
+
+/**
+ * Wait-free print list contents
+ */
+void print_list(SkipList* list) {
+    ebr_enter();
+    SkipNode* cur = get_unmarked(atomic_load(&list->head[0]));
+    if (cur == NULL) {
+        printf("empty list\n");
+        ebr_exit();
+        return;
+    }
+
+    printf("List: ");
+    while (cur != NULL) {
+        SkipNode* succ = atomic_load(&cur->next[0]);
+        if (!is_marked(succ)) {
+            printf("%d -> ", cur->data);
+        }
+        cur = get_unmarked(succ);
+    }
+    printf("END\n");
+    ebr_exit();
+}
+
+/**
+ * Wait-free count nodes in list
+ */
+int count_nodes(SkipList* list) {
+    int count = 0;
+    ebr_enter();
+    SkipNode* cur = get_unmarked(atomic_load(&list->head[0]));
+    while (cur != NULL) {
+        SkipNode* succ = atomic_load(&cur->next[0]);
+        if (!is_marked(succ)) { // Don't count logically deleted nodes
+            count++;
+        }
+        cur = get_unmarked(succ);
+    }
+    ebr_exit();
+    return count;
+}
+
+/**
+ * Free memory used by the list
+ * Not safe against concurrent operations, call once all threads are done
+ * Nodes that were already retired are freed by ebr_drain()
+ */
+void free_list(SkipList* list) {
+    SkipNode* cur = get_unmarked(atomic_load(&list->head[0]));
+    while (cur != NULL) {
+        SkipNode* next = get_unmarked(atomic_load(&cur->next[0]));
+        pool_free(cur);
+        cur = next;
+    }
+    for (int i = 0; i < SKIP_MAX_LEVEL; i++) {
+        atomic_store(&list->head[i], NULL);
+    }
+}
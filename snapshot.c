@@ -0,0 +1,273 @@
+#ifndef SNAPSHOT_C
+#define SNAPSHOT_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Versioned nodes for the list_iter_* snapshot mode
+ *
+ * Every node of a versioned structure carries the clock value it was inserted
+ * at and the one it was deleted at, 0 while that hasn't been stamped yet. Writers only ever load
+ * the clock; starting a snapshot is the one thing that bumps it, so the
+ * snapshot gets a version V that splits every stamp into "<= V, happened
+ * before" and "> V, happened after". A node is in the snapshot iff it was
+ * inserted at or before V and not deleted by then.
+ *
+ * A stamp is what makes an update take effect. A writer stamps its own node
+ * right after the CAS/store that links or marks it, and anyone else who
+ * acts on a node first stamps whatever is missing for it. That way no
+ * reader can see an update that the snapshot puts after V.
+ *
+ * Deletes still unlink right away. A node that gets unlinked while a snapshot
+ * is running is reported to it before the unlink, so the walk doesn't lose a
+ * node it hadn't reached yet. snap_finish() merges those reports back in and
+ * drops duplicates.
+ *
+ * The clock is 32 bits and only moves once per snapshot.
+ *
+ * Stamps cost every node 8 bytes and every update a stamp or two, so they're
+ * opt-in (list_set_versioned()). Without them a snapshot is just a copy of
+ * what one walk saw, see snap_values().
+ */
+
+typedef enum {
+    ITER_WEAK,     // Plain walk, sees whatever is there as it goes, no extra cost
+    ITER_SNAPSHOT  // Linearizable copy taken at list_iter_begin() on a versioned structure
+} IterMode;
+
+typedef struct SnapReport {
+    void* node;
+    int data;
+    unsigned ins;
+    unsigned del;
+    struct SnapReport* next;
+} SnapReport;
+
+typedef struct SnapCollector {
+    _Alignas(64) _Atomic bool active;
+    _Atomic bool in_use;
+    unsigned version;
+    _Atomic(SnapReport*) reports;
+    struct SnapCollector* next;  // Registry link, collectors are never removed
+} SnapCollector;
+
+typedef struct SnapClock {
+    _Alignas(64) _Atomic unsigned clock;
+    _Atomic int active;          // Collectors running, unlinks check this first
+    _Atomic(SnapCollector*) collectors;
+} SnapClock;
+
+typedef struct SnapItem {
+    void* node;
+    int data;
+} SnapItem;
+
+typedef struct SnapBuffer {
+    SnapItem* items;
+    long count;
+    long capacity;
+} SnapBuffer;
+
+/**
+ * Sets up a clock with no snapshots, 0 is kept for "not stamped yet"
+ */
+void snap_init(SnapClock* snap) {
+    atomic_init(&snap->clock, 1);
+    atomic_init(&snap->active, 0);
+    atomic_init(&snap->collectors, NULL);
+}
+
+/**
+ * Frees the collectors and any reports they still hold, leaves a fresh clock
+ * Not safe against concurrent operations
+ */
+void snap_destroy(SnapClock* snap) {
+    SnapCollector* col = atomic_load(&snap->collectors);
+    while (col != NULL) {
+        SnapCollector* next = col->next;
+        SnapReport* report = atomic_load(&col->reports);
+        while (report != NULL) {
+            SnapReport* next_report = report->next;
+            free(report);
+            report = next_report;
+        }
+        free(col);
+        col = next;
+    }
+    snap_init(snap);
+}
+
+/**
+ * Stamps ver with the current clock unless someone already did, returns the stamp
+ */
+static inline unsigned snap_stamp(SnapClock* snap, _Atomic unsigned* ver) {
+    unsigned v = atomic_load(ver);
+    if (v == 0) {
+        unsigned now = atomic_load(&snap->clock);
+        if (atomic_compare_exchange_strong(ver, &v, now)) {
+            v = now;
+        }
+    }
+    return v;
+}
+
+/**
+ * Whether a node with these stamps is in the snapshot taken at version
+ */
+static inline bool snap_visible(unsigned ins, unsigned del, unsigned version) {
+    return ins != 0 && ins <= version && (del == 0 || del > version);
+}
+
+/**
+ * Claims a collector and starts a snapshot, bumps the clock
+ * Call inside ebr_enter()/ebr_exit() and stay there until snap_finish()
+ */
+SnapCollector* snap_begin(SnapClock* snap) {
+    SnapCollector* col;
+    for (col = atomic_load(&snap->collectors); col != NULL; col = col->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&col->in_use, &expected, true)) {
+            break;
+        }
+    }
+
+    if (col == NULL) {
+        col = aligned_alloc(64, sizeof(SnapCollector));
+        if (col == NULL) {
+            printf("malloc fail\n");
+            exit(1);
+        }
+        atomic_init(&col->active, false);
+        atomic_init(&col->in_use, true);
+        atomic_init(&col->reports, NULL);
+
+        SnapCollector* head;
+        do {
+            head = atomic_load(&snap->collectors);
+            col->next = head;
+        } while (!atomic_compare_exchange_weak(&snap->collectors, &head, col));
+    }
+
+    // Visible to unlinkers before the bump, so anything deleted after V gets reported
+    atomic_store(&col->active, true);
+    atomic_fetch_add(&snap->active, 1);
+    col->version = atomic_fetch_add(&snap->clock, 1);
+    return col;
+}
+
+/**
+ * Tells every running snapshot about a node that's about to be unlinked
+ * del must already be stamped. Costs one load when no snapshot is running
+ */
+void snap_report(SnapClock* snap, void* node, int data, unsigned ins, unsigned del) {
+    if (atomic_load(&snap->active) == 0) {
+        return;
+    }
+    for (SnapCollector* col = atomic_load(&snap->collectors); col != NULL; col = col->next) {
+        if (!atomic_load(&col->active)) {
+            continue;
+        }
+        SnapReport* report = malloc(sizeof(SnapReport));
+        if (report == NULL) {
+            printf("malloc fail\n");
+            exit(1);
+        }
+        report->node = node;
+        report->data = data;
+        report->ins = ins;
+        report->del = del;
+        SnapReport* head;
+        do {
+            head = atomic_load(&col->reports);
+            report->next = head;
+        } while (!atomic_compare_exchange_weak(&col->reports, &head, report));
+    }
+}
+
+/**
+ * Adds a node the walk found visible
+ */
+void snap_add(SnapBuffer* buf, void* node, int data) {
+    if (buf->count == buf->capacity) {
+        buf->capacity = buf->capacity > 0 ? buf->capacity * 2 : 256;
+        buf->items = realloc(buf->items, buf->capacity * sizeof(SnapItem));
+        if (buf->items == NULL) {
+            printf("malloc fail\n");
+            exit(1);
+        }
+    }
+    buf->items[buf->count].node = node;
+    buf->items[buf->count].data = data;
+    buf->count++;
+}
+
+int snap_item_compare(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)((const SnapItem*)a)->node;
+    uintptr_t y = (uintptr_t)((const SnapItem*)b)->node;
+    return (x > y) - (x < y);
+}
+
+int snap_value_compare(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Drops nodes seen twice and returns the values in ascending order
+ * (malloc'd, *count of them), a walk without stamps can go straight here
+ * Takes over buf
+ */
+int* snap_values(SnapBuffer* buf, long* count) {
+    if (buf->count > 0) { // items is still NULL if nothing was added
+        qsort(buf->items, buf->count, sizeof(SnapItem), snap_item_compare);
+    }
+    int* values = malloc((buf->count > 0 ? buf->count : 1) * sizeof(int));
+    if (values == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    long n = 0;
+    for (long i = 0; i < buf->count; i++) {
+        if (i == 0 || buf->items[i].node != buf->items[i - 1].node) {
+            values[n++] = buf->items[i].data;
+        }
+    }
+    free(buf->items);
+    buf->items = NULL;
+    buf->count = 0;
+    buf->capacity = 0;
+
+    qsort(values, n, sizeof(int), snap_value_compare);
+    *count = n;
+    return values;
+}
+
+/**
+ * Ends a snapshot: merges in the reports, drops nodes seen twice and
+ * returns the values in ascending order (malloc'd, *count of them)
+ * Takes over buf
+ */
+int* snap_finish(SnapClock* snap, SnapCollector* col, SnapBuffer* buf, long* count) {
+    atomic_store(&col->active, false);
+    atomic_fetch_sub(&snap->active, 1);
+    SnapReport* report = atomic_exchange(&col->reports, NULL);
+    unsigned version = col->version;
+    atomic_store(&col->in_use, false);
+
+    while (report != NULL) {
+        SnapReport* next = report->next;
+        if (snap_visible(report->ins, report->del, version)) {
+            snap_add(buf, report->node, report->data);
+        }
+        free(report);
+        report = next;
+    }
+    return snap_values(buf, count);
+}
+
+#endif
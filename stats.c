@@ -0,0 +1,216 @@
+#ifndef STATS_C
+#define STATS_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/*
+ * Contention counters, compiled in with -DLIST_STATS (make STATS=1)
+ *
+ * Every thread counts into its own cache-line aligned StatRecord, so counting
+ * never adds sharing of its own. Records are never freed, so the totals keep
+ * what threads did after they exit. list_stats_snapshot() adds every record
+ * up; it's exact once the threads are done and close enough while they run.
+ *
+ * Without LIST_STATS the stat_* calls below compile away to nothing and
+ * stat_cas() is just the CAS.
+ */
+
+typedef enum {
+    STAT_SITE_INSERT_HEAD,   // Swinging head in insert_begin()/insert_many()
+    STAT_SITE_INSERT_LINK,   // Linking a node after prev, sorted and hash set inserts
+    STAT_SITE_MARK,          // Logical delete
+    STAT_SITE_UNLINK,        // Physical delete, ours or helping
+    STAT_SITE_MCAS,          // Multi-word updates, list_move()/list_replace() and moves to the front
+    STAT_SITES
+} StatSite;
+
+typedef enum {
+    STAT_OPS,                // Calls that walk the list
+    STAT_VISITED,            // Nodes stepped over by those walks
+    STAT_RETRIES,            // find() restarts and delete retries
+    STAT_HELP_UNLINKS,       // Marked nodes somebody else deleted that a walk snipped out
+    STAT_LOCK_ACQUIRES,      // linked-list.c lock and mutex acquisitions
+    STAT_LOCK_WAIT_NS,       // Time spent getting them
+    STAT_ELIMINATED,         // insert_begin()/delete_node() pairs that met in an elimination slot
+    STAT_MOVED,              // Hits an adaptive list moved to the front
+    STAT_FILTER_CHECKS,      // Lookups that asked the Bloom filter first
+    STAT_FILTER_NEGATIVES,   // ... and got "definitely not there", no walk
+    STAT_FILTER_FALSE_POSITIVES, // ... got "maybe" and then missed anyway
+    STAT_COUNTERS
+} StatCounter;
+
+typedef struct StatRecord {
+    _Alignas(64) _Atomic long cas_attempts[STAT_SITES];
+    _Atomic long cas_failures[STAT_SITES];
+    _Atomic long counters[STAT_COUNTERS];
+    struct StatRecord* next;  // Registry link
+} StatRecord;
+
+typedef struct ListStats {
+    long cas_attempts[STAT_SITES];
+    long cas_failures[STAT_SITES];
+    long counters[STAT_COUNTERS];
+} ListStats;
+
+const char* stat_site_names[STAT_SITES] = { "insert_head", "insert_link", "mark", "unlink", "mcas" };
+
+#ifdef LIST_STATS
+
+_Atomic(StatRecord*) stat_records = NULL;
+_Thread_local StatRecord* stat_self = NULL;
+
+/**
+ * Calling thread's record, registers one on first use
+ */
+StatRecord* stat_record(void) {
+    if (stat_self != NULL) {
+        return stat_self;
+    }
+    StatRecord* rec = aligned_alloc(64, sizeof(StatRecord));
+    if (rec == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    for (int i = 0; i < STAT_SITES; i++) {
+        atomic_init(&rec->cas_attempts[i], 0);
+        atomic_init(&rec->cas_failures[i], 0);
+    }
+    for (int i = 0; i < STAT_COUNTERS; i++) {
+        atomic_init(&rec->counters[i], 0);
+    }
+    StatRecord* head;
+    do {
+        head = atomic_load(&stat_records);
+        rec->next = head;
+    } while (!atomic_compare_exchange_weak(&stat_records, &head, rec));
+    stat_self = rec;
+    return rec;
+}
+
+/**
+ * Owner-only bump, relaxed since only the snapshot reads it
+ */
+static inline void stat_bump(_Atomic long* counter, long n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/**
+ * Adds n to one of the calling thread's counters
+ */
+static inline void stat_add(StatCounter counter, long n) {
+    stat_bump(&stat_record()->counters[counter], n);
+}
+
+/**
+ * Counts a CAS at a call site, wrap the CAS itself: stat_cas(site, cas(...))
+ */
+static inline bool stat_cas(StatSite site, bool ok) {
+    StatRecord* rec = stat_record();
+    stat_bump(&rec->cas_attempts[site], 1);
+    if (!ok) {
+        stat_bump(&rec->cas_failures[site], 1);
+    }
+    return ok;
+}
+
+/**
+ * Monotonic nanoseconds for the lock wait timer
+ */
+static inline long stat_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Times a lock call: STAT_LOCK(pthread_mutex_lock(&m));
+#define STAT_LOCK(call) do {                                  \
+        long stat_start = stat_now();                         \
+        call;                                                 \
+        stat_add(STAT_LOCK_WAIT_NS, stat_now() - stat_start); \
+        stat_add(STAT_LOCK_ACQUIRES, 1);                      \
+    } while (0)
+
+/**
+ * Sum of every thread's counters
+ */
+ListStats list_stats_snapshot(void) {
+    ListStats total = { 0 };
+    for (StatRecord* rec = atomic_load(&stat_records); rec != NULL; rec = rec->next) {
+        for (int i = 0; i < STAT_SITES; i++) {
+            total.cas_attempts[i] += atomic_load_explicit(&rec->cas_attempts[i], memory_order_relaxed);
+            total.cas_failures[i] += atomic_load_explicit(&rec->cas_failures[i], memory_order_relaxed);
+        }
+        for (int i = 0; i < STAT_COUNTERS; i++) {
+            total.counters[i] += atomic_load_explicit(&rec->counters[i], memory_order_relaxed);
+        }
+    }
+    return total;
+}
+
+#else
+
+static inline void stat_add(StatCounter counter, long n) {
+    (void)counter;
+    (void)n;
+}
+
+#define stat_cas(site, ok) (ok)
+#define STAT_LOCK(call) call
+
+/**
+ * Everything reads zero when the counters aren't compiled in
+ */
+ListStats list_stats_snapshot(void) {
+    ListStats total = { 0 };
+    return total;
+}
+
+#endif
+
+/**
+ * Prints a snapshot, one line per call site then the totals
+ */
+void list_stats_print(ListStats* stats) {
+#ifndef LIST_STATS
+    printf("stats: not compiled in, build with make STATS=1\n");
+    (void)stats;
+#else
+    for (int i = 0; i < STAT_SITES; i++) {
+        long attempts = stats->cas_attempts[i];
+        if (attempts > 0) {
+            printf("stats: cas %-12s %10ld attempts %10ld failed (%.2f%%)\n", stat_site_names[i],
+                   attempts, stats->cas_failures[i], 100.0 * stats->cas_failures[i] / attempts);
+        }
+    }
+    long ops = stats->counters[STAT_OPS];
+    if (ops > 0) {
+        printf("stats: %ld walks, %.1f nodes visited each, %ld retries, %ld helping unlinks\n",
+               ops, (double)stats->counters[STAT_VISITED] / ops,
+               stats->counters[STAT_RETRIES], stats->counters[STAT_HELP_UNLINKS]);
+    }
+    if (stats->counters[STAT_ELIMINATED] > 0) {
+        printf("stats: %ld insert/delete pairs eliminated\n", stats->counters[STAT_ELIMINATED]);
+    }
+    if (stats->counters[STAT_MOVED] > 0) {
+        printf("stats: %ld hits moved to the front\n", stats->counters[STAT_MOVED]);
+    }
+    long checks = stats->counters[STAT_FILTER_CHECKS];
+    if (checks > 0) {
+        printf("stats: filter answered %ld of %ld lookups (%.1f%%), %ld false positives\n",
+               stats->counters[STAT_FILTER_NEGATIVES], checks,
+               100.0 * stats->counters[STAT_FILTER_NEGATIVES] / checks,
+               stats->counters[STAT_FILTER_FALSE_POSITIVES]);
+    }
+    long locks = stats->counters[STAT_LOCK_ACQUIRES];
+    if (locks > 0) {
+        printf("stats: %ld lock acquires, %.0f ns average wait\n",
+               locks, (double)stats->counters[STAT_LOCK_WAIT_NS] / locks);
+    }
+#endif
+}
+
+#endif
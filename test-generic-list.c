@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "generic-list.c"
+
+#define NUM_THREADS 8
+#define OPERATIONS_PER_THREAD 10000
+#define VALUE_RANGE 1000
+
+/**
+ * Value stored inline next to a 64-bit key
+ */
+typedef struct {
+    uint64_t twice;
+    uint32_t low;
+} Payload;
+
+/**
+ * Fixed-size string key
+ */
+typedef struct {
+    char s[16];
+} Name;
+
+static inline int name_cmp(const Name* a, const Name* b) {
+    return strncmp(a->s, b->s, sizeof(a->s));
+}
+
+static inline unsigned name_hash(const Name* k) {
+    return generic_hash_bytes(k->s, strnlen(k->s, sizeof(k->s)));
+}
+
+DEFINE_LOCKFREE_LIST(u64_map, uint64_t, Payload, GENERIC_CMP_SCALAR, GENERIC_HASH_INT)
+DEFINE_LOCKED_LIST(name_map, Name, int, name_cmp, name_hash)
+
+u64_map numbers;
+name_map names;
+
+// More specializations than there are pool ids, see verify_many_types()
+#define SPEC_PAIR(n)                                                                    \
+    DEFINE_LOCKFREE_LIST(spec_lf##n, int, int, GENERIC_CMP_SCALAR, GENERIC_HASH_INT)    \
+    DEFINE_LOCKED_LIST(spec_lk##n, int, int, GENERIC_CMP_SCALAR, GENERIC_HASH_INT)
+#define SPEC_CHECK(name, n) {                                                           \
+        name list;                                                                      \
+        name##_init(&list);                                                             \
+        ok = ok && name##_insert(&list, n, n) && name##_contains(&list, n);             \
+        name##_free(&list);                                                             \
+    }
+
+SPEC_PAIR(0) SPEC_PAIR(1) SPEC_PAIR(2) SPEC_PAIR(3) SPEC_PAIR(4) SPEC_PAIR(5)
+SPEC_PAIR(6) SPEC_PAIR(7) SPEC_PAIR(8) SPEC_PAIR(9) SPEC_PAIR(10) SPEC_PAIR(11)
+SPEC_PAIR(12) SPEC_PAIR(13) SPEC_PAIR(14) SPEC_PAIR(15) SPEC_PAIR(16)
+
+// 0 or 1 per key and map since both are maps
+_Atomic int* expected_numbers;
+_Atomic int* expected_names;
+_Atomic bool bad_value = false;
+
+/**
+ * Thread struct
+ */
+typedef struct {
+    int thread_id;
+    int seed;
+} ThreadArg;
+
+/**
+ * Keys are spread out so the 64-bit range actually gets used
+ */
+static inline uint64_t number_key(int i) {
+    return ((uint64_t)i << 40) | (uint64_t)i;
+}
+
+static inline Name name_key(int i) {
+    Name n;
+    memset(&n, 0, sizeof(n));
+    snprintf(n.s, sizeof(n.s), "key-%d", i);
+    return n;
+}
+
+/**
+ * Initialize the expected values arrays
+ */
+void init_expected_values() {
+    expected_numbers = calloc(VALUE_RANGE, sizeof(_Atomic int));
+    expected_names = calloc(VALUE_RANGE, sizeof(_Atomic int));
+    if (expected_numbers == NULL || expected_names == NULL) {
+        perror("calloc failed for expected values");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < VALUE_RANGE; i++) {
+        atomic_init(&expected_numbers[i], 0);
+        atomic_init(&expected_names[i], 0);
+    }
+}
+
+/**
+ * Thread implementation
+ */
+void* thread_function(void* arg) {
+    ThreadArg* thread_arg = (ThreadArg*)arg;
+    int thread_id = thread_arg->thread_id;
+    unsigned int seed = thread_arg->seed;
+
+    printf("Thread %d starting\n", thread_id);
+
+    for (int i = 0; i < OPERATIONS_PER_THREAD; i++) {
+        int operation = rand_r(&seed) % 3;
+        int value = rand_r(&seed) % VALUE_RANGE;
+        uint64_t key = number_key(value);
+        Name name = name_key(value);
+        Payload payload;
+        int index;
+
+        switch (operation) {
+            case 0: // Insert, only counts if the key wasn't there yet
+                payload.twice = key * 2;
+                payload.low = (uint32_t)key;
+                if (u64_map_insert(&numbers, key, payload)) {
+                    atomic_fetch_add(&expected_numbers[value], 1);
+                }
+                if (name_map_insert(&names, name, value)) {
+                    atomic_fetch_add(&expected_names[value], 1);
+                }
+                break;
+
+            case 1: // Delete
+                if (u64_map_delete(&numbers, key)) {
+                    atomic_fetch_sub(&expected_numbers[value], 1);
+                }
+                if (name_map_delete(&names, name)) {
+                    atomic_fetch_sub(&expected_names[value], 1);
+                }
+                break;
+
+            case 2: // Get, the value has to belong to the key
+                if (u64_map_get(&numbers, key, &payload) &&
+                    (payload.twice != key * 2 || payload.low != (uint32_t)key)) {
+                    atomic_store(&bad_value, true);
+                }
+                if (name_map_get(&names, name, &index) && index != value) {
+                    atomic_store(&bad_value, true);
+                }
+                break;
+        }
+
+        // Delay to cause thread interleaving
+        if (rand_r(&seed) % 100 == 0) {
+            usleep(1);
+        }
+    }
+
+    printf("thread %d complete\n", thread_id);
+    return NULL;
+}
+
+/**
+ * Tallies callbacks, one per map
+ */
+void tally_number(const uint64_t* key, const Payload* val, void* arg) {
+    int* seen = arg;
+    int value = (int)(*key & 0xffffffffu);
+    if (value < 0 || value >= VALUE_RANGE || *key != number_key(value) || val->twice != *key * 2) {
+        seen[VALUE_RANGE]++; // Last slot counts garbage
+        return;
+    }
+    seen[value]++;
+}
+
+void tally_name(const Name* key, const int* val, void* arg) {
+    int* seen = arg;
+    Name expected = name_key(*val);
+    if (*val < 0 || *val >= VALUE_RANGE || name_cmp(key, &expected) != 0) {
+        seen[VALUE_RANGE]++;
+        return;
+    }
+    seen[*val]++;
+}
+
+/**
+ * Verification function, both maps have to hold exactly the expected keys
+ */
+bool verify_maps() {
+    printf("verifying integrity...\n");
+
+    if (atomic_load(&bad_value)) {
+        printf("verification fail: get returned a value for the wrong key\n");
+        return false;
+    }
+
+    int expected_number_count = 0;
+    int expected_name_count = 0;
+    for (int i = 0; i < VALUE_RANGE; i++) {
+        expected_number_count += atomic_load(&expected_numbers[i]);
+        expected_name_count += atomic_load(&expected_names[i]);
+    }
+    printf("node counts: numbers=%ld/%d, names=%ld/%d\n", u64_map_count(&numbers), expected_number_count,
+           name_map_count(&names), expected_name_count);
+    if (u64_map_count(&numbers) != expected_number_count || name_map_count(&names) != expected_name_count) {
+        printf("verification fail: count mismatch\n");
+        return false;
+    }
+
+    int* number_seen = calloc(VALUE_RANGE + 1, sizeof(int));
+    int* name_seen = calloc(VALUE_RANGE + 1, sizeof(int));
+    if (number_seen == NULL || name_seen == NULL) {
+        perror("calloc failed for tallies");
+        return false;
+    }
+    u64_map_for_each(&numbers, tally_number, number_seen);
+    name_map_for_each(&names, tally_name, name_seen);
+
+    bool result = true;
+    for (int i = 0; i <= VALUE_RANGE; i++) {
+        int want_number = i < VALUE_RANGE ? atomic_load(&expected_numbers[i]) : 0;
+        int want_name = i < VALUE_RANGE ? atomic_load(&expected_names[i]) : 0;
+        if (number_seen[i] != want_number || name_seen[i] != want_name) {
+            printf("verification fail: key %d - found %d/%d times, expected %d/%d\n",
+                   i, number_seen[i], name_seen[i], want_number, want_name);
+            result = false;
+        }
+        if (i < VALUE_RANGE && (u64_map_contains(&numbers, number_key(i)) != (want_number == 1) ||
+                                name_map_contains(&names, name_key(i)) != (want_name == 1))) {
+            printf("verification fail: contains(%d) wrong\n", i);
+            result = false;
+        }
+    }
+
+    free(number_seen);
+    free(name_seen);
+    return result;
+}
+
+/**
+ * Uses all 34 spec_ maps once, they have to share pools to fit
+ */
+bool verify_many_types() {
+    bool ok = true;
+    SPEC_CHECK(spec_lf0, 0) SPEC_CHECK(spec_lk0, 0) SPEC_CHECK(spec_lf1, 1) SPEC_CHECK(spec_lk1, 1)
+    SPEC_CHECK(spec_lf2, 2) SPEC_CHECK(spec_lk2, 2) SPEC_CHECK(spec_lf3, 3) SPEC_CHECK(spec_lk3, 3)
+    SPEC_CHECK(spec_lf4, 4) SPEC_CHECK(spec_lk4, 4) SPEC_CHECK(spec_lf5, 5) SPEC_CHECK(spec_lk5, 5)
+    SPEC_CHECK(spec_lf6, 6) SPEC_CHECK(spec_lk6, 6) SPEC_CHECK(spec_lf7, 7) SPEC_CHECK(spec_lk7, 7)
+    SPEC_CHECK(spec_lf8, 8) SPEC_CHECK(spec_lk8, 8) SPEC_CHECK(spec_lf9, 9) SPEC_CHECK(spec_lk9, 9)
+    SPEC_CHECK(spec_lf10, 10) SPEC_CHECK(spec_lk10, 10) SPEC_CHECK(spec_lf11, 11) SPEC_CHECK(spec_lk11, 11)
+    SPEC_CHECK(spec_lf12, 12) SPEC_CHECK(spec_lk12, 12) SPEC_CHECK(spec_lf13, 13) SPEC_CHECK(spec_lk13, 13)
+    SPEC_CHECK(spec_lf14, 14) SPEC_CHECK(spec_lk14, 14) SPEC_CHECK(spec_lf15, 15) SPEC_CHECK(spec_lk15, 15)
+    SPEC_CHECK(spec_lf16, 16) SPEC_CHECK(spec_lk16, 16)
+    if (!ok) {
+        printf("verification fail: many specializations\n");
+    }
+    return ok;
+}
+
+int main() {
+    srand(time(NULL)); // Initialize random seed
+    init_expected_values();
+    u64_map_init(&numbers);
+    name_map_init(&names);
+
+    // Create threads
+    pthread_t threads[NUM_THREADS];
+    ThreadArg thread_args[NUM_THREADS];
+
+    printf("starting %d threads with %d operations each\n", NUM_THREADS, OPERATIONS_PER_THREAD);
+
+    for (int i = 0; i < NUM_THREADS; i++) {
+        thread_args[i].thread_id = i;
+        thread_args[i].seed = rand();
+
+        if (pthread_create(&threads[i], NULL, thread_function, &thread_args[i]) != 0) {
+            perror("thread creation fail");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Wait for all threads to complete
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (pthread_join(threads[i], NULL) != 0) {
+            perror("thread join fail");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("all threads complete\n");
+
+    // Verify integrity
+    bool ok = verify_maps() && verify_many_types();
+    if (ok) {
+        printf("verification pass\n");
+    } else {
+        printf("verification fail\n");
+    }
+
+    // Clean up
+    ebr_drain(); // Deleted nodes are still waiting in limbo
+    u64_map_free(&numbers);
+    name_map_free(&names);
+    pool_destroy_all();
+    free(expected_numbers);
+    free(expected_names);
+
+    return ok ? 0 : 1;
+}
@@ -2,17 +2,23 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <time.h>
 #include <stdbool.h>
 #include <stdatomic.h>
-#include "lock-free.c"
+#ifndef LIST_IMPL
+#define LIST_IMPL "lock-free.c" // -DLIST_IMPL='"hash-set.c"' runs the same test on the hash set
+#endif
+#include LIST_IMPL
 
 #define NUM_THREADS 8
 #define OPERATIONS_PER_THREAD 10000
 #define VALUE_RANGE 1000
+#define BATCH_SIZE 16
+#define TOKEN_BASE (VALUE_RANGE + 2) // Token keys sit above every tracked value
 
-// Global atomic head pointer
-_Atomic(Node*) head = NULL;
+// Global list
+List head;
 
 // Keep track of expected values using atomic operations
 #define BUCKET_SIZE (VALUE_RANGE + 1)
@@ -60,17 +66,12 @@ void add_expected(int value) {
 
 /**
  * Lock free remove value from expected values - 
+ * Only called after a delete succeeded, so it always pairs with an earlier add.
+ * The count can dip below zero for a moment if the delete's tracker update
+ * lands before the insert's, it's right again once both are in.
  */
 void remove_expected(int value) {
-    if (atomic_load(&expected_values[value].used) && 
-        atomic_load(&expected_values[value].count) > 0) {
-        
-        int old_count = atomic_fetch_sub(&expected_values[value].count, 1);
-        
-        if (old_count == 1) {
-            atomic_store(&expected_values[value].used, false);
-        }
-    }
+    atomic_fetch_sub(&expected_values[value].count, 1);
 }
 
 /**
@@ -86,6 +87,153 @@ int get_expected_count() {
     return total;
 }
 
+/**
+ * Pushes a random batch through delete_many(), and insert_many() unless the
+ * list has to stay sorted
+ */
+void run_batch(unsigned int* seed) {
+    int keys[BATCH_SIZE];
+    bool results[BATCH_SIZE];
+    for (int j = 0; j < BATCH_SIZE; j++) {
+        keys[j] = rand_r(seed) % VALUE_RANGE;
+    }
+#ifndef TEST_SORTED
+    if (rand_r(seed) % 2 == 0) {
+        insert_many(&head, keys, BATCH_SIZE);
+        for (int j = 0; j < BATCH_SIZE; j++) {
+            add_expected(keys[j]);
+        }
+        return;
+    }
+#endif
+    delete_many(&head, keys, BATCH_SIZE, results);
+    for (int j = 0; j < BATCH_SIZE; j++) {
+        if (results[j]) {
+            remove_expected(keys[j]);
+        }
+    }
+}
+
+/*
+ * Snapshot check while the threads run
+ *
+ * Every thread owns a token that it keeps moving between two keys of its own,
+ * inserting the new key before deleting the old one, so at any instant at
+ * least one of them is in the list. A snapshot has to show that too. A thread
+ * counts as live between its first insert and its last delete. The thread
+ * also looks up its current key every so often, which has to find it even
+ * while an adaptive list is moving nodes around.
+ *
+ * With TEST_MCAS the token moves with list_replace(), so a snapshot has to
+ * show exactly one.
+ */
+#ifdef TEST_MCAS
+#define TOKENS_SEEN_MAX 1
+#else
+#define TOKENS_SEEN_MAX 2
+#endif
+
+_Atomic bool token_live[NUM_THREADS];
+_Atomic bool token_fail = false;
+
+void token_insert(int key) {
+#ifdef TEST_SORTED
+    insert_sorted(&head, key);
+#else
+    insert_begin(&head, key);
+#endif
+}
+
+void token_delete(int key) {
+#ifdef TEST_SORTED
+    delete_sorted(&head, key);
+#else
+    delete_node(&head, key);
+#endif
+}
+
+bool token_contains(int key) {
+#ifdef TEST_SORTED
+    return contains_sorted(&head, key);
+#else
+    return contains(&head, key);
+#endif
+}
+
+void token_move(int from, int to) {
+#if defined(TEST_MCAS) && defined(TEST_SORTED)
+    list_replace_sorted(&head, from, to);
+#elif defined(TEST_MCAS)
+    list_replace(&head, from, to);
+#else
+    token_insert(to);
+    token_delete(from);
+#endif
+}
+
+#ifdef TEST_MCAS
+/*
+ * Multi-key check
+ *
+ * Threads also move values from the list into a second one and back with
+ * list_move(), tracking both, so at the end each list has to hold exactly
+ * what its tracker says and nothing can have been lost or doubled on the way.
+ */
+List spare;
+_Atomic int spare_counts[BUCKET_SIZE];
+
+/**
+ * Moves value out of the list into spare, or back if back is set
+ */
+void run_move(int value, bool back) {
+    List* src = back ? &spare : &head;
+    List* dst = back ? &head : &spare;
+#ifdef TEST_SORTED
+    bool moved = list_move_sorted(src, dst, value);
+#else
+    bool moved = list_move(src, dst, value);
+#endif
+    if (!moved) {
+        return;
+    }
+    if (back) {
+        atomic_fetch_sub(&spare_counts[value], 1);
+        add_expected(value);
+    } else {
+        remove_expected(value);
+        atomic_fetch_add(&spare_counts[value], 1);
+    }
+}
+#endif
+
+/**
+ * Takes a snapshot and checks every thread live across it shows 1 or 2 tokens
+ */
+void check_tokens() {
+    bool live[NUM_THREADS];
+    int seen[NUM_THREADS] = {0};
+    for (int t = 0; t < NUM_THREADS; t++) {
+        live[t] = atomic_load(&token_live[t]);
+    }
+
+    ListIter it;
+    int data;
+    list_iter_begin(&head, &it, ITER_SNAPSHOT);
+    while (list_iter_next(&it, &data)) {
+        if (data >= TOKEN_BASE && data < TOKEN_BASE + 2 * NUM_THREADS) {
+            seen[(data - TOKEN_BASE) / 2]++;
+        }
+    }
+    list_iter_end(&it);
+
+    for (int t = 0; t < NUM_THREADS; t++) {
+        if (live[t] && atomic_load(&token_live[t]) && (seen[t] < 1 || seen[t] > TOKENS_SEEN_MAX)) {
+            printf("verification fail: snapshot has %d tokens for thread %d\n", seen[t], t);
+            atomic_store(&token_fail, true);
+        }
+    }
+}
+
 /**
  * Thread implementation
  */
@@ -96,11 +244,32 @@ void* thread_function(void* arg) {
     
     printf("Thread %d starting\n", thread_id);
     
+    int token = TOKEN_BASE + 2 * thread_id;
+    token_insert(token);
+    atomic_store(&token_live[thread_id], true);
+
     for (int i = 0; i < OPERATIONS_PER_THREAD; i++) {
         int operation = rand_r(&seed) % 3;
         int value = rand_r(&seed) % VALUE_RANGE;
         
         switch (operation) {
+#ifdef TEST_SORTED
+            case 0: // Insert, only counts if the value wasn't there yet
+                if (insert_sorted(&head, value) != NULL) {
+                    add_expected(value);
+                }
+                break;
+                
+            case 1: // Delete
+                if (delete_sorted(&head, value)) {
+                    remove_expected(value);
+                }
+                break;
+                
+            case 2: // Search
+                contains_sorted(&head, value);
+                break;
+#else
             case 0: // Insert
                 insert_begin(&head, value);
                 add_expected(value);
@@ -115,6 +284,31 @@ void* thread_function(void* arg) {
             case 2: // Search
                 search(&head, value);
                 break;
+#endif
+        }
+        // Every so often push a batch through as well, it races the single-key calls
+        if (i % 100 == 99) {
+            run_batch(&seed);
+        }
+#ifdef TEST_MCAS
+        if (i % 10 == 5) {
+            run_move(value, rand_r(&seed) % 2 == 0);
+        }
+#ifndef TEST_SORTED
+        if (i % 100 == 75 && insert_if_absent(&head, value) != NULL) {
+            add_expected(value);
+        }
+#endif
+#endif
+        if (i % 10 == 0 && !token_contains(token)) { // Only this thread moves it, so it has to be there
+            printf("verification fail: thread %d lost its token\n", thread_id);
+            atomic_store(&token_fail, true);
+        }
+        if (i % 100 == 49) {
+            int moved = token ^ 1; // TOKEN_BASE is even, so this is the other key
+            token_move(token, moved);
+            token = moved;
+            check_tokens();
         }
         
         // Delay to cause thread interleaving
@@ -123,16 +317,57 @@ void* thread_function(void* arg) {
         }
     }
     
+    atomic_store(&token_live[thread_id], false);
+    token_delete(token);
+
     printf("thread %d complete\n", thread_id);
     return NULL;
 }
 
+/**
+ * Running state for tally_value()
+ */
+typedef struct {
+    int* counts;
+    int last;
+    bool ok;
+} TallyState;
+
+/**
+ * Counts one occurrence of data, snapshots come out ascending
+ */
+void tally_value(int data, TallyState* state) {
+    if (!state->ok) {
+        return;
+    }
+#ifdef TEST_SORTED
+    if (data <= state->last) {
+        printf("verification fail: %d after %d, list out of order\n", data, state->last);
+        state->ok = false;
+        return;
+    }
+#endif
+    state->last = data;
+    if (data >= 0 && data < BUCKET_SIZE) {
+        state->counts[data]++;
+    } else {
+        printf("verification fail: value %d out of expected range\n", data);
+        state->ok = false;
+    }
+}
+
 /**
  * Verification function to check list integrity
  */
 bool verify_list() {
     printf("verifying integrity...\n");
     
+    // The sharded counters have to agree with a real walk
+    if (!validate_size(&head)) {
+        printf("verification fail: size counters off\n");
+        return false;
+    }
+
     int actual_count = count_nodes(&head); // Count actual nodes in list
     int expected_count = get_expected_count(); // Get expected count from tracker
 
@@ -150,18 +385,17 @@ bool verify_list() {
         return false;
     }
     
-    Node* current = atomic_load(&head);
-    while (current != NULL) {
-        if (!atomic_load(&current->marked)) {
-            if (current->data >= 0 && current->data < BUCKET_SIZE) {
-                list_counts[current->data]++;
-            } else {
-                printf("verification fail: value %d out of expected range\n", current->data);
-                free(list_counts);
-                return false;
-            }
-        }
-        current = atomic_load(&current->next);
+    TallyState tally = { list_counts, -1, true };
+    ListIter it;
+    int data;
+    list_iter_begin(&head, &it, ITER_SNAPSHOT);
+    while (list_iter_next(&it, &data)) {
+        tally_value(data, &tally);
+    }
+    list_iter_end(&it);
+    if (!tally.ok) {
+        free(list_counts);
+        return false;
     }
     
     // Compare with expected
@@ -180,10 +414,313 @@ bool verify_list() {
     return result;
 }
 
+#ifdef TEST_SORTED
+/**
+ * Range callback, just counts
+ */
+void count_value(int data, void* arg) {
+    (void)data;
+    (*(int*)arg)++;
+}
+
+/**
+ * Checks range_scan/range_delete against the expected values
+ */
+bool verify_ranges() {
+    int lo = VALUE_RANGE / 4;
+    int hi = VALUE_RANGE / 2;
+    int expected = 0;
+    for (int i = lo; i <= hi; i++) {
+        expected += atomic_load(&expected_values[i].count);
+    }
+
+    int seen = 0;
+    int scanned = range_scan(&head, lo, hi, count_value, &seen);
+    printf("range [%d, %d]: scanned=%d, expected=%d\n", lo, hi, scanned, expected);
+    if (scanned != expected || seen != expected) {
+        printf("verification fail: range scan mismatch\n");
+        return false;
+    }
+
+    int before = count_nodes(&head);
+    int deleted = range_delete(&head, lo, hi);
+    int after = count_nodes(&head);
+    Node* next = lower_bound(&head, lo);
+    if (deleted != expected || before - after != expected || (next != NULL && next->data <= hi)) {
+        printf("verification fail: range delete removed %d, expected %d\n", deleted, expected);
+        return false;
+    }
+    return true;
+}
+#endif
+
+/**
+ * Looks up every value with one contains_many() and checks it against the expected values
+ */
+bool verify_batches() {
+    int keys[VALUE_RANGE];
+    bool found[VALUE_RANGE];
+    for (int i = 0; i < VALUE_RANGE; i++) {
+        keys[i] = VALUE_RANGE - 1 - i; // Backwards so the sort has something to do
+    }
+
+    int hits = contains_many(&head, keys, VALUE_RANGE, found);
+    int expected_hits = 0;
+    for (int i = 0; i < VALUE_RANGE; i++) {
+        bool expected = atomic_load(&expected_values[keys[i]].count) > 0;
+        expected_hits += expected;
+        if (found[i] != expected) {
+            printf("verification fail: contains_many says %d is%s there\n", keys[i], found[i] ? "" : " not");
+            return false;
+        }
+    }
+    if (hits != expected_hits) {
+        printf("verification fail: contains_many found %d, expected %d\n", hits, expected_hits);
+        return false;
+    }
+
+#ifndef TEST_SORTED // insert_many() prepends, which would break the sorted list
+    // Put every value in once more and take those copies back out
+    int before = count_nodes(&head);
+    insert_many(&head, keys, VALUE_RANGE);
+    int deleted = delete_many(&head, keys, VALUE_RANGE, found);
+    if (deleted != VALUE_RANGE || count_nodes(&head) != before || !validate_size(&head)) {
+        printf("verification fail: delete_many took back %d of %d\n", deleted, VALUE_RANGE);
+        return false;
+    }
+#endif
+    return true;
+}
+
+#ifdef TEST_MCAS
+#ifdef TEST_SORTED
+#define replace_value list_replace_sorted
+#define move_value list_move_sorted
+#define delete_value delete_sorted
+#else
+#define replace_value list_replace
+#define move_value list_move
+#define delete_value try_delete
+#endif
+
+/**
+ * Checks spare against its tracker, then walks one key through every call
+ * on the quiet list, including the ones that have to fail
+ */
+bool verify_mcas() {
+    int* counts = calloc(BUCKET_SIZE, sizeof(int));
+    if (counts == NULL) {
+        perror("calloc failed for counts");
+        return false;
+    }
+    TallyState tally = { counts, -1, true };
+    ListIter it;
+    int data;
+    list_iter_begin(&spare, &it, ITER_SNAPSHOT);
+    while (list_iter_next(&it, &data)) {
+        tally_value(data, &tally);
+    }
+    list_iter_end(&it);
+    bool ok = tally.ok && validate_size(&spare);
+    for (int i = 0; i < BUCKET_SIZE && ok; i++) {
+        if (counts[i] != atomic_load(&spare_counts[i])) {
+            printf("verification fail: spare has %d %d times, expected %d\n", i, counts[i], atomic_load(&spare_counts[i]));
+            ok = false;
+        }
+    }
+    free(counts);
+
+    int present = -1;
+    for (int i = 0; i < VALUE_RANGE && present < 0; i++) {
+        if (atomic_load(&expected_values[i].count) > 0) {
+            present = i;
+        }
+    }
+    int key = VALUE_RANGE; // Nothing else puts this one in
+    int other = TOKEN_BASE + 2 * NUM_THREADS; // Above every token
+    int before = count_nodes(&head);
+    ok = ok && present >= 0 && !move_value(&head, &spare, key) && !replace_value(&head, key, other);
+#ifdef TEST_SORTED
+    ok = ok && insert_sorted(&head, key) != NULL;
+#else
+    ok = ok && insert_if_absent(&head, key) != NULL && insert_if_absent(&head, key) == NULL;
+#endif
+    ok = ok && !replace_value(&head, key, present) && replace_value(&head, key, other);
+    ok = ok && !token_contains(key) && token_contains(other);
+    ok = ok && move_value(&head, &spare, other) && !token_contains(other) && !move_value(&head, &spare, other);
+    ok = ok && move_value(&spare, &head, other) && delete_value(&head, other);
+    ok = ok && count_nodes(&head) == before && validate_size(&head);
+    if (!ok) {
+        printf("verification fail: multi-key calls\n");
+    }
+    return ok;
+}
+#endif
+
+#ifndef LOCK_FREE_CORE_ONLY // hash-set.c has no images or bulk loads
+/**
+ * Whether two lists hold the same values right now
+ */
+bool same_values(List* a, List* b) {
+    ListIter x, y;
+    int dx, dy;
+    bool same = true;
+    list_iter_begin(a, &x, ITER_SNAPSHOT);
+    list_iter_begin(b, &y, ITER_SNAPSHOT);
+    while (same) {
+        bool more = list_iter_next(&x, &dx);
+        if (more != list_iter_next(&y, &dy)) {
+            same = false;
+        } else if (!more) {
+            break;
+        } else {
+            same = dx == dy;
+        }
+    }
+    list_iter_end(&x);
+    list_iter_end(&y);
+    return same;
+}
+
+/**
+ * Saves the list, maps it back in and checks the copy reads the same,
+ * then that the first write promotes it without losing anything
+ */
+bool verify_image() {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/list-image-%d", (int)getpid());
+    if (!list_save(&head, path)) {
+        printf("verification fail: list_save\n");
+        return false;
+    }
+    List copy;
+    bool opened = list_open_mmap(&copy, path);
+    unlink(path); // The mapping keeps the data
+    if (!opened) {
+        printf("verification fail: list_open_mmap\n");
+        return false;
+    }
+
+    int keys[VALUE_RANGE];
+    bool found[VALUE_RANGE];
+    for (int i = 0; i < VALUE_RANGE; i++) {
+        keys[i] = i;
+    }
+    contains_many(&copy, keys, VALUE_RANGE, found);
+    for (int i = 0; i < VALUE_RANGE; i++) {
+        if (found[i] != (atomic_load(&expected_values[i].count) > 0)) {
+            printf("verification fail: mapped image says %d is%s there\n", i, found[i] ? "" : " not");
+            free_list(&copy);
+            return false;
+        }
+    }
+    bool ok = same_values(&head, &copy) && validate_size(&copy);
+
+    // First write builds the nodes, after which it's an ordinary list
+#ifdef TEST_SORTED
+    ok = ok && insert_sorted(&copy, VALUE_RANGE) != NULL && delete_sorted(&copy, VALUE_RANGE);
+#else
+    insert_begin(&copy, VALUE_RANGE);
+    ok = ok && try_delete(&copy, VALUE_RANGE);
+#endif
+    ok = ok && same_values(&head, &copy) && validate_size(&copy) && count_nodes(&copy) == count_nodes(&head);
+    if (!ok) {
+        printf("verification fail: mapped image doesn't match the list\n");
+    }
+    free_list(&copy);
+    return ok;
+}
+
+/**
+ * Bulk loads every even value from an array and from a file and checks both,
+ * then that input out of order gets turned down
+ */
+bool verify_bulk_load() {
+    int n = VALUE_RANGE / 2;
+    int keys[VALUE_RANGE / 2];
+    for (int i = 0; i < n; i++) {
+        keys[i] = i * 2;
+    }
+    List loaded, streamed, rejected;
+    bool ok = list_bulk_load(&loaded, keys, n);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/list-keys-%d", (int)getpid());
+    FILE* file = fopen(path, "wb");
+    ok = ok && file != NULL && fwrite(keys, sizeof(int), n, file) == (size_t)n;
+    if (file != NULL) {
+        fclose(file);
+    }
+    int fd = open(path, O_RDONLY);
+    ok = ok && list_bulk_load_fd(&streamed, fd, n);
+    close(fd);
+    unlink(path);
+
+    int probe[VALUE_RANGE];
+    bool found[VALUE_RANGE];
+    for (int i = 0; i < VALUE_RANGE; i++) {
+        probe[i] = i;
+    }
+    ok = ok && contains_many(&loaded, probe, VALUE_RANGE, found) == n;
+    for (int i = 0; i < VALUE_RANGE && ok; i++) {
+        ok = found[i] == (i % 2 == 0);
+    }
+    ok = ok && same_values(&loaded, &streamed) && count_nodes(&loaded) == n && validate_size(&loaded);
+#ifdef TEST_SORTED
+    ok = ok && insert_sorted(&loaded, 1) != NULL && contains_sorted(&loaded, 1);
+#else
+    ok = ok && insert_begin(&loaded, 1) != NULL && contains(&loaded, 1);
+#endif
+
+    keys[0] = VALUE_RANGE; // Out of order now
+    ok = ok && !list_bulk_load(&rejected, keys, n) && count_nodes(&rejected) == 0;
+    if (!ok) {
+        printf("verification fail: bulk load\n");
+    }
+    free_list(&loaded);
+    free_list(&streamed);
+    free_list(&rejected);
+    return ok;
+}
+#endif
+
+/**
+ * Snapshots a list that never had anything in it, plain and versioned
+ */
+bool verify_empty() {
+    static List empty; // hash-set.c's free_list() sets it up again, this keeps that reachable
+    list_init(&empty);
+    bool ok = true;
+    for (int versioned = 0; versioned < 2; versioned++) {
+        list_set_versioned(&empty, versioned); // Still empty, free_list() leaves it that way
+        ListIter it;
+        int data;
+        list_iter_begin(&empty, &it, ITER_SNAPSHOT);
+        ok = ok && it.count == 0 && !list_iter_next(&it, &data);
+        list_iter_end(&it);
+        free_list(&empty);
+    }
+    if (!ok) {
+        printf("verification fail: snapshot of an empty list\n");
+    }
+    return ok;
+}
+
 int main() {
     srand(time(NULL)); // Initialize random seed
     init_expected_values(); // Initialize expected values array
-    atomic_init(&head, NULL); // Initialize atomic head
+    list_init(&head);
+    list_set_versioned(&head, true); // Snapshots get checked while the threads write
+#ifdef TEST_MCAS
+    list_init(&spare);
+    list_set_versioned(&spare, true);
+#endif
+#ifdef TEST_ADAPTIVE
+    list_set_adaptive(&head, true); // Lookups reorder the list under everything else
+#endif
+#ifdef TEST_FILTER
+    list_set_filter(&head, VALUE_RANGE, 0.01); // Every insert and delete keeps it in step
+#endif
     
     // Create threads
     pthread_t threads[NUM_THREADS];
@@ -215,16 +752,36 @@ int main() {
     printf("Final ");
     print_list(&head);
     
+#ifdef LIST_STATS
+    ListStats stats = list_stats_snapshot(); // make STATS=1
+    list_stats_print(&stats);
+#endif
+
     // Verify integrity
-    if (verify_list()) {
+    bool ok = !atomic_load(&token_fail) && verify_list() && verify_batches() && verify_empty();
+#ifdef TEST_MCAS
+    ok = ok && verify_mcas();
+#endif
+#ifndef LOCK_FREE_CORE_ONLY
+    ok = ok && verify_image() && verify_bulk_load();
+#endif
+#ifdef TEST_SORTED
+    ok = ok && verify_ranges(); // Last, it deletes behind the tracker's back
+#endif
+    if (ok) {
         printf("verification pass\n");
     } else {
         printf("verification fail\n");
     }
     
     // Clean up
+    ebr_drain(); // Nodes deleted during the run are still waiting in limbo
     free_list(&head);
+#ifdef TEST_MCAS
+    free_list(&spare);
+#endif
+    pool_destroy_all();
     free(expected_values);
     
-    return 0;
+    return ok ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "queue.c"
+
+#define NUM_PRODUCERS 4
+#define NUM_CONSUMERS 4
+#define ITEMS_PER_PRODUCER 20000
+#define TOTAL_ITEMS (NUM_PRODUCERS * ITEMS_PER_PRODUCER)
+#define BATCH_SIZE 16
+
+Queue queue; // Global queue
+
+// Each value is producer * ITEMS_PER_PRODUCER + sequence, so it says who sent it and when
+_Atomic int* seen_count;
+_Atomic int consumed = 0;
+_Atomic bool order_fail = false;
+
+/**
+ * Thread struct
+ */
+typedef struct {
+    int thread_id;
+    int seed;
+} ThreadArg;
+
+/**
+ * Producer, enqueues its sequence in order
+ */
+void* producer_function(void* arg) {
+    ThreadArg* thread_arg = (ThreadArg*)arg;
+    int thread_id = thread_arg->thread_id;
+    unsigned int seed = thread_arg->seed;
+
+    printf("producer %d starting\n", thread_id);
+    for (int i = 0; i < ITEMS_PER_PRODUCER; i++) {
+        enqueue(&queue, thread_id * ITEMS_PER_PRODUCER + i);
+
+        // Delay to cause thread interleaving
+        if (rand_r(&seed) % 100 == 0) {
+            usleep(1);
+        }
+    }
+    printf("producer %d complete\n", thread_id);
+    return NULL;
+}
+
+/**
+ * Records one dequeued value, every producer's values have to come out in order
+ */
+void take(int value, int* last) {
+    if (value < 0 || value >= TOTAL_ITEMS) {
+        printf("verification fail: dequeued %d, never enqueued\n", value);
+        atomic_store(&order_fail, true);
+        return;
+    }
+    int producer = value / ITEMS_PER_PRODUCER;
+    if (value <= last[producer]) {
+        printf("verification fail: %d came out after %d\n", value, last[producer]);
+        atomic_store(&order_fail, true);
+    }
+    last[producer] = value;
+    atomic_fetch_add(&seen_count[value], 1);
+}
+
+/**
+ * Consumer, mixes single and batch dequeues until everything is out
+ */
+void* consumer_function(void* arg) {
+    ThreadArg* thread_arg = (ThreadArg*)arg;
+    int thread_id = thread_arg->thread_id;
+    unsigned int seed = thread_arg->seed;
+    int last[NUM_PRODUCERS];
+    for (int p = 0; p < NUM_PRODUCERS; p++) {
+        last[p] = -1;
+    }
+
+    printf("consumer %d starting\n", thread_id);
+    while (atomic_load(&consumed) < TOTAL_ITEMS) {
+        int values[BATCH_SIZE];
+        int n;
+        if (rand_r(&seed) % 2 == 0) {
+            n = try_dequeue(&queue, &values[0]) ? 1 : 0;
+        } else {
+            n = dequeue_batch(&queue, values, 1 + rand_r(&seed) % BATCH_SIZE);
+        }
+        for (int i = 0; i < n; i++) {
+            take(values[i], last);
+        }
+        atomic_fetch_add(&consumed, n);
+        if (n == 0) {
+            sched_yield(); // Producers are behind
+        }
+    }
+    printf("consumer %d complete\n", thread_id);
+    return NULL;
+}
+
+/**
+ * Blocks in dequeue() on an empty queue until main enqueues something
+ */
+void* waiter_function(void* arg) {
+    *(int*)arg = dequeue(&queue);
+    return NULL;
+}
+
+/**
+ * Verification function to check every value came out exactly once
+ * and the queue is empty and still works afterwards
+ */
+bool verify_queue() {
+    printf("verifying integrity...\n");
+    if (atomic_load(&order_fail)) {
+        return false;
+    }
+    for (int i = 0; i < TOTAL_ITEMS; i++) {
+        if (atomic_load(&seen_count[i]) != 1) {
+            printf("verification fail: %d dequeued %d times\n", i, atomic_load(&seen_count[i]));
+            return false;
+        }
+    }
+    int data;
+    if (try_dequeue(&queue, &data) || queue_peek(&queue, &data)) {
+        printf("verification fail: queue not empty at the end\n");
+        return false;
+    }
+
+    pthread_t waiter;
+    int got = -1;
+    if (pthread_create(&waiter, NULL, waiter_function, &got) != 0) {
+        perror("thread creation fail");
+        exit(EXIT_FAILURE);
+    }
+    usleep(1000);
+    enqueue(&queue, 7);
+    pthread_join(waiter, NULL);
+    if (got != 7) {
+        printf("verification fail: blocked dequeue got %d\n", got);
+        return false;
+    }
+
+    enqueue(&queue, 1);
+    enqueue(&queue, 2);
+    enqueue(&queue, 3);
+    int values[BATCH_SIZE];
+    bool peeked = queue_peek(&queue, &data) && data == 1;
+    int n = dequeue_batch(&queue, values, BATCH_SIZE);
+    if (!peeked || n != 3 || values[0] != 1 || values[1] != 2 || values[2] != 3) {
+        printf("verification fail: batch came out wrong\n");
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    srand(time(NULL)); // Initialize random seed
+    seen_count = calloc(TOTAL_ITEMS, sizeof(_Atomic int));
+    if (seen_count == NULL) {
+        perror("calloc failed for seen_count");
+        exit(EXIT_FAILURE);
+    }
+    queue_init(&queue);
+
+    pthread_t threads[NUM_PRODUCERS + NUM_CONSUMERS];
+    ThreadArg thread_args[NUM_PRODUCERS + NUM_CONSUMERS];
+
+    printf("starting %d producers with %d items each and %d consumers\n",
+           NUM_PRODUCERS, ITEMS_PER_PRODUCER, NUM_CONSUMERS);
+
+    for (int i = 0; i < NUM_PRODUCERS + NUM_CONSUMERS; i++) {
+        bool producer = i < NUM_PRODUCERS;
+        thread_args[i].thread_id = producer ? i : i - NUM_PRODUCERS;
+        thread_args[i].seed = rand();
+
+        if (pthread_create(&threads[i], NULL, producer ? producer_function : consumer_function,
+                           &thread_args[i]) != 0) {
+            perror("thread creation fail");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Wait for all threads to complete
+    for (int i = 0; i < NUM_PRODUCERS + NUM_CONSUMERS; i++) {
+        if (pthread_join(threads[i], NULL) != 0) {
+            perror("thread join fail");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("all threads complete\n");
+
+    // Verify integrity
+    bool ok = verify_queue();
+    if (ok) {
+        printf("verification pass\n");
+    } else {
+        printf("verification fail\n");
+    }
+
+    // Clean up
+    ebr_drain(); // Old dummies are still waiting in limbo
+    queue_free(&queue);
+    pool_destroy_all();
+    free(seen_count);
+
+    return ok ? 0 : 1;
+}
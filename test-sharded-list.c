@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "sharded-list.c"
+
+#define NUM_THREADS 8
+#define OPERATIONS_PER_THREAD 10000
+#define VALUE_RANGE 1000
+#define RANGE_SHARDS 8 // Fixed so the range run splits keys even on one core
+
+ShardedList list; // Global sharded list
+
+// Copies of each value there should be, insert_begin keeps duplicates while the sorted calls keep a set
+#define BUCKET_SIZE (VALUE_RANGE + 1)
+_Atomic int* expected_values;
+
+/**
+ * Thread struct
+ */
+typedef struct {
+    int thread_id;
+    int seed;
+    bool sorted;
+} ThreadArg;
+
+/**
+ * Initialize the expected values array
+ */
+void init_expected_values() {
+    expected_values = calloc(BUCKET_SIZE, sizeof(_Atomic int));
+    if (expected_values == NULL) {
+        perror("calloc failed for expected_values");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        atomic_init(&expected_values[i], 0);
+    }
+}
+
+/**
+ * Thread implementation
+ */
+void* thread_function(void* arg) {
+    ThreadArg* thread_arg = (ThreadArg*)arg;
+    int thread_id = thread_arg->thread_id;
+    unsigned int seed = thread_arg->seed;
+
+    printf("Thread %d starting\n", thread_id);
+
+    for (int i = 0; i < OPERATIONS_PER_THREAD; i++) {
+        int operation = rand_r(&seed) % 3;
+        int value = rand_r(&seed) % VALUE_RANGE;
+
+        switch (operation) {
+            case 0: // Insert
+                if (!thread_arg->sorted) {
+                    sharded_insert(&list, value);
+                    atomic_fetch_add(&expected_values[value], 1);
+                } else if (sharded_insert_sorted(&list, value) != NULL) {
+                    atomic_fetch_add(&expected_values[value], 1);
+                }
+                break;
+
+            case 1: // Delete
+                if (thread_arg->sorted ? sharded_delete_sorted(&list, value) : sharded_delete(&list, value)) {
+                    atomic_fetch_sub(&expected_values[value], 1);
+                }
+                break;
+
+            case 2: // Search
+                if (thread_arg->sorted) {
+                    sharded_contains_sorted(&list, value);
+                } else {
+                    sharded_contains(&list, value);
+                }
+                break;
+        }
+
+        // Delay to cause thread interleaving
+        if (rand_r(&seed) % 100 == 0) {
+            usleep(1);
+        }
+    }
+
+    printf("thread %d complete\n", thread_id);
+    return NULL;
+}
+
+/**
+ * for_each callback, tallies values and checks each one sits in the shard that owns it
+ */
+typedef struct {
+    int shard;
+    int last;       // Range mode: values have to keep rising across shards
+    bool sorted;
+    bool misplaced;
+    int* seen;
+} Tally;
+
+void tally_value(int data, void* arg) {
+    Tally* tally = (Tally*)arg;
+    if (data < 0 || data >= VALUE_RANGE || shard_index(&list, data) != tally->shard ||
+        (tally->sorted && data <= tally->last)) {
+        tally->misplaced = true;
+        return;
+    }
+    tally->last = data;
+    tally->seen[data]++;
+}
+
+/**
+ * Verification function to check list integrity
+ * Every shard has to hold only its own keys, the counts summed over the
+ * shards have to match what the threads did, and in range mode the shards
+ * read in order have to come out ascending
+ */
+bool verify_list(bool sorted) {
+    printf("verifying integrity...\n");
+
+    int actual_count = sharded_count_nodes(&list);
+    int expected_count = 0;
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        expected_count += atomic_load(&expected_values[i]);
+    }
+
+    printf("node counts: actual=%d, expected=%d over %d shards\n", actual_count, expected_count, list.count);
+    if (actual_count != expected_count) {
+        printf("verification fail: count mismatch\n");
+        return false;
+    }
+    if (!sharded_validate_size(&list)) {
+        printf("verification fail: shard size counters off\n");
+        return false;
+    }
+
+    Tally tally = { 0, -1, sorted, false, calloc(VALUE_RANGE, sizeof(int)) };
+    if (tally.seen == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    for (tally.shard = 0; tally.shard < list.count; tally.shard++) {
+        list_for_each(&list.shards[tally.shard].list, tally_value, &tally);
+    }
+    bool ok = !tally.misplaced;
+    if (!ok) {
+        printf("verification fail: value in the wrong shard or out of order\n");
+    }
+    for (int i = 0; i < VALUE_RANGE && ok; i++) {
+        if (tally.seen[i] != atomic_load(&expected_values[i])) {
+            printf("verification fail: %d found %d times, expected %d\n", i, tally.seen[i],
+                   atomic_load(&expected_values[i]));
+            ok = false;
+        }
+        if (ok && (sorted ? sharded_contains_sorted(&list, i) : sharded_contains(&list, i)) != (tally.seen[i] > 0)) {
+            printf("verification fail: contains(%d) wrong\n", i);
+            ok = false;
+        }
+    }
+    free(tally.seen);
+
+    return ok;
+}
+
+/**
+ * One full run: fresh list, threads, verify, free
+ */
+bool run(const char* name, ShardMode mode, int shards, bool sorted) {
+    printf("%s sharding\n", name);
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        atomic_store(&expected_values[i], 0);
+    }
+    sharded_init(&list, mode, shards, 0, VALUE_RANGE - 1);
+
+    // Create threads
+    pthread_t threads[NUM_THREADS];
+    ThreadArg thread_args[NUM_THREADS];
+
+    printf("starting %d threads with %d operations each\n", NUM_THREADS, OPERATIONS_PER_THREAD);
+
+    for (int i = 0; i < NUM_THREADS; i++) {
+        thread_args[i].thread_id = i;
+        thread_args[i].seed = rand();
+        thread_args[i].sorted = sorted;
+
+        if (pthread_create(&threads[i], NULL, thread_function, &thread_args[i]) != 0) {
+            perror("thread creation fail");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Wait for all threads to complete
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (pthread_join(threads[i], NULL) != 0) {
+            perror("thread join fail");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("all threads complete\n");
+
+    bool ok = verify_list(sorted);
+
+    // Clean up
+    ebr_drain(); // Nodes deleted during the run are still waiting in limbo
+    sharded_free(&list);
+    return ok;
+}
+
+int main() {
+    srand(time(NULL)); // Initialize random seed
+    init_expected_values(); // Initialize expected values array
+
+    // Hash sharding with one shard per core, then range sharding kept sorted
+    bool ok = run("hash", SHARD_HASH, 0, false) && run("range", SHARD_RANGE, RANGE_SHARDS, true);
+
+    if (ok) {
+        printf("verification pass\n");
+    } else {
+        printf("verification fail\n");
+    }
+
+    pool_destroy_all(); // Both runs freed their lists
+    free(expected_values);
+
+    return ok ? 0 : 1;
+}
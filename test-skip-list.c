@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "skip-list.c"
+
+#define NUM_THREADS 8
+#define OPERATIONS_PER_THREAD 10000
+#define VALUE_RANGE 1000
+
+SkipList list; // Global skip list
+
+// Keep track of expected values using atomic operations, 0 or 1 each since it's a set
+#define BUCKET_SIZE (VALUE_RANGE + 1)
+_Atomic int* expected_values;
+
+/**
+ * Thread struct
+ */
+typedef struct {
+    int thread_id;
+    int seed;
+} ThreadArg;
+
+/**
+ * Initialize the expected values array
+ */
+void init_expected_values() {
+    expected_values = calloc(BUCKET_SIZE, sizeof(_Atomic int));
+    if (expected_values == NULL) {
+        perror("calloc failed for expected_values");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        atomic_init(&expected_values[i], 0);
+    }
+}
+
+/**
+ * Thread implementation
+ */
+void* thread_function(void* arg) {
+    ThreadArg* thread_arg = (ThreadArg*)arg;
+    int thread_id = thread_arg->thread_id;
+    unsigned int seed = thread_arg->seed;
+
+    printf("Thread %d starting\n", thread_id);
+
+    for (int i = 0; i < OPERATIONS_PER_THREAD; i++) {
+        int operation = rand_r(&seed) % 3;
+        int value = rand_r(&seed) % VALUE_RANGE;
+
+        switch (operation) {
+            case 0: // Insert, only counts if the value wasn't there yet
+                if (insert(&list, value)) {
+                    atomic_fetch_add(&expected_values[value], 1);
+                }
+                break;
+
+            case 1: // Delete
+                if (delete_node(&list, value)) {
+                    atomic_fetch_sub(&expected_values[value], 1);
+                }
+                break;
+
+            case 2: // Search
+                contains(&list, value);
+                break;
+        }
+
+        // Delay to cause thread interleaving
+        if (rand_r(&seed) % 100 == 0) {
+            usleep(1);
+        }
+    }
+
+    printf("thread %d complete\n", thread_id);
+    return NULL;
+}
+
+/**
+ * Verification function to check list integrity
+ * Level 0 has to match the expected set, every level above has to be
+ * sorted and only hold nodes that are live on level 0
+ */
+bool verify_list() {
+    printf("verifying integrity...\n");
+
+    int actual_count = count_nodes(&list);
+    int expected_count = 0;
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        expected_count += atomic_load(&expected_values[i]);
+    }
+
+    printf("node counts: actual=%d, expected=%d\n", actual_count, expected_count);
+    if (actual_count != expected_count) {
+        printf("verification fail: count mismatch\n");
+        return false;
+    }
+
+    for (int level = 0; level < SKIP_MAX_LEVEL; level++) {
+        int last = -1;
+        SkipNode* cur = atomic_load(&list.head[level]);
+        while (cur != NULL) {
+            SkipNode* succ = atomic_load(&cur->next[level]);
+            if (is_marked(succ)) {
+                printf("verification fail: deleted node %d still on level %d\n", cur->data, level);
+                return false;
+            }
+            if (cur->data <= last || cur->data < 0 || cur->data >= VALUE_RANGE) {
+                printf("verification fail: level %d has %d after %d\n", level, cur->data, last);
+                return false;
+            }
+            if (atomic_load(&expected_values[cur->data]) != 1 || cur->level <= level) {
+                printf("verification fail: level %d has unexpected node %d\n", level, cur->data);
+                return false;
+            }
+            last = cur->data;
+            cur = succ;
+        }
+    }
+
+    for (int i = 0; i < VALUE_RANGE; i++) {
+        if (contains(&list, i) != (atomic_load(&expected_values[i]) == 1)) {
+            printf("verification fail: contains(%d) wrong\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    srand(time(NULL)); // Initialize random seed
+    init_expected_values(); // Initialize expected values array
+    skip_list_init(&list);
+
+    // Create threads
+    pthread_t threads[NUM_THREADS];
+    ThreadArg thread_args[NUM_THREADS];
+
+    printf("starting %d threads with %d operations each\n", NUM_THREADS, OPERATIONS_PER_THREAD);
+
+    for (int i = 0; i < NUM_THREADS; i++) {
+        thread_args[i].thread_id = i;
+        thread_args[i].seed = rand();
+
+        if (pthread_create(&threads[i], NULL, thread_function, &thread_args[i]) != 0) {
+            perror("thread creation fail");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Wait for all threads to complete
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (pthread_join(threads[i], NULL) != 0) {
+            perror("thread join fail");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("all threads complete\n");
+
+    // Verify integrity
+    bool ok = verify_list();
+    if (ok) {
+        printf("verification pass\n");
+    } else {
+        printf("verification fail\n");
+    }
+
+    // Clean up
+    ebr_drain(); // Nodes deleted during the run are still waiting in limbo
+    free_list(&list);
+    pool_destroy_all();
+    free(expected_values);
+
+    return ok ? 0 : 1;
+}
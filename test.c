@@ -2,15 +2,26 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <time.h>
 #include <stdbool.h>
-#include "linked-list.c"
+#define ANCHOR_GAP 16 // linked-list.c: small enough that test-sized lists get split for parallel passes
+#ifndef LIST_IMPL
+#define LIST_IMPL "linked-list.c" // -DLIST_IMPL='"unrolled-list.c"' runs the same test on another list
+#endif
+#include LIST_IMPL
+
+#ifndef LIST_MODE
+#define LIST_MODE LIST_RWLOCK // -DLIST_MODE=LIST_LAZY etc. runs the same test on the other modes
+#endif
 
 #define NUM_THREADS 4
 #define OPERATIONS_PER_THREAD 1000
 #define VALUE_RANGE 1000
+#define BATCH_SIZE 16
+#define TOKEN_BASE (VALUE_RANGE + 2) // Token keys sit above every tracked value
 
-Node* head = NULL; // Global head pointer
+List list; // Global list
 
 // Better tracking of expected values - use a simple hash table
 #define BUCKET_SIZE (VALUE_RANGE + 1)
@@ -55,15 +66,13 @@ void add_expected(int value) {
 
 /**
  * Remove value from expected values
+ * Only called after a delete succeeded, so it always pairs with an earlier add.
+ * The count can dip below zero for a moment if the delete's tracker update
+ * lands before the insert's, it's right again once both are in.
  */
 void remove_expected(int value) {
     pthread_mutex_lock(&expected_mutex);
-    if (expected_values[value].used && expected_values[value].count > 0) {
-        expected_values[value].count--;
-        if (expected_values[value].count == 0) {
-            expected_values[value].used = false;
-        }
-    }
+    expected_values[value].count--;
     pthread_mutex_unlock(&expected_mutex);
 }
 
@@ -82,6 +91,94 @@ int get_expected_count() {
     return total;
 }
 
+/**
+ * Pushes a random batch through insert_many()/delete_many()
+ */
+void run_batch(unsigned int* seed) {
+    int keys[BATCH_SIZE];
+    bool results[BATCH_SIZE];
+    for (int j = 0; j < BATCH_SIZE; j++) {
+        keys[j] = rand_r(seed) % VALUE_RANGE;
+    }
+    if (rand_r(seed) % 2 == 0) {
+        insert_many(&list, keys, BATCH_SIZE);
+        for (int j = 0; j < BATCH_SIZE; j++) {
+            add_expected(keys[j]);
+        }
+    } else {
+        delete_many(&list, keys, BATCH_SIZE, results);
+        for (int j = 0; j < BATCH_SIZE; j++) {
+            if (results[j]) {
+                remove_expected(keys[j]);
+            }
+        }
+    }
+}
+
+/*
+ * Snapshot check while the threads run
+ *
+ * Every thread owns a token that it keeps moving between two keys of its own,
+ * inserting the new key before deleting the old one, so a snapshot must
+ * always show at least one of them while the thread is live. The thread
+ * also looks up its current key every so often, which has to find it even
+ * while an adaptive list is moving nodes around.
+ */
+_Atomic bool token_live[NUM_THREADS];
+_Atomic bool token_fail = false;
+
+/**
+ * Takes a snapshot and checks every thread live across it shows 1 or 2 tokens
+ */
+void check_tokens() {
+    bool live[NUM_THREADS];
+    int seen[NUM_THREADS] = {0};
+    for (int t = 0; t < NUM_THREADS; t++) {
+        live[t] = atomic_load(&token_live[t]);
+    }
+
+    ListIter it;
+    int data;
+    list_iter_begin(&list, &it, ITER_SNAPSHOT);
+    while (list_iter_next(&it, &data)) {
+        if (data >= TOKEN_BASE && data < TOKEN_BASE + 2 * NUM_THREADS) {
+            seen[(data - TOKEN_BASE) / 2]++;
+        }
+    }
+    list_iter_end(&it);
+
+    for (int t = 0; t < NUM_THREADS; t++) {
+        if (live[t] && atomic_load(&token_live[t]) && (seen[t] < 1 || seen[t] > 2)) {
+            printf("verification fail: snapshot has %d tokens for thread %d\n", seen[t], t);
+            atomic_store(&token_fail, true);
+        }
+    }
+}
+
+#ifdef LIST_IMAGE_C // unrolled-list.c has no parallel passes
+/**
+ * Parallel map callback, 1 per node, flags values nobody ever inserted
+ */
+long map_checked(int data, void* arg) {
+    (void)arg;
+    if (data < 0 || data >= TOKEN_BASE + 2 * NUM_THREADS) {
+        printf("verification fail: parallel pass saw %d\n", data);
+        atomic_store(&token_fail, true);
+    }
+    return 1;
+}
+
+/**
+ * Parallel pass while the other threads write, has to see sane values only
+ */
+void check_parallel() {
+    long seen = list_parallel_reduce(&list, map_checked, sum_values, 0, NULL);
+    if (seen < 0) {
+        atomic_store(&token_fail, true);
+    }
+}
+#endif
+
 /**
  * Thread implementation
  */
@@ -92,41 +189,96 @@ void* thread_function(void* arg) {
     
     printf("thread %d start\n", thread_id);
     
+    int token = TOKEN_BASE + 2 * thread_id;
+    insert_node(&list, token);
+    atomic_store(&token_live[thread_id], true);
+
     for (int i = 0; i < OPERATIONS_PER_THREAD; i++) {
         int operation = rand_r(&seed) % 3;
         int value = rand_r(&seed) % VALUE_RANGE;
         
         switch (operation) {
             case 0: // Insert
-                insert_node(&head, value);
+                insert_node(&list, value);
                 add_expected(value);
                 break;
             case 1: // Delete
-                delete_node(&head, value);
-                remove_expected(value);
+                if (delete_node(&list, value)) {
+                    remove_expected(value);
+                }
                 break;
             case 2: // Search
-                search(head, value);
+                search(&list, value);
                 break;
         }
+        // Every so often push a batch through as well
+        if (i % 100 == 99) {
+            run_batch(&seed);
+        }
+        if (i % 10 == 0 && !contains(&list, token)) { // Only this thread moves it, so it has to be there
+            printf("verification fail: thread %d lost its token\n", thread_id);
+            atomic_store(&token_fail, true);
+        }
+        if (i % 100 == 49) {
+            int moved = token ^ 1; // TOKEN_BASE is even, so this is the other key
+            insert_node(&list, moved);
+            delete_node(&list, token);
+            token = moved;
+            check_tokens();
+#ifdef LIST_IMAGE_C
+            if (thread_id == 0) {
+                check_parallel();
+            }
+#endif
+        }
+
         // Delay to cause thread interleaving
         if (rand_r(&seed) % 100 == 0) {
             usleep(1);
         }
     }
     
+    atomic_store(&token_live[thread_id], false);
+    delete_node(&list, token);
+
     printf("thread %d complete\n", thread_id);
     return NULL;
 }
 
+/**
+ * Running state for tally_value()
+ */
+typedef struct {
+    int* counts;
+    bool ok;
+} TallyState;
+
+/**
+ * Counts one occurrence of data
+ */
+void tally_value(int data, TallyState* state) {
+    if (data >= 0 && data < BUCKET_SIZE) {
+        state->counts[data]++;
+    } else {
+        printf("verification fail: value %d out of expected range\n", data);
+        state->ok = false;
+    }
+}
+
 /**
  * Comprehensive verification
  */
 bool verify_list() {
     printf("verifying integrity...\n");
     bool result = true;
+
+    // The sharded counters have to agree with a real walk
+    if (!validate_size(&list)) {
+        printf("verification fail: size counters off\n");
+        return false;
+    }
     
-    int actual_count = count_nodes(head); // Count actual nodes in list
+    int actual_count = count_nodes(&list); // Count actual nodes in list
     int expected_count = get_expected_count(); // Get expected count from tracker
 
     // Compare counts first
@@ -146,18 +298,15 @@ bool verify_list() {
         return false;
     }
     
-    pthread_rwlock_rdlock(&list_rwlock);
-    Node* current = head;
-    while (current != NULL) {
-        if (current->data >= 0 && current->data < BUCKET_SIZE) {
-            list_counts[current->data]++;
-        } else {
-            printf("verification fail: value %d out of expected range\n", current->data);
-            result = false;
-        }
-        current = current->next;
+    TallyState tally = { list_counts, true };
+    ListIter it;
+    int data;
+    list_iter_begin(&list, &it, ITER_SNAPSHOT);
+    while (list_iter_next(&it, &data)) {
+        tally_value(data, &tally);
     }
-    pthread_rwlock_unlock(&list_rwlock);
+    list_iter_end(&it);
+    result = result && tally.ok;
     
     // Compare with expected
     for (int i = 0; i < BUCKET_SIZE; i++) {
@@ -175,12 +324,270 @@ bool verify_list() {
     return result;
 }
 
+/**
+ * Looks up every value with one contains_many() and checks it against the expected values
+ */
+bool verify_batches() {
+    int keys[VALUE_RANGE];
+    bool found[VALUE_RANGE];
+    for (int i = 0; i < VALUE_RANGE; i++) {
+        keys[i] = VALUE_RANGE - 1 - i; // Backwards so the sort has something to do
+    }
+
+    int hits = contains_many(&list, keys, VALUE_RANGE, found);
+    int expected_hits = 0;
+    for (int i = 0; i < VALUE_RANGE; i++) {
+        bool expected = expected_values[keys[i]].count > 0;
+        expected_hits += expected;
+        if (found[i] != expected) {
+            printf("verification fail: contains_many says %d is%s there\n", keys[i], found[i] ? "" : " not");
+            return false;
+        }
+    }
+    if (hits != expected_hits) {
+        printf("verification fail: contains_many found %d, expected %d\n", hits, expected_hits);
+        return false;
+    }
+    return true;
+}
+
 /**
  * Runs the tests
  */
+#ifdef LIST_IMAGE_C // unrolled-list.c has no images or bulk loads
+/**
+ * Whether two lists hold the same values right now
+ */
+bool same_values(List* a, List* b) {
+    ListIter x, y;
+    int dx, dy;
+    bool same = true;
+    list_iter_begin(a, &x, ITER_SNAPSHOT);
+    list_iter_begin(b, &y, ITER_SNAPSHOT);
+    while (same) {
+        bool more = list_iter_next(&x, &dx);
+        if (more != list_iter_next(&y, &dy)) {
+            same = false;
+        } else if (!more) {
+            break;
+        } else {
+            same = dx == dy;
+        }
+    }
+    list_iter_end(&x);
+    list_iter_end(&y);
+    return same;
+}
+
+/**
+ * Saves the list, maps it back in and checks the copy reads the same,
+ * then that the first write promotes it without losing anything
+ */
+bool verify_image() {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/list-image-%d", (int)getpid());
+    if (!list_save(&list, path)) {
+        printf("verification fail: list_save\n");
+        return false;
+    }
+    List copy;
+    bool opened = list_open_mmap(&copy, LIST_MODE, path);
+    unlink(path); // The mapping keeps the data
+    if (!opened) {
+        printf("verification fail: list_open_mmap\n");
+        return false;
+    }
+
+    int keys[VALUE_RANGE];
+    bool found[VALUE_RANGE];
+    for (int i = 0; i < VALUE_RANGE; i++) {
+        keys[i] = i;
+    }
+    contains_many(&copy, keys, VALUE_RANGE, found);
+    for (int i = 0; i < VALUE_RANGE; i++) {
+        if (found[i] != (expected_values[i].count > 0)) {
+            printf("verification fail: mapped image says %d is%s there\n", i, found[i] ? "" : " not");
+            list_destroy(&copy);
+            return false;
+        }
+    }
+    bool ok = same_values(&list, &copy) && validate_size(&copy);
+
+    // First write builds the nodes, after which it's an ordinary list
+    insert_node(&copy, VALUE_RANGE);
+    ok = ok && delete_node(&copy, VALUE_RANGE);
+    ok = ok && same_values(&list, &copy) && validate_size(&copy) && count_nodes(&copy) == count_nodes(&list);
+    if (!ok) {
+        printf("verification fail: mapped image doesn't match the list\n");
+    }
+    list_destroy(&copy);
+    return ok;
+}
+
+/**
+ * Parallel for_each callback, counts a value with atomics
+ */
+void tally_atomic(int data, void* arg) {
+    _Atomic int* counts = (_Atomic int*)arg;
+    if (data >= 0 && data < BUCKET_SIZE) {
+        atomic_fetch_add(&counts[data], 1);
+    } else {
+        atomic_fetch_add(&counts[BUCKET_SIZE], 1); // Out of range bucket
+    }
+}
+
+long map_value(int data, void* arg) {
+    (void)arg;
+    return data;
+}
+
+/**
+ * Parallel passes against the expected values, then over a big bulk loaded
+ * list as it gets written to, then a parallel free of it
+ */
+bool verify_parallel() {
+    list_parallel_threads = NUM_THREADS; // Split even on a single CPU
+    _Atomic int* counts = calloc(BUCKET_SIZE + 1, sizeof(_Atomic int));
+    if (counts == NULL) {
+        perror("calloc failed for counts");
+        exit(EXIT_FAILURE);
+    }
+    list_parallel_for_each(&list, tally_atomic, (void*)counts);
+    bool ok = atomic_load(&counts[BUCKET_SIZE]) == 0;
+    long expected_sum = 0;
+    for (int i = 0; i < BUCKET_SIZE && ok; i++) {
+        int expected = expected_values[i].used ? expected_values[i].count : 0;
+        ok = atomic_load(&counts[i]) == expected;
+        expected_sum += (long)i * expected;
+    }
+    free(counts);
+    ok = ok && list_parallel_reduce(&list, map_value, sum_values, 0, NULL) == expected_sum;
+
+    int n = 100000;
+    int* keys = malloc(n * sizeof(int));
+    if (keys == NULL) {
+        perror("malloc failed for keys");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++) {
+        keys[i] = i;
+    }
+    List big;
+    ok = ok && list_bulk_load(&big, LIST_MODE, keys, n);
+    long sum = (long)n * (n - 1) / 2;
+    ok = ok && list_parallel_reduce(&big, map_value, sum_values, 0, NULL) == sum;
+    int m = 0;
+    for (int i = 0; i < n; i += 7) { // Takes out plenty of anchors
+        keys[m++] = i;
+        sum -= i;
+    }
+    bool* deleted = malloc(m * sizeof(bool));
+    if (deleted == NULL) {
+        perror("malloc failed for deleted");
+        exit(EXIT_FAILURE);
+    }
+    ok = ok && delete_many(&big, keys, m, deleted) == m;
+    free(deleted);
+    for (int i = 0; i < 5000; i++) {
+        keys[i] = n + i;
+        sum += n + i;
+    }
+    insert_many(&big, keys, 5000);
+    ok = ok && list_parallel_reduce(&big, map_value, sum_values, 0, NULL) == sum && validate_size(&big);
+    ok = ok && list_parallel_reduce(&big, map_value, sum_values, 0, NULL) == sum; // Again on the new anchors
+#ifdef EBR_C
+    ebr_drain();
+#endif
+    list_destroy(&big);
+    free(keys);
+    if (!ok) {
+        printf("verification fail: parallel pass\n");
+    }
+    return ok;
+}
+
+/**
+ * Bulk loads every even value from an array and from a file and checks both,
+ * then that input out of order gets turned down
+ */
+bool verify_bulk_load() {
+    int n = VALUE_RANGE / 2;
+    int keys[VALUE_RANGE / 2];
+    for (int i = 0; i < n; i++) {
+        keys[i] = i * 2;
+    }
+    List loaded, streamed, rejected;
+    bool ok = list_bulk_load(&loaded, LIST_MODE, keys, n);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/list-keys-%d", (int)getpid());
+    FILE* file = fopen(path, "wb");
+    ok = ok && file != NULL && fwrite(keys, sizeof(int), n, file) == (size_t)n;
+    if (file != NULL) {
+        fclose(file);
+    }
+    int fd = open(path, O_RDONLY);
+    ok = ok && list_bulk_load_fd(&streamed, LIST_MODE, fd, n);
+    close(fd);
+    unlink(path);
+
+    int probe[VALUE_RANGE];
+    bool found[VALUE_RANGE];
+    for (int i = 0; i < VALUE_RANGE; i++) {
+        probe[i] = i;
+    }
+    ok = ok && contains_many(&loaded, probe, VALUE_RANGE, found) == n;
+    for (int i = 0; i < VALUE_RANGE && ok; i++) {
+        ok = found[i] == (i % 2 == 0);
+    }
+    ok = ok && same_values(&loaded, &streamed) && count_nodes(&loaded) == n && validate_size(&loaded);
+    insert_node(&loaded, 1);
+    ok = ok && contains(&loaded, 1);
+
+    keys[0] = VALUE_RANGE; // Out of order now
+    ok = ok && !list_bulk_load(&rejected, LIST_MODE, keys, n) && count_nodes(&rejected) == 0;
+    if (!ok) {
+        printf("verification fail: bulk load\n");
+    }
+    list_destroy(&loaded);
+    list_destroy(&streamed);
+    list_destroy(&rejected);
+    return ok;
+}
+#endif
+
+/**
+ * Snapshots a list that never had anything in it
+ */
+bool verify_empty() {
+    List empty;
+    list_init(&empty, LIST_MODE);
+    ListIter it;
+    int data;
+    list_iter_begin(&empty, &it, ITER_SNAPSHOT);
+    bool ok = it.count == 0 && !list_iter_next(&it, &data);
+    list_iter_end(&it);
+#ifdef LIST_IMAGE_C
+    list_destroy(&empty); // LIST_LAZY has a sentinel to give back
+#else
+    free_list(&empty);
+#endif
+    if (!ok) {
+        printf("verification fail: snapshot of an empty list\n");
+    }
+    return ok;
+}
+
 int main() {
     srand(time(NULL)); // Initialize random seed
     init_expected_values(); // Initialize expected values array
+    list_init(&list, LIST_MODE);
+#ifdef TEST_ADAPTIVE
+    list_set_adaptive(&list, true); // Lookups reorder the list under everything else
+#endif
+#ifdef TEST_FILTER
+    list_set_filter(&list, VALUE_RANGE, 0.01); // Every insert and delete keeps it in step
+#endif
     
     // Create threads
     pthread_t threads[NUM_THREADS];
@@ -210,18 +617,31 @@ int main() {
     
     // Print final list
     printf("Final ");
-    print_list(head);
+    print_list(&list);
     
+#ifdef LIST_STATS
+    ListStats stats = list_stats_snapshot(); // make STATS=1
+    list_stats_print(&stats);
+#endif
+
     // Verify integrity
-    if (verify_list()) {
+    bool ok = !atomic_load(&token_fail) && verify_list() && verify_batches() && verify_empty();
+#ifdef LIST_IMAGE_C
+    ok = ok && verify_image() && verify_bulk_load() && verify_parallel();
+#endif
+    if (ok) {
         printf("verification pass\n");
     } else {
         printf("verification fail\n");
     }
     
     // Clean up
-    free_list(head);
+#ifdef EBR_C
+    ebr_drain(); // LIST_LAZY deletes are still waiting in limbo
+#endif
+    free_list(&list);
+    pool_destroy_all();
     free(expected_values);
     
-    return 0;
+    return ok ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,458 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include "node-pool.c"
+#include "batch.c"
+#include "stats.c"
+#include "snapshot.c"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Unrolled list, same API as linked-list.c
+ *
+ * Every node is a 64 byte Block holding up to UNROLL_KEYS sorted keys, so a
+ * scan takes one cache miss per block instead of one per key, and a key costs
+ * 5-11 bytes instead of a whole Node. Blocks stay in order (last key of a
+ * block <= first key of the next), so a walk only looks at each block's last
+ * key until it reaches the block that could hold the value, then compares all
+ * of its keys at once with AVX2 or SSE2 (plain loop if neither is there).
+ *
+ * A full block splits in half on insert. A block that drops under half full on
+ * delete swallows its successor if they fit in one block, and an empty block
+ * is unlinked. One reader-writer lock per list like LIST_RWLOCK, duplicates
+ * are kept like insert_node().
+ */
+
+#define UNROLL_KEYS 12 // Fills the cache line, the SIMD compares below assume 12
+
+typedef enum {
+    LIST_RWLOCK
+} ListMode;
+
+typedef struct Block {
+    int keys[UNROLL_KEYS];  // keys[0 .. count-1] are valid and sorted
+    int count;              // Never 0 while linked
+    struct Block* next;
+} Block;
+
+typedef struct List {
+    Block* head;
+    long size;              // Keys in the list, under the write lock
+    pthread_rwlock_t rwlock;
+} List;
+
+NodePool block_pool = NODE_POOL_INIT(Block); // 64 byte slots, cache line aligned
+
+/**
+ * Allocates an empty block
+ */
+Block* create_block(void) {
+    Block* block = (Block*)pool_alloc(&block_pool);
+    block->count = 0;
+    block->next = NULL;
+    return block;
+}
+
+/**
+ * Sets up an empty list, there's only the one mode
+ */
+void list_init(List* list, ListMode mode) {
+    (void)mode;
+    list->head = NULL;
+    list->size = 0;
+    pthread_rwlock_init(&list->rwlock, NULL);
+}
+
+/**
+ * Index of the first copy of data in a block, -1 if it's not there
+ */
+static inline int block_find(Block* block, int data) {
+    unsigned mask;
+#if defined(__AVX2__)
+    __m256i key = _mm256_set1_epi32(data);
+    __m256i lo = _mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i*)&block->keys[0]), key);
+    __m256i hi = _mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i*)&block->keys[4]), key); // Overlaps lo, that's fine
+    mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(lo)) |
+           ((unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 4);
+#elif defined(__SSE2__)
+    __m128i key = _mm_set1_epi32(data);
+    mask = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i*)&block->keys[0]), key))) |
+           ((unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i*)&block->keys[4]), key))) << 4) |
+           ((unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i*)&block->keys[8]), key))) << 8);
+#else
+    mask = 0;
+    for (int i = 0; i < block->count; i++) {
+        if (block->keys[i] == data) {
+            mask |= 1u << i;
+        }
+    }
+#endif
+    mask &= (1u << block->count) - 1; // Slots past count are leftovers
+    return mask != 0 ? __builtin_ctz(mask) : -1;
+}
+
+/**
+ * First block after start (NULL for head) whose last key is >= data, or the last block
+ * prev_ptr gets the block before it, call with the lock held
+ */
+static inline Block* locate(List* list, Block* start, int data, Block** prev_ptr) {
+    Block* prev = start;
+    Block* block = start != NULL ? start->next : list->head;
+    while (block != NULL && block->next != NULL && block->keys[block->count - 1] < data) {
+        prev = block;
+        block = block->next;
+    }
+    *prev_ptr = prev;
+    return block;
+}
+
+/**
+ * Insert a key in order, splits the block if it's full
+ * Starts looking after start, returns where the next key of an ascending
+ * batch can start. Call with the write lock held
+ */
+static Block* insert_locked(List* list, Block* start, int data) {
+    Block* prev;
+    Block* block = locate(list, start, data, &prev);
+    if (block == NULL) { // Empty list, or start's successor got merged away
+        block = prev;
+        if (block == NULL) {
+            block = create_block();
+            list->head = block;
+        }
+    }
+
+    int pos = 0;
+    while (pos < block->count && block->keys[pos] <= data) { // After any copies already there
+        pos++;
+    }
+
+    if (block->count == UNROLL_KEYS) { // Move the top half into a new block
+        int half = UNROLL_KEYS / 2;
+        Block* upper = create_block();
+        memcpy(upper->keys, &block->keys[half], (UNROLL_KEYS - half) * sizeof(int));
+        upper->count = UNROLL_KEYS - half;
+        block->count = half;
+        upper->next = block->next;
+        block->next = upper;
+        if (pos > half) {
+            block = upper;
+            pos -= half;
+        }
+    }
+
+    memmove(&block->keys[pos + 1], &block->keys[pos], (block->count - pos) * sizeof(int));
+    block->keys[pos] = data;
+    block->count++;
+    list->size++;
+    return prev;
+}
+
+/**
+ * Deletes one copy of a key looking after *start, *start gets where the next
+ * key of an ascending batch can start. Call with the write lock held
+ * Merges the block with its successor once it gets under half full
+ */
+static bool delete_locked(List* list, Block** start, int data) {
+    Block* prev;
+    Block* block = locate(list, *start, data, &prev);
+    *start = prev; // Never freed below, only block or its successor can go
+    int pos = block != NULL ? block_find(block, data) : -1;
+    if (pos < 0) {
+        return false;
+    }
+
+    block->count--;
+    memmove(&block->keys[pos], &block->keys[pos + 1], (block->count - pos) * sizeof(int));
+    list->size--;
+
+    Block* next = block->next;
+    if (block->count == 0) {
+        if (prev == NULL) {
+            list->head = next;
+        } else {
+            prev->next = next;
+        }
+        pool_free(block);
+    } else if (next != NULL && block->count < UNROLL_KEYS / 2 && block->count + next->count <= UNROLL_KEYS) {
+        memcpy(&block->keys[block->count], next->keys, next->count * sizeof(int));
+        block->count += next->count;
+        block->next = next->next;
+        pool_free(next);
+    }
+    return true;
+}
+
+/**
+ * Insert a key in order
+ */
+void insert_node(List* list, int data) {
+    STAT_LOCK(pthread_rwlock_wrlock(&list->rwlock));
+    insert_locked(list, NULL, data);
+    pthread_rwlock_unlock(&list->rwlock);
+}
+
+/**
+ * Deletes one copy of a key, returns whether it was there
+ */
+bool delete_node(List* list, int data) {
+    Block* start = NULL;
+    STAT_LOCK(pthread_rwlock_wrlock(&list->rwlock));
+    bool deleted = delete_locked(list, &start, data);
+    pthread_rwlock_unlock(&list->rwlock);
+    return deleted;
+}
+
+/**
+ * Returns the block holding a key, uses the read lock
+ * The block can change once the lock is dropped, use contains() unless
+ * nothing else is writing
+ */
+Block* search(List* list, int data) {
+    STAT_LOCK(pthread_rwlock_rdlock(&list->rwlock));
+
+    Block* prev;
+    Block* block = locate(list, NULL, data, &prev);
+    if (block != NULL && block_find(block, data) < 0) {
+        block = NULL;
+    }
+
+    pthread_rwlock_unlock(&list->rwlock);
+    return block;
+}
+
+/**
+ * Checks if a value exists in the list
+ */
+bool contains(List* list, int data) {
+    return search(list, data) != NULL;
+}
+
+/**
+ * Insert a batch of keys under one lock, sorts keys in place
+ * Each key's walk carries on from where the previous one went in
+ */
+void insert_many(List* list, int* keys, int n) {
+    batch_sort(keys, n);
+    STAT_LOCK(pthread_rwlock_wrlock(&list->rwlock));
+    Block* start = NULL;
+    for (int i = 0; i < n; i++) {
+        start = insert_locked(list, start, keys[i]);
+    }
+    pthread_rwlock_unlock(&list->rwlock);
+}
+
+/**
+ * Delete one copy per key in a batch under one lock, sorts keys in place
+ * deleted[i] says whether keys[i] (after sorting) was there, returns how many were
+ */
+int delete_many(List* list, int* keys, int n, bool* deleted) {
+    int count = 0;
+    batch_sort(keys, n);
+    STAT_LOCK(pthread_rwlock_wrlock(&list->rwlock));
+    Block* start = NULL;
+    for (int i = 0; i < n; i++) {
+        deleted[i] = delete_locked(list, &start, keys[i]);
+        count += deleted[i];
+    }
+    pthread_rwlock_unlock(&list->rwlock);
+    return count;
+}
+
+/**
+ * Look up a batch of keys in one pass, sorts keys in place
+ * found[i] says whether keys[i] (after sorting) is in the list, returns how many are
+ */
+int contains_many(List* list, int* keys, int n, bool* found) {
+    int count = 0;
+    batch_sort(keys, n);
+    STAT_LOCK(pthread_rwlock_rdlock(&list->rwlock));
+    Block* block = list->head;
+    for (int i = 0; i < n; i++) {
+        while (block != NULL && block->next != NULL && block->keys[block->count - 1] < keys[i]) {
+            block = block->next;
+        }
+        found[i] = block != NULL && block_find(block, keys[i]) >= 0;
+        count += found[i];
+    }
+    pthread_rwlock_unlock(&list->rwlock);
+    return count;
+}
+
+/*
+ * Iterators, same API as linked-list.c. ITER_WEAK holds the read lock from
+ * list_iter_begin() to list_iter_end(); ITER_SNAPSHOT copies the keys under
+ * the read lock and lets go straight away. Both hand keys back in order.
+ */
+
+typedef struct ListIter {
+    List* list;
+    IterMode mode;
+    Block* block;  // ITER_WEAK: where we are
+    int index;
+    int* values;   // ITER_SNAPSHOT: the copy
+    long count;
+    long pos;
+} ListIter;
+
+/**
+ * Starts an iterator
+ */
+void list_iter_begin(List* list, ListIter* it, IterMode mode) {
+    it->list = list;
+    it->mode = mode;
+    it->block = NULL;
+    it->index = 0;
+    it->values = NULL;
+    it->count = 0;
+    it->pos = 0;
+    STAT_LOCK(pthread_rwlock_rdlock(&list->rwlock));
+    if (mode == ITER_WEAK) {
+        it->block = list->head;
+        return;
+    }
+
+    it->values = malloc((list->size > 0 ? list->size : 1) * sizeof(int));
+    if (it->values == NULL) {
+        printf("malloc fail\n");
+        exit(1);
+    }
+    for (Block* block = list->head; block != NULL; block = block->next) {
+        memcpy(&it->values[it->count], block->keys, block->count * sizeof(int));
+        it->count += block->count;
+    }
+    pthread_rwlock_unlock(&list->rwlock);
+}
+
+/**
+ * Next key, false once there are no more
+ */
+bool list_iter_next(ListIter* it, int* data) {
+    if (it->mode == ITER_SNAPSHOT) {
+        if (it->pos == it->count) {
+            return false;
+        }
+        *data = it->values[it->pos++];
+        return true;
+    }
+    while (it->block != NULL && it->index == it->block->count) {
+        it->block = it->block->next;
+        it->index = 0;
+    }
+    if (it->block == NULL) {
+        return false;
+    }
+    *data = it->block->keys[it->index++];
+    return true;
+}
+
+/**
+ * Done with an iterator
+ */
+void list_iter_end(ListIter* it) {
+    if (it->mode == ITER_SNAPSHOT) {
+        free(it->values);
+    } else {
+        pthread_rwlock_unlock(&it->list->rwlock);
+    }
+}
+
+/**
+ * Calls cb on every value in order, holds the read lock
+ */
+void list_for_each(List* list, void (*cb)(int data, void* arg), void* arg) {
+    ListIter it;
+    int data;
+    list_iter_begin(list, &it, ITER_WEAK);
+    while (list_iter_next(&it, &data)) {
+        cb(data, arg);
+    }
+    list_iter_end(&it);
+}
+
+/**
+ * Print callback
+ */
+void print_value(int data, void* arg) {
+    (void)arg;
+    printf("%d -> ", data);
+}
+
+/**
+ * Prints list contents
+ */
+void print_list(List* list) {
+    if (list->head == NULL) {
+        printf("empty list\n");
+        return;
+    }
+
+    printf("List: ");
+    list_for_each(list, print_value, NULL);
+    printf("END\n");
+}
+
+/**
+ * Count nodes in list, kept by insert/delete
+ */
+int count_nodes(List* list) {
+    STAT_LOCK(pthread_rwlock_rdlock(&list->rwlock));
+    long size = list->size;
+    pthread_rwlock_unlock(&list->rwlock);
+    return (int)size;
+}
+
+/**
+ * Debug check: walks the blocks, checks they're non-empty and in order
+ * and that the keys add up to the size
+ */
+bool validate_size(List* list) {
+    bool ok = true;
+    long walked = 0;
+    int last = 0;
+
+    STAT_LOCK(pthread_rwlock_rdlock(&list->rwlock));
+    for (Block* block = list->head; block != NULL; block = block->next) {
+        if (block->count < 1 || block->count > UNROLL_KEYS) {
+            printf("bad block: holds %d keys\n", block->count);
+            ok = false;
+            break;
+        }
+        for (int i = 0; i < block->count; i++) {
+            if (walked > 0 && block->keys[i] < last) {
+                printf("out of order: %d after %d\n", block->keys[i], last);
+                ok = false;
+            }
+            last = block->keys[i];
+            walked++;
+        }
+    }
+    if (ok && walked != list->size) {
+        printf("size mismatch: walked %ld keys, list says %ld\n", walked, list->size);
+        ok = false;
+    }
+    pthread_rwlock_unlock(&list->rwlock);
+    return ok;
+}
+
+/**
+ * Free memory used by the list, leaves it empty and usable
+ */
+void free_list(List* list) {
+    STAT_LOCK(pthread_rwlock_wrlock(&list->rwlock));
+
+    Block* block = list->head;
+    while (block != NULL) {
+        Block* next = block->next;
+        pool_free(block);
+        block = next;
+    }
+    list->head = NULL;
+    list->size = 0;
+
+    pthread_rwlock_unlock(&list->rwlock);
+}